@@ -41,6 +41,7 @@
 #include "blk.h"
 #include "blk-mq.h"
 #include "blk-mq-sched.h"
+#include "blk-stat.h"
 #include "blk-wbt.h"
 
 #ifdef CONFIG_DEBUG_FS
@@ -857,6 +858,8 @@ struct request_queue *blk_alloc_queue_node(gfp_t gfp_mask, int node_id)
 	q->backing_dev_info->capabilities = BDI_CAP_CGROUP_WRITEBACK;
 	q->backing_dev_info->name = "block";
 	q->node = node_id;
+	q->plug_max_count = BLK_MAX_REQUEST_COUNT;
+	q->plug_flush_size = BLK_PLUG_FLUSH_SIZE;
 
 	setup_timer(&q->backing_dev_info->laptop_mode_wb_timer,
 		    laptop_mode_timer_fn, (unsigned long) q);
@@ -1793,6 +1796,116 @@ unsigned int blk_plug_queued_count(struct request_queue *q)
 	return ret;
 }
 
+/*
+ * Adaptive plugging. With QUEUE_FLAG_ADAPTIVE_PLUG set, the number of
+ * requests and the size of the last request a plug may hold before it is
+ * flushed follow the mean completion latency of the device, sampled over
+ * BLK_PLUG_STAT_MSECS windows. Slow devices (eMMC) keep requests plugged
+ * longer so that more small writes get merged, fast devices flush early.
+ */
+#define BLK_PLUG_STAT_MSECS	100
+#define BLK_PLUG_FAST_LAT_NSEC	(250 * NSEC_PER_USEC)
+#define BLK_PLUG_SLOW_LAT_NSEC	(2 * NSEC_PER_MSEC)
+#define BLK_PLUG_MIN_COUNT	(BLK_MAX_REQUEST_COUNT / 4)
+#define BLK_PLUG_MAX_COUNT	(BLK_MAX_REQUEST_COUNT * 4)
+
+static int blk_plug_stat_bucket(const struct request *rq)
+{
+	return blk_rq_is_passthrough(rq) ? -1 : 0;
+}
+
+static void blk_plug_stat_timer_fn(struct blk_stat_callback *cb)
+{
+	struct request_queue *q = cb->data;
+	unsigned int count = q->plug_max_count;
+	u64 mean;
+
+	if (!cb->stat[0].nr_samples)
+		return;
+
+	/* move one step per window to avoid bouncing on noisy samples */
+	mean = cb->stat[0].mean;
+	if (mean < BLK_PLUG_FAST_LAT_NSEC)
+		count = max_t(unsigned int, count / 2, BLK_PLUG_MIN_COUNT);
+	else if (mean > BLK_PLUG_SLOW_LAT_NSEC)
+		count = min_t(unsigned int, count * 2, BLK_PLUG_MAX_COUNT);
+	else if (count > BLK_MAX_REQUEST_COUNT)
+		count /= 2;
+	else if (count < BLK_MAX_REQUEST_COUNT)
+		count *= 2;
+
+	WRITE_ONCE(q->plug_flush_size,
+		   BLK_PLUG_FLUSH_SIZE / BLK_MAX_REQUEST_COUNT * count);
+	WRITE_ONCE(q->plug_max_count, count);
+}
+
+/**
+ * blk_plug_should_flush - check if the plug has to be flushed
+ * @q: queue the next request is going to be plugged for
+ * @request_count: requests for @q already on the plug list
+ * @last: last request on the plug list, may be NULL
+ */
+bool blk_plug_should_flush(struct request_queue *q, unsigned int request_count,
+			   struct request *last)
+{
+	struct blk_stat_callback *cb;
+
+	if (test_bit(QUEUE_FLAG_ADAPTIVE_PLUG, &q->queue_flags)) {
+		/*
+		 * The flag may be seen before plug_cb on the first enable,
+		 * pairs with smp_store_release() in blk_adaptive_plug_enable().
+		 */
+		cb = smp_load_acquire(&q->plug_cb);
+		if (cb && !blk_stat_is_active(cb))
+			blk_stat_activate_msecs(cb, BLK_PLUG_STAT_MSECS);
+	}
+
+	return request_count >= READ_ONCE(q->plug_max_count) ||
+	       (last && blk_rq_bytes(last) >= READ_ONCE(q->plug_flush_size));
+}
+
+int blk_adaptive_plug_enable(struct request_queue *q, bool enable)
+{
+	if (enable == test_bit(QUEUE_FLAG_ADAPTIVE_PLUG, &q->queue_flags))
+		return 0;
+
+	if (!enable) {
+		clear_bit(QUEUE_FLAG_ADAPTIVE_PLUG, &q->queue_flags);
+		blk_stat_remove_callback(q, q->plug_cb);
+		q->plug_max_count = BLK_MAX_REQUEST_COUNT;
+		q->plug_flush_size = BLK_PLUG_FLUSH_SIZE;
+		return 0;
+	}
+
+	/* the callback is kept until the queue is released once allocated */
+	if (!q->plug_cb) {
+		struct blk_stat_callback *cb;
+
+		cb = blk_stat_alloc_callback(blk_plug_stat_timer_fn,
+					     blk_plug_stat_bucket, 1, q);
+		if (!cb)
+			return -ENOMEM;
+		smp_store_release(&q->plug_cb, cb);
+	}
+
+	blk_stat_add_callback(q, q->plug_cb);
+	smp_mb__before_atomic();
+	set_bit(QUEUE_FLAG_ADAPTIVE_PLUG, &q->queue_flags);
+	return 0;
+}
+
+void blk_adaptive_plug_exit(struct request_queue *q)
+{
+	if (!q->plug_cb)
+		return;
+
+	if (test_bit(QUEUE_FLAG_ADAPTIVE_PLUG, &q->queue_flags))
+		blk_stat_remove_callback(q, q->plug_cb);
+	else
+		del_timer_sync(&q->plug_cb->timer);
+	blk_stat_free_callback(q->plug_cb);
+}
+
 void blk_init_request_from_bio(struct request *req, struct bio *bio)
 {
 	struct io_context *ioc = rq_ioc(bio);
@@ -1922,8 +2035,7 @@ static blk_qc_t blk_queue_bio(struct request_queue *q, struct bio *bio)
 			trace_block_plug(q);
 		else {
 			struct request *last = list_entry_rq(plug->list.prev);
-			if (request_count >= BLK_MAX_REQUEST_COUNT ||
-			    blk_rq_bytes(last) >= BLK_PLUG_FLUSH_SIZE) {
+			if (blk_plug_should_flush(q, request_count, last)) {
 				blk_flush_plug_list(plug, false);
 				trace_block_plug(q);
 			}
@@ -14,10 +14,15 @@
  * TODO :
  * We need to agonize what lock we use between spin_lock_irq and spin_lock
  * for algorithm_manager.
+ *
+ * The algorithm list is only modified under alg_manager.lock. Lookups walk
+ * it under RCU, so that resolving the context of every new key does not
+ * serialize on the global lock.
  */
 
 #include <linux/module.h>
 #include <linux/blkdev.h>
+#include <linux/rculist.h>
 #include <crypto/skcipher.h>
 
 #define BLK_CRYPT_ALG_NAMELEN_MAX	(15)
@@ -27,6 +32,7 @@
 struct blk_crypt_algorithm {
 	struct list_head list;
 	atomic_t ref;
+	bool dead;
 	unsigned int mode;
 	struct block_device *bdev;
 	char name[BLK_CRYPT_ALG_NAMELEN_MAX+1];
@@ -42,7 +48,7 @@ struct blk_crypt_algorithm_manager {
 	struct list_head list;
 	spinlock_t lock;
 	atomic_t ref;
-	struct blk_crypt_algorithm *last_acc;
+	struct blk_crypt_algorithm __rcu *last_acc;
 };
 
 /* Initialize algorithm manager */
@@ -56,6 +62,34 @@ static struct blk_crypt_algorithm_manager alg_manager = {
 static struct kmem_cache *blk_crypt_cachep = NULL;
 
 /* Static functions */
+static bool blk_crypt_alg_match(struct blk_crypt_algorithm *alg,
+		struct block_device *bdev, const char *cipher_str)
+{
+	if (strcmp(alg->name, cipher_str))
+		return false;
+
+	if (alg->bdev && alg->bdev != bdev)
+		return false;
+
+	return true;
+}
+
+/*
+ * Take a reference on @alg found under RCU. It fails if the algorithm is
+ * being unregistered, see blk_crypt_alg_unregister().
+ */
+static bool blk_crypt_alg_get(struct blk_crypt_algorithm *alg)
+{
+	atomic_inc(&alg->ref);
+	smp_mb__after_atomic();
+	if (unlikely(READ_ONCE(alg->dead))) {
+		atomic_dec(&alg->ref);
+		return false;
+	}
+
+	return true;
+}
+
 /**
  * blk_crypt_alloc_context() - allocate blk_crypt_context structure
  * @mode: filesystem encryption mode.
@@ -68,39 +102,38 @@ static struct kmem_cache *blk_crypt_cachep = NULL;
  */
 static blk_crypt_t *blk_crypt_alloc_context(struct block_device *bdev, const char *cipher_str)
 {
-	struct blk_crypt_algorithm *alg;
-	struct blk_crypt_context *bctx;
+	struct blk_crypt_algorithm *alg, *found = NULL;
+	struct blk_crypt_context *bctx = NULL;
 	int res = -ENOENT;
 
-	spin_lock_irq(&alg_manager.lock);
-	if (alg_manager.last_acc && !strcmp(alg_manager.last_acc->name, cipher_str)) {
-		alg = alg_manager.last_acc;
-		atomic_inc(&alg->ref);
+	rcu_read_lock();
+	alg = rcu_dereference(alg_manager.last_acc);
+	if (alg && blk_crypt_alg_match(alg, bdev, cipher_str) &&
+	    blk_crypt_alg_get(alg)) {
+		found = alg;
 		goto unlock;
 	}
 
-	list_for_each_entry(alg, &alg_manager.list, list) {
-		if (strcmp(alg->name, cipher_str)) {
-			pr_info("blk-crypt: no matched alg(%s) != requested alg(%s)\n",
+	list_for_each_entry_rcu(alg, &alg_manager.list, list) {
+		if (!blk_crypt_alg_match(alg, bdev, cipher_str)) {
+			pr_debug("blk-crypt: no matched alg(%s) for requested alg(%s)\n",
 				alg->name, cipher_str);
 			continue;
 		}
 
-		if (alg->bdev && alg->bdev != bdev) {
-			pr_info("blk-crypt: no matched alg(%s)->bdev != bdev\n",
-				cipher_str);
+		if (!blk_crypt_alg_get(alg))
 			continue;
-		}
 
-		alg_manager.last_acc = alg;
-		atomic_inc(&alg->ref);
+		rcu_assign_pointer(alg_manager.last_acc, alg);
+		found = alg;
 		break;
 	}
 unlock:
-	spin_unlock_irq(&alg_manager.lock);
+	rcu_read_unlock();
 
-	if (alg == (void *)&alg_manager.list)
+	if (!found)
 		return ERR_PTR(-ENOENT);
+	alg = found;
 
 	bctx = kmem_cache_zalloc(blk_crypt_cachep, GFP_NOFS);
 	if (!bctx) {
@@ -283,7 +316,7 @@ void *blk_crypt_alg_register(struct block_device *bdev, const char *name,
 	}
 
 	/* Add to algorithm manager */
-	list_add(&new_alg->list, &alg_manager.list);
+	list_add_rcu(&new_alg->list, &alg_manager.list);
 	spin_unlock_irq(&alg_manager.lock);
 	pr_info("blk_crypt: registed algorithm(%s)\n", name);
 
@@ -306,15 +339,30 @@ int blk_crypt_alg_unregister(void *handle)
 
 	alg = (struct blk_crypt_algorithm *)handle;
 
-	/* prevent unregister if an algorithm is  being referenced */
-	if (atomic_read(&alg->ref))
+	spin_lock_irq(&alg_manager.lock);
+
+	/*
+	 * prevent unregister if an algorithm is being referenced. Lookups
+	 * take their reference before checking alg->dead, so either they
+	 * see it or we see their reference.
+	 */
+	WRITE_ONCE(alg->dead, true);
+	smp_mb();
+	if (atomic_read(&alg->ref)) {
+		WRITE_ONCE(alg->dead, false);
+		spin_unlock_irq(&alg_manager.lock);
 		return -EBUSY;
+	}
 
 	/* just unlink this algorithm from the manager */
-	spin_lock_irq(&alg_manager.lock);
-	list_del_init(&alg->list);
+	list_del_rcu(&alg->list);
+	if (rcu_access_pointer(alg_manager.last_acc) == alg)
+		RCU_INIT_POINTER(alg_manager.last_acc, NULL);
 	spin_unlock_irq(&alg_manager.lock);
 
+	/* wait for lookups that may still walk over it */
+	synchronize_rcu();
+
 	kfree(handle);
 	return 0;
 }
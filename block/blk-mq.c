@@ -1709,8 +1709,7 @@ static blk_qc_t blk_mq_make_request(struct request_queue *q, struct bio *bio)
 		else
 			last = list_entry_rq(plug->mq_list.prev);
 
-		if (request_count >= BLK_MAX_REQUEST_COUNT || (last &&
-		    blk_rq_bytes(last) >= BLK_PLUG_FLUSH_SIZE)) {
+		if (blk_plug_should_flush(q, request_count, last)) {
 			blk_flush_plug_list(plug, false);
 			trace_block_plug(q);
 		}
@@ -433,6 +433,30 @@ static ssize_t queue_poll_store(struct request_queue *q, const char *page,
 	return ret;
 }
 
+static ssize_t queue_adaptive_plug_show(struct request_queue *q, char *page)
+{
+	return queue_var_show(test_bit(QUEUE_FLAG_ADAPTIVE_PLUG,
+				       &q->queue_flags), page);
+}
+
+static ssize_t queue_adaptive_plug_store(struct request_queue *q,
+					 const char *page, size_t count)
+{
+	unsigned long enable;
+	ssize_t ret;
+	int err;
+
+	ret = queue_var_store(&enable, page, count);
+	if (ret < 0)
+		return ret;
+
+	err = blk_adaptive_plug_enable(q, !!enable);
+	if (err)
+		return err;
+
+	return ret;
+}
+
 static ssize_t queue_wb_lat_show(struct request_queue *q, char *page)
 {
 	if (!q->rq_wb)
@@ -671,6 +695,12 @@ static struct queue_sysfs_entry queue_poll_delay_entry = {
 	.store = queue_poll_delay_store,
 };
 
+static struct queue_sysfs_entry queue_adaptive_plug_entry = {
+	.attr = {.name = "adaptive_plug", .mode = S_IRUGO | S_IWUSR },
+	.show = queue_adaptive_plug_show,
+	.store = queue_adaptive_plug_store,
+};
+
 static struct queue_sysfs_entry queue_wc_entry = {
 	.attr = {.name = "write_cache", .mode = S_IRUGO | S_IWUSR },
 	.show = queue_wc_show,
@@ -729,6 +759,7 @@ static struct attribute *default_attrs[] = {
 	&queue_dax_entry.attr,
 	&queue_wb_lat_entry.attr,
 	&queue_poll_delay_entry.attr,
+	&queue_adaptive_plug_entry.attr,
 #ifdef CONFIG_BLK_DEV_THROTTLING_LOW
 	&throtl_sample_time_entry.attr,
 #endif
@@ -810,6 +841,7 @@ static void __blk_release_queue(struct work_struct *work)
 	if (test_bit(QUEUE_FLAG_POLL_STATS, &q->queue_flags))
 		blk_stat_remove_callback(q, q->poll_cb);
 	blk_stat_free_callback(q->poll_cb);
+	blk_adaptive_plug_exit(q);
 	bdi_put(q->backing_dev_info);
 	blkcg_exit_queue(q);
 
@@ -114,6 +114,10 @@ bool blk_attempt_plug_merge(struct request_queue *q, struct bio *bio,
 			    unsigned int *request_count,
 			    struct request **same_queue_rq);
 unsigned int blk_plug_queued_count(struct request_queue *q);
+bool blk_plug_should_flush(struct request_queue *q, unsigned int request_count,
+			   struct request *last);
+int blk_adaptive_plug_enable(struct request_queue *q, bool enable);
+void blk_adaptive_plug_exit(struct request_queue *q);
 
 void blk_account_io_start(struct request *req, bool new_io);
 void blk_account_io_completion(struct request *req, unsigned int bytes);
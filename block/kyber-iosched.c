@@ -19,6 +19,7 @@
 
 #include <linux/kernel.h>
 #include <linux/blkdev.h>
+#include <linux/blk-cgroup.h>
 #include <linux/blk-mq.h>
 #include <linux/elevator.h>
 #include <linux/module.h>
@@ -39,6 +40,16 @@ enum {
 	KYBER_NUM_DOMAINS,
 };
 
+/*
+ * Reads and synchronous writes from cgroups whose latency target is tighter
+ * than the one of the queue are tracked in their own statistics buckets.
+ */
+enum {
+	KYBER_READ_TIGHT = KYBER_NUM_DOMAINS,
+	KYBER_SYNC_WRITE_TIGHT,
+	KYBER_NUM_STAT_BUCKETS,
+};
+
 enum {
 	KYBER_MIN_DEPTH = 256,
 
@@ -92,11 +103,26 @@ struct kyber_queue_data {
 
 	/* Target latencies in nanoseconds. */
 	u64 read_lat_nsec, write_lat_nsec;
+
+	/*
+	 * Tightest per-cgroup target seen for reads and synchronous writes
+	 * during the current statistics window, U64_MAX if none.
+	 */
+	u64 tight_lat_nsec[KYBER_OTHER];
+
+	/*
+	 * Per-word depth of the domain tokens that requests without a tighter
+	 * target may use. It shrinks while the tight requests of the domain
+	 * miss their target, so that they find free tokens.
+	 */
+	unsigned int loose_depth[KYBER_NUM_DOMAINS];
 };
 
 struct kyber_hctx_data {
 	spinlock_t lock;
 	struct list_head rqs[KYBER_NUM_DOMAINS];
+	/* requests with a tighter cgroup target, dispatched first */
+	struct list_head tight_rqs[KYBER_NUM_DOMAINS];
 	unsigned int cur_domain;
 	unsigned int batching;
 	wait_queue_entry_t domain_wait[KYBER_NUM_DOMAINS];
@@ -115,6 +141,169 @@ static int rq_sched_domain(const struct request *rq)
 		return KYBER_OTHER;
 }
 
+#ifdef CONFIG_BLK_CGROUP
+/*
+ * Per-cgroup latency targets. A cgroup may ask for a tighter read or
+ * synchronous write target than the one of the queue, e.g. for foreground
+ * applications. 0 means that the cgroup follows the queue.
+ */
+struct kyber_cgroup_data {
+	struct blkcg_policy_data cpd;
+
+	u64 lat_nsec[KYBER_OTHER];
+};
+
+static struct blkcg_policy blkcg_policy_kyber;
+static bool kyber_blkcg_registered;
+
+static struct kyber_cgroup_data *cpd_to_kcd(struct blkcg_policy_data *cpd)
+{
+	return cpd ? container_of(cpd, struct kyber_cgroup_data, cpd) : NULL;
+}
+
+static struct blkcg_policy_data *kyber_cpd_alloc(gfp_t gfp)
+{
+	struct kyber_cgroup_data *kcd;
+
+	kcd = kzalloc(sizeof(*kcd), gfp);
+	if (!kcd)
+		return NULL;
+	return &kcd->cpd;
+}
+
+static void kyber_cpd_init(struct blkcg_policy_data *cpd)
+{
+}
+
+static void kyber_cpd_free(struct blkcg_policy_data *cpd)
+{
+	kfree(cpd_to_kcd(cpd));
+}
+
+static u64 kyber_cgroup_lat_target(struct bio *bio, unsigned int sched_domain)
+{
+	struct kyber_cgroup_data *kcd;
+	u64 target;
+
+	if (!kyber_blkcg_registered)
+		return 0;
+
+	rcu_read_lock();
+	kcd = cpd_to_kcd(blkcg_to_cpd(bio_blkcg(bio), &blkcg_policy_kyber));
+	target = kcd ? READ_ONCE(kcd->lat_nsec[sched_domain]) : 0;
+	rcu_read_unlock();
+
+	return target;
+}
+
+static u64 kyber_cgroup_lat_read(struct cgroup_subsys_state *css,
+				 struct cftype *cft)
+{
+	struct kyber_cgroup_data *kcd;
+
+	kcd = cpd_to_kcd(blkcg_to_cpd(css_to_blkcg(css), &blkcg_policy_kyber));
+	return kcd ? kcd->lat_nsec[cft->private] : 0;
+}
+
+static int kyber_cgroup_lat_write(struct cgroup_subsys_state *css,
+				  struct cftype *cft, u64 val)
+{
+	struct kyber_cgroup_data *kcd;
+
+	kcd = cpd_to_kcd(blkcg_to_cpd(css_to_blkcg(css), &blkcg_policy_kyber));
+	if (!kcd)
+		return -ENODEV;
+
+	WRITE_ONCE(kcd->lat_nsec[cft->private], val);
+	return 0;
+}
+
+#define KYBER_BLKCG_FILES						\
+	{								\
+		.name = "kyber.read_lat_nsec",				\
+		.flags = CFTYPE_NOT_ON_ROOT,				\
+		.private = KYBER_READ,					\
+		.read_u64 = kyber_cgroup_lat_read,			\
+		.write_u64 = kyber_cgroup_lat_write,			\
+	},								\
+	{								\
+		.name = "kyber.write_lat_nsec",				\
+		.flags = CFTYPE_NOT_ON_ROOT,				\
+		.private = KYBER_SYNC_WRITE,				\
+		.read_u64 = kyber_cgroup_lat_read,			\
+		.write_u64 = kyber_cgroup_lat_write,			\
+	},								\
+	{ }	/* terminate */
+
+static struct cftype kyber_blkcg_files[] = { KYBER_BLKCG_FILES };
+static struct cftype kyber_blkcg_legacy_files[] = { KYBER_BLKCG_FILES };
+#undef KYBER_BLKCG_FILES
+
+static struct blkcg_policy blkcg_policy_kyber = {
+	.dfl_cftypes		= kyber_blkcg_files,
+	.legacy_cftypes		= kyber_blkcg_legacy_files,
+
+	.cpd_alloc_fn		= kyber_cpd_alloc,
+	.cpd_init_fn		= kyber_cpd_init,
+	.cpd_free_fn		= kyber_cpd_free,
+};
+
+static void kyber_blkcg_register(void)
+{
+	/*
+	 * Without a free policy slot kyber still works, only with the
+	 * targets of the queue.
+	 */
+	if (blkcg_policy_register(&blkcg_policy_kyber))
+		pr_warn("kyber: per-cgroup latency targets unavailable\n");
+	else
+		kyber_blkcg_registered = true;
+}
+
+static void kyber_blkcg_unregister(void)
+{
+	if (kyber_blkcg_registered)
+		blkcg_policy_unregister(&blkcg_policy_kyber);
+}
+#else
+static inline u64 kyber_cgroup_lat_target(struct bio *bio,
+					  unsigned int sched_domain)
+{
+	return 0;
+}
+
+static inline void kyber_blkcg_register(void) { }
+static inline void kyber_blkcg_unregister(void) { }
+#endif
+
+/*
+ * Flush and FUA requests bypass kyber_prepare_request() and the flush
+ * machinery reuses rq->elv for its own list, so only trust priv[1] when
+ * the request went through the elevator.
+ */
+static u64 rq_get_lat_target(const struct request *rq)
+{
+	if (!(rq->rq_flags & RQF_ELVPRIV))
+		return 0;
+
+	return (unsigned long)rq->elv.priv[1];
+}
+
+static void rq_set_lat_target(struct request *rq, u64 target)
+{
+	rq->elv.priv[1] = (void *)(unsigned long)target;
+}
+
+static int kyber_stat_bucket(const struct request *rq)
+{
+	int sched_domain = rq_sched_domain(rq);
+
+	if (sched_domain != KYBER_OTHER && rq_get_lat_target(rq))
+		return KYBER_READ_TIGHT + sched_domain;
+
+	return sched_domain;
+}
+
 enum {
 	NONE = 0,
 	GOOD = 1,
@@ -244,6 +433,45 @@ static void kyber_adjust_other_depth(struct kyber_queue_data *kqd,
 		sbitmap_queue_resize(&kqd->domain_tokens[KYBER_OTHER], depth);
 }
 
+/*
+ * Combine the status of a domain with the status of its tight requests. The
+ * domain is only as good as the worse of the two.
+ */
+static int kyber_worse_status(int status, int tight_status)
+{
+	if (status == NONE)
+		return tight_status;
+	if (tight_status == NONE)
+		return status;
+	return min(status, tight_status);
+}
+
+static unsigned int kyber_full_depth(struct kyber_queue_data *kqd,
+				     unsigned int sched_domain)
+{
+	return 1U << kqd->domain_tokens[sched_domain].sb.shift;
+}
+
+/*
+ * Adjust the depth available to requests without a tighter target given the
+ * status of the tight requests of the same domain. Halve it while the tight
+ * requests miss their target, and give it back gradually once they don't.
+ */
+static void kyber_adjust_loose_depth(struct kyber_queue_data *kqd,
+				     unsigned int sched_domain,
+				     int tight_status)
+{
+	unsigned int full = kyber_full_depth(kqd, sched_domain);
+	unsigned int depth = kqd->loose_depth[sched_domain];
+
+	if (IS_BAD(tight_status))
+		depth = max(depth / 2, 1U);
+	else
+		depth = min(depth + max(depth / 4, 1U), full);
+
+	kqd->loose_depth[sched_domain] = depth;
+}
+
 /*
  * Apply heuristics for limiting queue depths based on gathered latency
  * statistics.
@@ -252,9 +480,32 @@ static void kyber_stat_timer_fn(struct blk_stat_callback *cb)
 {
 	struct kyber_queue_data *kqd = cb->data;
 	int read_status, write_status;
+	int tight_read_status, tight_write_status;
+	bool throttling_loose = false;
+	int i;
+
+	tight_read_status = kyber_lat_status(cb, KYBER_READ_TIGHT,
+					     kqd->tight_lat_nsec[KYBER_READ]);
+	tight_write_status = kyber_lat_status(cb, KYBER_SYNC_WRITE_TIGHT,
+					      kqd->tight_lat_nsec[KYBER_SYNC_WRITE]);
+	kyber_adjust_loose_depth(kqd, KYBER_READ, tight_read_status);
+	kyber_adjust_loose_depth(kqd, KYBER_SYNC_WRITE, tight_write_status);
+	kyber_adjust_loose_depth(kqd, KYBER_OTHER,
+			kyber_worse_status(tight_read_status, tight_write_status));
 
-	read_status = kyber_lat_status(cb, KYBER_READ, kqd->read_lat_nsec);
-	write_status = kyber_lat_status(cb, KYBER_SYNC_WRITE, kqd->write_lat_nsec);
+	for (i = 0; i < KYBER_NUM_DOMAINS; i++) {
+		if (kqd->loose_depth[i] < kyber_full_depth(kqd, i))
+			throttling_loose = true;
+	}
+	for (i = 0; i < KYBER_OTHER; i++)
+		kqd->tight_lat_nsec[i] = U64_MAX;
+
+	read_status = kyber_worse_status(
+			kyber_lat_status(cb, KYBER_READ, kqd->read_lat_nsec),
+			tight_read_status);
+	write_status = kyber_worse_status(
+			kyber_lat_status(cb, KYBER_SYNC_WRITE, kqd->write_lat_nsec),
+			tight_write_status);
 
 	kyber_adjust_rw_depth(kqd, KYBER_READ, read_status, write_status);
 	kyber_adjust_rw_depth(kqd, KYBER_SYNC_WRITE, write_status, read_status);
@@ -266,7 +517,7 @@ static void kyber_stat_timer_fn(struct blk_stat_callback *cb)
 	 * we're still throttling other requests.
 	 */
 	if (!blk_stat_is_active(kqd->cb) &&
-	    ((IS_BAD(read_status) || IS_BAD(write_status) ||
+	    ((IS_BAD(read_status) || IS_BAD(write_status) || throttling_loose ||
 	      kqd->domain_tokens[KYBER_OTHER].sb.depth < kyber_depth[KYBER_OTHER])))
 		blk_stat_activate_msecs(kqd->cb, 100);
 }
@@ -293,8 +544,8 @@ static struct kyber_queue_data *kyber_queue_data_alloc(struct request_queue *q)
 		goto err;
 	kqd->q = q;
 
-	kqd->cb = blk_stat_alloc_callback(kyber_stat_timer_fn, rq_sched_domain,
-					  KYBER_NUM_DOMAINS, kqd);
+	kqd->cb = blk_stat_alloc_callback(kyber_stat_timer_fn, kyber_stat_bucket,
+					  KYBER_NUM_STAT_BUCKETS, kqd);
 	if (!kqd->cb)
 		goto err_kqd;
 
@@ -317,8 +568,12 @@ static struct kyber_queue_data *kyber_queue_data_alloc(struct request_queue *q)
 			goto err_cb;
 		}
 		sbitmap_queue_resize(&kqd->domain_tokens[i], kyber_depth[i]);
+		kqd->loose_depth[i] = kyber_full_depth(kqd, i);
 	}
 
+	for (i = 0; i < KYBER_OTHER; i++)
+		kqd->tight_lat_nsec[i] = U64_MAX;
+
 	shift = kyber_sched_tags_shift(kqd);
 	kqd->async_depth = (1U << shift) * KYBER_ASYNC_PERCENT / 100U;
 
@@ -385,6 +640,7 @@ static int kyber_init_hctx(struct blk_mq_hw_ctx *hctx, unsigned int hctx_idx)
 
 	for (i = 0; i < KYBER_NUM_DOMAINS; i++) {
 		INIT_LIST_HEAD(&khd->rqs[i]);
+		INIT_LIST_HEAD(&khd->tight_rqs[i]);
 		INIT_LIST_HEAD(&khd->domain_wait[i].entry);
 		atomic_set(&khd->wait_index[i], 0);
 	}
@@ -441,7 +697,33 @@ static void kyber_limit_depth(unsigned int op, struct blk_mq_alloc_data *data)
 
 static void kyber_prepare_request(struct request *rq, struct bio *bio)
 {
+	struct kyber_queue_data *kqd = rq->q->elevator->elevator_data;
+	unsigned int sched_domain = rq_sched_domain(rq);
+	u64 target = 0;
+
 	rq_set_domain_token(rq, -1);
+
+	/*
+	 * Remember the cgroup target of the request only if it is tighter
+	 * than the target of the queue.
+	 */
+	switch (sched_domain) {
+	case KYBER_READ:
+		target = kyber_cgroup_lat_target(bio, sched_domain);
+		if (target >= kqd->read_lat_nsec)
+			target = 0;
+		break;
+	case KYBER_SYNC_WRITE:
+		target = kyber_cgroup_lat_target(bio, sched_domain);
+		if (target >= kqd->write_lat_nsec)
+			target = 0;
+		break;
+	}
+
+	if (target && target < READ_ONCE(kqd->tight_lat_nsec[sched_domain]))
+		WRITE_ONCE(kqd->tight_lat_nsec[sched_domain], target);
+
+	rq_set_lat_target(rq, target);
 }
 
 static void kyber_finish_request(struct request *rq)
@@ -474,6 +756,9 @@ static void kyber_completed_request(struct request *rq)
 		return;
 	}
 
+	if (rq_get_lat_target(rq))
+		target = rq_get_lat_target(rq);
+
 	/* If we are already monitoring latencies, don't check again. */
 	if (blk_stat_is_active(kqd->cb))
 		return;
@@ -499,7 +784,10 @@ static void kyber_flush_busy_ctxs(struct kyber_hctx_data *khd,
 		unsigned int sched_domain;
 
 		sched_domain = rq_sched_domain(rq);
-		list_move_tail(&rq->queuelist, &khd->rqs[sched_domain]);
+		if (rq_get_lat_target(rq))
+			list_move_tail(&rq->queuelist, &khd->tight_rqs[sched_domain]);
+		else
+			list_move_tail(&rq->queuelist, &khd->rqs[sched_domain]);
 	}
 }
 
@@ -513,9 +801,24 @@ static int kyber_domain_wake(wait_queue_entry_t *wait, unsigned mode, int flags,
 	return 1;
 }
 
+static int __kyber_get_domain_token(struct kyber_queue_data *kqd,
+				    struct request *rq)
+{
+	unsigned int sched_domain = rq_sched_domain(rq);
+	struct sbitmap_queue *domain_tokens = &kqd->domain_tokens[sched_domain];
+	unsigned int loose_depth = READ_ONCE(kqd->loose_depth[sched_domain]);
+
+	if (!rq_get_lat_target(rq) &&
+	    loose_depth < kyber_full_depth(kqd, sched_domain))
+		return __sbitmap_queue_get_shallow(domain_tokens, loose_depth);
+
+	return __sbitmap_queue_get(domain_tokens);
+}
+
 static int kyber_get_domain_token(struct kyber_queue_data *kqd,
 				  struct kyber_hctx_data *khd,
-				  struct blk_mq_hw_ctx *hctx)
+				  struct blk_mq_hw_ctx *hctx,
+				  struct request *rq)
 {
 	unsigned int sched_domain = khd->cur_domain;
 	struct sbitmap_queue *domain_tokens = &kqd->domain_tokens[sched_domain];
@@ -523,7 +826,7 @@ static int kyber_get_domain_token(struct kyber_queue_data *kqd,
 	struct sbq_wait_state *ws;
 	int nr;
 
-	nr = __sbitmap_queue_get(domain_tokens);
+	nr = __kyber_get_domain_token(kqd, rq);
 	if (nr >= 0)
 		return nr;
 
@@ -543,23 +846,34 @@ static int kyber_get_domain_token(struct kyber_queue_data *kqd,
 		 * Try again in case a token was freed before we got on the wait
 		 * queue.
 		 */
-		nr = __sbitmap_queue_get(domain_tokens);
+		nr = __kyber_get_domain_token(kqd, rq);
 	}
 	return nr;
 }
 
+static struct request *kyber_next_rq(struct kyber_hctx_data *khd)
+{
+	struct request *rq;
+
+	rq = list_first_entry_or_null(&khd->tight_rqs[khd->cur_domain],
+				      struct request, queuelist);
+	if (rq)
+		return rq;
+
+	return list_first_entry_or_null(&khd->rqs[khd->cur_domain],
+					struct request, queuelist);
+}
+
 static struct request *
 kyber_dispatch_cur_domain(struct kyber_queue_data *kqd,
 			  struct kyber_hctx_data *khd,
 			  struct blk_mq_hw_ctx *hctx,
 			  bool *flushed)
 {
-	struct list_head *rqs;
 	struct request *rq;
 	int nr;
 
-	rqs = &khd->rqs[khd->cur_domain];
-	rq = list_first_entry_or_null(rqs, struct request, queuelist);
+	rq = kyber_next_rq(khd);
 
 	/*
 	 * If there wasn't already a pending request and we haven't flushed the
@@ -568,11 +882,11 @@ kyber_dispatch_cur_domain(struct kyber_queue_data *kqd,
 	if (!rq && !*flushed) {
 		kyber_flush_busy_ctxs(khd, hctx);
 		*flushed = true;
-		rq = list_first_entry_or_null(rqs, struct request, queuelist);
+		rq = kyber_next_rq(khd);
 	}
 
 	if (rq) {
-		nr = kyber_get_domain_token(kqd, khd, hctx);
+		nr = kyber_get_domain_token(kqd, khd, hctx, rq);
 		if (nr >= 0) {
 			khd->batching++;
 			rq_set_domain_token(rq, nr);
@@ -638,7 +952,8 @@ static bool kyber_has_work(struct blk_mq_hw_ctx *hctx)
 	int i;
 
 	for (i = 0; i < KYBER_NUM_DOMAINS; i++) {
-		if (!list_empty_careful(&khd->rqs[i]))
+		if (!list_empty_careful(&khd->rqs[i]) ||
+		    !list_empty_careful(&khd->tight_rqs[i]))
 			return true;
 	}
 	return false;
@@ -831,12 +1146,21 @@ static struct elevator_type kyber_sched = {
 
 static int __init kyber_init(void)
 {
-	return elv_register(&kyber_sched);
+	int ret;
+
+	kyber_blkcg_register();
+
+	ret = elv_register(&kyber_sched);
+	if (ret)
+		kyber_blkcg_unregister();
+
+	return ret;
 }
 
 static void __exit kyber_exit(void)
 {
 	elv_unregister(&kyber_sched);
+	kyber_blkcg_unregister();
 }
 
 module_init(kyber_init);
@@ -0,0 +1,300 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * MQ Anxiety I/O Scheduler - adaptation of the legacy anxiety scheduler,
+ * for the blk-mq scheduling framework
+ *
+ * Copyright (c) 2020, Tyler Nijmeh <tylernij@gmail.com>
+ */
+
+#include <linux/kernel.h>
+#include <linux/blkdev.h>
+#include <linux/blk-mq.h>
+#include <linux/elevator.h>
+#include <linux/bio.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/init.h>
+
+#include "blk.h"
+#include "blk-mq.h"
+#include "blk-mq-debugfs.h"
+#include "blk-mq-tag.h"
+#include "blk-mq-sched.h"
+
+/* Batch this many synchronous requests at a time */
+#define	DEFAULT_SYNC_RATIO	(8)
+
+struct anxiety_data {
+	struct list_head sync_queue;
+	struct list_head async_queue;
+
+	/* Sync requests dispatched since the last async one */
+	uint8_t sync_batched;
+
+	/* Tunables */
+	uint8_t sync_ratio;
+
+	spinlock_t lock;
+	struct list_head dispatch;
+};
+
+static inline struct request *anxiety_next_entry(struct list_head *queue)
+{
+	return list_first_entry(queue, struct request, queuelist);
+}
+
+static void anxiety_remove_request(struct request_queue *q, struct request *rq)
+{
+	list_del_init(&rq->queuelist);
+
+	elv_rqhash_del(q, rq);
+	if (q->last_merge == rq)
+		q->last_merge = NULL;
+}
+
+static void anxiety_merged_requests(struct request_queue *q, struct request *rq,
+		struct request *next)
+{
+	anxiety_remove_request(q, next);
+}
+
+/*
+ * The legacy scheduler dispatches batches of sync_ratio synchronous requests
+ * followed by one asynchronous request. blk-mq pulls one request at a time,
+ * so the position in the batch is kept across calls instead.
+ */
+static struct request *__anxiety_dispatch_request(struct blk_mq_hw_ctx *hctx)
+{
+	struct anxiety_data *adata = hctx->queue->elevator->elevator_data;
+	struct request *rq;
+	bool sync = !list_empty(&adata->sync_queue);
+	bool async = !list_empty(&adata->async_queue);
+
+	if (!list_empty(&adata->dispatch)) {
+		rq = anxiety_next_entry(&adata->dispatch);
+		list_del_init(&rq->queuelist);
+		goto done;
+	}
+
+	/* Submit one async request after the sync batch to avoid starvation */
+	if (async && (!sync || adata->sync_batched >= adata->sync_ratio)) {
+		rq = anxiety_next_entry(&adata->async_queue);
+		adata->sync_batched = 0;
+	} else if (sync) {
+		rq = anxiety_next_entry(&adata->sync_queue);
+		adata->sync_batched++;
+	} else {
+		return NULL;
+	}
+
+	anxiety_remove_request(rq->q, rq);
+done:
+	rq->rq_flags |= RQF_STARTED;
+	return rq;
+}
+
+static struct request *anxiety_dispatch_request(struct blk_mq_hw_ctx *hctx)
+{
+	struct anxiety_data *adata = hctx->queue->elevator->elevator_data;
+	struct request *rq;
+
+	spin_lock(&adata->lock);
+	rq = __anxiety_dispatch_request(hctx);
+	spin_unlock(&adata->lock);
+
+	return rq;
+}
+
+static bool anxiety_bio_merge(struct blk_mq_hw_ctx *hctx, struct bio *bio)
+{
+	struct request_queue *q = hctx->queue;
+	struct anxiety_data *adata = q->elevator->elevator_data;
+	struct request *free = NULL;
+	bool ret;
+
+	spin_lock(&adata->lock);
+	ret = blk_mq_sched_try_merge(q, bio, &free);
+	spin_unlock(&adata->lock);
+
+	if (free)
+		blk_mq_free_request(free);
+
+	return ret;
+}
+
+static void anxiety_insert_request(struct blk_mq_hw_ctx *hctx,
+		struct request *rq, bool at_head)
+{
+	struct request_queue *q = hctx->queue;
+	struct anxiety_data *adata = q->elevator->elevator_data;
+
+	if (blk_mq_sched_try_insert_merge(q, rq))
+		return;
+
+	blk_mq_sched_request_inserted(rq);
+
+	if (at_head || blk_rq_is_passthrough(rq)) {
+		if (at_head)
+			list_add(&rq->queuelist, &adata->dispatch);
+		else
+			list_add_tail(&rq->queuelist, &adata->dispatch);
+		return;
+	}
+
+	if (rq_mergeable(rq)) {
+		elv_rqhash_add(q, rq);
+		if (!q->last_merge)
+			q->last_merge = rq;
+	}
+
+	list_add_tail(&rq->queuelist,
+		rq_is_sync(rq) ? &adata->sync_queue : &adata->async_queue);
+}
+
+static void anxiety_insert_requests(struct blk_mq_hw_ctx *hctx,
+		struct list_head *list, bool at_head)
+{
+	struct request_queue *q = hctx->queue;
+	struct anxiety_data *adata = q->elevator->elevator_data;
+
+	spin_lock(&adata->lock);
+	while (!list_empty(list)) {
+		struct request *rq;
+
+		rq = anxiety_next_entry(list);
+		list_del_init(&rq->queuelist);
+		anxiety_insert_request(hctx, rq, at_head);
+	}
+	spin_unlock(&adata->lock);
+}
+
+static bool anxiety_has_work(struct blk_mq_hw_ctx *hctx)
+{
+	struct anxiety_data *adata = hctx->queue->elevator->elevator_data;
+
+	return !list_empty_careful(&adata->dispatch) ||
+		!list_empty_careful(&adata->sync_queue) ||
+		!list_empty_careful(&adata->async_queue);
+}
+
+static int anxiety_init_queue(struct request_queue *q,
+		struct elevator_type *elv)
+{
+	struct anxiety_data *adata;
+	struct elevator_queue *eq = elevator_alloc(q, elv);
+
+	if (!eq)
+		return -ENOMEM;
+
+	/* Allocate the data */
+	adata = kzalloc_node(sizeof(*adata), GFP_KERNEL, q->node);
+	if (!adata) {
+		kobject_put(&eq->kobj);
+		return -ENOMEM;
+	}
+
+	/* Set the elevator data */
+	eq->elevator_data = adata;
+
+	/* Initialize */
+	INIT_LIST_HEAD(&adata->sync_queue);
+	INIT_LIST_HEAD(&adata->async_queue);
+	adata->sync_ratio = DEFAULT_SYNC_RATIO;
+	spin_lock_init(&adata->lock);
+	INIT_LIST_HEAD(&adata->dispatch);
+
+	q->elevator = eq;
+
+	return 0;
+}
+
+static void anxiety_exit_queue(struct elevator_queue *e)
+{
+	struct anxiety_data *adata = e->elevator_data;
+
+	BUG_ON(!list_empty(&adata->sync_queue));
+	BUG_ON(!list_empty(&adata->async_queue));
+
+	kfree(adata);
+}
+
+/* Sysfs access */
+static ssize_t anxiety_sync_ratio_show(struct elevator_queue *e, char *page)
+{
+	struct anxiety_data *adata = e->elevator_data;
+
+	return snprintf(page, PAGE_SIZE, "%u\n", adata->sync_ratio);
+}
+
+static ssize_t anxiety_sync_ratio_store(struct elevator_queue *e,
+		const char *page, size_t count)
+{
+	struct anxiety_data *adata = e->elevator_data;
+	int ret;
+
+	ret = kstrtou8(page, 0, &adata->sync_ratio);
+	if (ret < 0)
+		return ret;
+
+	return count;
+}
+
+static struct elv_fs_entry anxiety_attrs[] = {
+	__ATTR(sync_ratio, 0644, anxiety_sync_ratio_show,
+		anxiety_sync_ratio_store),
+	__ATTR_NULL
+};
+
+#ifdef CONFIG_BLK_DEBUG_FS
+static int anxiety_sync_batched_show(void *data, struct seq_file *m)
+{
+	struct request_queue *q = data;
+	struct anxiety_data *adata = q->elevator->elevator_data;
+
+	seq_printf(m, "%u\n", adata->sync_batched);
+	return 0;
+}
+
+static const struct blk_mq_debugfs_attr anxiety_queue_debugfs_attrs[] = {
+	{"sync_batched", 0400, anxiety_sync_batched_show},
+	{},
+};
+#endif
+
+static struct elevator_type mq_anxiety = {
+	.ops.mq = {
+		.insert_requests	= anxiety_insert_requests,
+		.dispatch_request	= anxiety_dispatch_request,
+		.bio_merge		= anxiety_bio_merge,
+		.requests_merged	= anxiety_merged_requests,
+		.has_work		= anxiety_has_work,
+		.init_sched		= anxiety_init_queue,
+		.exit_sched		= anxiety_exit_queue,
+	},
+
+	.uses_mq	= true,
+#ifdef CONFIG_BLK_DEBUG_FS
+	.queue_debugfs_attrs = anxiety_queue_debugfs_attrs,
+#endif
+	.elevator_name = "mq-anxiety",
+	.elevator_attrs = anxiety_attrs,
+	.elevator_owner = THIS_MODULE,
+};
+MODULE_ALIAS("mq-anxiety-iosched");
+
+static int __init anxiety_init(void)
+{
+	return elv_register(&mq_anxiety);
+}
+
+static void __exit anxiety_exit(void)
+{
+	elv_unregister(&mq_anxiety);
+}
+
+module_init(anxiety_init);
+module_exit(anxiety_exit);
+
+MODULE_AUTHOR("Tyler Nijmeh");
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("MQ Anxiety I/O scheduler");
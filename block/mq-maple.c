@@ -0,0 +1,555 @@
+/*
+ *  MQ Maple i/o scheduler - adaptation of the legacy maple scheduler,
+ *  for the blk-mq scheduling framework
+ *
+ * Maple uses a first come first serve style algorithm with separated
+ * read/write handling to allow for read biases, and increases expirations
+ * while the display is off to decrease workload.
+ */
+#include <linux/kernel.h>
+#include <linux/fs.h>
+#include <linux/blkdev.h>
+#include <linux/blk-mq.h>
+#include <linux/elevator.h>
+#include <linux/bio.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/init.h>
+#include <linux/compiler.h>
+#include <linux/fb.h>
+
+#include "blk.h"
+#include "blk-mq.h"
+#include "blk-mq-debugfs.h"
+#include "blk-mq-tag.h"
+#include "blk-mq-sched.h"
+
+enum { ASYNC, SYNC };
+
+/* Tunables, see block/maple-iosched.c */
+static const int sync_read_expire = 350;	/* max time before a read sync is submitted. */
+static const int sync_write_expire = 550;	/* max time before a write sync is submitted. */
+static const int async_read_expire = 250;	/* ditto for read async, these limits are SOFT! */
+static const int async_write_expire = 450;	/* ditto for write async, these limits are SOFT! */
+static const int fifo_batch = 16;		/* # of sequential requests treated as one by the above parameters. */
+static const int writes_starved = 4;		/* max times reads can starve a write */
+static const int sleep_latency_multiple = 10;	/* multple for expire time when device is asleep */
+
+struct maple_data {
+	/* Request queues */
+	struct list_head fifo_list[2][2];
+
+	/* Attributes */
+	unsigned int batched;
+	unsigned int starved;
+
+	/* Settings */
+	int fifo_expire[2][2];
+	int fifo_batch;
+	int writes_starved;
+	int sleep_latency_multiple;
+
+	/* Display state */
+	struct notifier_block fb_notifier;
+	bool display_on;
+
+	spinlock_t lock;
+	struct list_head dispatch;
+};
+
+/*
+ * remove rq from fifo and the merge hash.
+ */
+static void maple_remove_request(struct request_queue *q, struct request *rq)
+{
+	list_del_init(&rq->queuelist);
+
+	elv_rqhash_del(q, rq);
+	if (q->last_merge == rq)
+		q->last_merge = NULL;
+}
+
+static void maple_merged_requests(struct request_queue *q, struct request *rq,
+				  struct request *next)
+{
+	/*
+	 * If next expires before rq, assign its expire time to rq
+	 * and move into next position (next will be deleted) in fifo.
+	 */
+	if (!list_empty(&rq->queuelist) && !list_empty(&next->queuelist)) {
+		if (time_before((unsigned long)next->fifo_time,
+				(unsigned long)rq->fifo_time)) {
+			list_move(&rq->queuelist, &next->queuelist);
+			rq->fifo_time = next->fifo_time;
+		}
+	}
+
+	/* Delete next request */
+	maple_remove_request(q, next);
+}
+
+static struct request *
+maple_expired_request(struct maple_data *mdata, int sync, int data_dir)
+{
+	struct list_head *list = &mdata->fifo_list[sync][data_dir];
+	struct request *rq;
+
+	if (list_empty(list))
+		return NULL;
+
+	/* Retrieve request */
+	rq = rq_entry_fifo(list->next);
+
+	/* Request has expired */
+	if (time_after_eq(jiffies, (unsigned long)rq->fifo_time))
+		return rq;
+
+	return NULL;
+}
+
+static struct request *
+maple_choose_expired_request(struct maple_data *mdata)
+{
+	struct request *rq_sync_read = maple_expired_request(mdata, SYNC, READ);
+	struct request *rq_sync_write = maple_expired_request(mdata, SYNC, WRITE);
+	struct request *rq_async_read = maple_expired_request(mdata, ASYNC, READ);
+	struct request *rq_async_write = maple_expired_request(mdata, ASYNC, WRITE);
+
+	/* Reset (non-expired-)batch-counter */
+	mdata->batched = 0;
+
+	/*
+	 * Check expired requests.
+	 * Asynchronous requests have priority over synchronous.
+	 * Read requests have priority over write.
+	 */
+	if (rq_async_read && rq_sync_read) {
+		if (time_after((unsigned long)rq_sync_read->fifo_time,
+			       (unsigned long)rq_async_read->fifo_time))
+			return rq_async_read;
+	} else if (rq_async_read) {
+		return rq_async_read;
+	} else if (rq_sync_read) {
+		return rq_sync_read;
+	}
+
+	if (rq_async_write && rq_sync_write) {
+		if (time_after((unsigned long)rq_sync_write->fifo_time,
+			       (unsigned long)rq_async_write->fifo_time))
+			return rq_async_write;
+	} else if (rq_async_write) {
+		return rq_async_write;
+	} else if (rq_sync_write) {
+		return rq_sync_write;
+	}
+
+	return NULL;
+}
+
+static struct request *
+maple_choose_request(struct maple_data *mdata, int data_dir)
+{
+	struct list_head *sync = mdata->fifo_list[SYNC];
+	struct list_head *async = mdata->fifo_list[ASYNC];
+
+	/* Increase (non-expired-)batch-counter */
+	mdata->batched++;
+
+	/*
+	 * Retrieve request from available fifo list.
+	 * Asynchronous requests have priority over synchronous.
+	 * Read requests have priority over write.
+	 */
+	if (!list_empty(&async[data_dir]))
+		return rq_entry_fifo(async[data_dir].next);
+	if (!list_empty(&sync[data_dir]))
+		return rq_entry_fifo(sync[data_dir].next);
+
+	if (!list_empty(&async[!data_dir]))
+		return rq_entry_fifo(async[!data_dir].next);
+	if (!list_empty(&sync[!data_dir]))
+		return rq_entry_fifo(sync[!data_dir].next);
+
+	return NULL;
+}
+
+/*
+ * take rq off the fifo and account the starvation of writes
+ */
+static void maple_move_request(struct maple_data *mdata, struct request *rq)
+{
+	maple_remove_request(rq->q, rq);
+
+	if (rq_data_dir(rq)) {
+		mdata->starved = 0;
+	} else {
+		if (!list_empty(&mdata->fifo_list[SYNC][WRITE]) ||
+		    !list_empty(&mdata->fifo_list[ASYNC][WRITE]))
+			mdata->starved++;
+	}
+}
+
+static struct request *__maple_dispatch_request(struct blk_mq_hw_ctx *hctx)
+{
+	struct maple_data *mdata = hctx->queue->elevator->elevator_data;
+	struct request *rq = NULL;
+	int data_dir = READ;
+
+	if (!list_empty(&mdata->dispatch)) {
+		rq = list_first_entry(&mdata->dispatch, struct request, queuelist);
+		list_del_init(&rq->queuelist);
+		goto done;
+	}
+
+	/*
+	 * Retrieve any expired request after a batch of
+	 * sequential requests.
+	 */
+	if (mdata->batched >= mdata->fifo_batch)
+		rq = maple_choose_expired_request(mdata);
+
+	/* Retrieve request */
+	if (!rq) {
+		/* Treat writes fairly while suspended, otherwise allow them to be starved */
+		if (mdata->display_on && mdata->starved >= mdata->writes_starved)
+			data_dir = WRITE;
+		else if (!mdata->display_on && mdata->starved >= 1)
+			data_dir = WRITE;
+
+		rq = maple_choose_request(mdata, data_dir);
+		if (!rq)
+			return NULL;
+	}
+
+	maple_move_request(mdata, rq);
+done:
+	rq->rq_flags |= RQF_STARTED;
+	return rq;
+}
+
+static struct request *maple_dispatch_request(struct blk_mq_hw_ctx *hctx)
+{
+	struct maple_data *mdata = hctx->queue->elevator->elevator_data;
+	struct request *rq;
+
+	spin_lock(&mdata->lock);
+	rq = __maple_dispatch_request(hctx);
+	spin_unlock(&mdata->lock);
+
+	return rq;
+}
+
+static int fb_notifier_callback(struct notifier_block *self,
+				unsigned long event, void *data)
+{
+	struct maple_data *mdata = container_of(self, struct maple_data,
+						fb_notifier);
+	struct fb_event *evdata = data;
+	int *blank;
+
+	if (evdata && evdata->data && event == FB_EVENT_BLANK) {
+		blank = evdata->data;
+		switch (*blank) {
+		case FB_BLANK_UNBLANK:
+			WRITE_ONCE(mdata->display_on, true);
+			break;
+		case FB_BLANK_POWERDOWN:
+		case FB_BLANK_HSYNC_SUSPEND:
+		case FB_BLANK_VSYNC_SUSPEND:
+		case FB_BLANK_NORMAL:
+			WRITE_ONCE(mdata->display_on, false);
+			break;
+		}
+	}
+
+	return 0;
+}
+
+static void maple_exit_queue(struct elevator_queue *e)
+{
+	struct maple_data *mdata = e->elevator_data;
+
+	fb_unregister_client(&mdata->fb_notifier);
+
+	BUG_ON(!list_empty(&mdata->fifo_list[SYNC][READ]));
+	BUG_ON(!list_empty(&mdata->fifo_list[SYNC][WRITE]));
+	BUG_ON(!list_empty(&mdata->fifo_list[ASYNC][READ]));
+	BUG_ON(!list_empty(&mdata->fifo_list[ASYNC][WRITE]));
+
+	kfree(mdata);
+}
+
+/*
+ * initialize elevator private data (maple_data).
+ */
+static int maple_init_queue(struct request_queue *q, struct elevator_type *e)
+{
+	struct maple_data *mdata;
+	struct elevator_queue *eq;
+
+	eq = elevator_alloc(q, e);
+	if (!eq)
+		return -ENOMEM;
+
+	mdata = kzalloc_node(sizeof(*mdata), GFP_KERNEL, q->node);
+	if (!mdata) {
+		kobject_put(&eq->kobj);
+		return -ENOMEM;
+	}
+	eq->elevator_data = mdata;
+
+	INIT_LIST_HEAD(&mdata->fifo_list[SYNC][READ]);
+	INIT_LIST_HEAD(&mdata->fifo_list[SYNC][WRITE]);
+	INIT_LIST_HEAD(&mdata->fifo_list[ASYNC][READ]);
+	INIT_LIST_HEAD(&mdata->fifo_list[ASYNC][WRITE]);
+	mdata->fifo_expire[SYNC][READ] = sync_read_expire;
+	mdata->fifo_expire[SYNC][WRITE] = sync_write_expire;
+	mdata->fifo_expire[ASYNC][READ] = async_read_expire;
+	mdata->fifo_expire[ASYNC][WRITE] = async_write_expire;
+	mdata->fifo_batch = fifo_batch;
+	mdata->writes_starved = writes_starved;
+	mdata->sleep_latency_multiple = sleep_latency_multiple;
+	mdata->display_on = true;
+	spin_lock_init(&mdata->lock);
+	INIT_LIST_HEAD(&mdata->dispatch);
+
+	mdata->fb_notifier.notifier_call = fb_notifier_callback;
+	fb_register_client(&mdata->fb_notifier);
+
+	q->elevator = eq;
+	return 0;
+}
+
+static bool maple_bio_merge(struct blk_mq_hw_ctx *hctx, struct bio *bio)
+{
+	struct request_queue *q = hctx->queue;
+	struct maple_data *mdata = q->elevator->elevator_data;
+	struct request *free = NULL;
+	bool ret;
+
+	spin_lock(&mdata->lock);
+	ret = blk_mq_sched_try_merge(q, bio, &free);
+	spin_unlock(&mdata->lock);
+
+	if (free)
+		blk_mq_free_request(free);
+
+	return ret;
+}
+
+/*
+ * add rq to the fifo of its sync class and direction
+ */
+static void maple_insert_request(struct blk_mq_hw_ctx *hctx, struct request *rq,
+				 bool at_head)
+{
+	struct request_queue *q = hctx->queue;
+	struct maple_data *mdata = q->elevator->elevator_data;
+	const int sync = rq_is_sync(rq);
+	const int data_dir = rq_data_dir(rq);
+	int expire;
+
+	if (blk_mq_sched_try_insert_merge(q, rq))
+		return;
+
+	blk_mq_sched_request_inserted(rq);
+
+	if (at_head || blk_rq_is_passthrough(rq)) {
+		if (at_head)
+			list_add(&rq->queuelist, &mdata->dispatch);
+		else
+			list_add_tail(&rq->queuelist, &mdata->dispatch);
+		return;
+	}
+
+	if (rq_mergeable(rq)) {
+		elv_rqhash_add(q, rq);
+		if (!q->last_merge)
+			q->last_merge = rq;
+	}
+
+	/* increase expiration when device is asleep */
+	expire = mdata->fifo_expire[sync][data_dir];
+	if (!READ_ONCE(mdata->display_on))
+		expire *= mdata->sleep_latency_multiple;
+
+	rq->fifo_time = jiffies + expire;
+	list_add_tail(&rq->queuelist, &mdata->fifo_list[sync][data_dir]);
+}
+
+static void maple_insert_requests(struct blk_mq_hw_ctx *hctx,
+				  struct list_head *list, bool at_head)
+{
+	struct request_queue *q = hctx->queue;
+	struct maple_data *mdata = q->elevator->elevator_data;
+
+	spin_lock(&mdata->lock);
+	while (!list_empty(list)) {
+		struct request *rq;
+
+		rq = list_first_entry(list, struct request, queuelist);
+		list_del_init(&rq->queuelist);
+		maple_insert_request(hctx, rq, at_head);
+	}
+	spin_unlock(&mdata->lock);
+}
+
+static bool maple_has_work(struct blk_mq_hw_ctx *hctx)
+{
+	struct maple_data *mdata = hctx->queue->elevator->elevator_data;
+
+	return !list_empty_careful(&mdata->dispatch) ||
+		!list_empty_careful(&mdata->fifo_list[SYNC][READ]) ||
+		!list_empty_careful(&mdata->fifo_list[SYNC][WRITE]) ||
+		!list_empty_careful(&mdata->fifo_list[ASYNC][READ]) ||
+		!list_empty_careful(&mdata->fifo_list[ASYNC][WRITE]);
+}
+
+/*
+ * sysfs parts below
+ */
+static ssize_t
+maple_var_show(int var, char *page)
+{
+	return sprintf(page, "%d\n", var);
+}
+
+static void
+maple_var_store(int *var, const char *page)
+{
+	char *p = (char *) page;
+
+	*var = simple_strtol(p, &p, 10);
+}
+
+#define SHOW_FUNCTION(__FUNC, __VAR, __CONV)				\
+static ssize_t __FUNC(struct elevator_queue *e, char *page)		\
+{									\
+	struct maple_data *mdata = e->elevator_data;			\
+	int __data = __VAR;						\
+	if (__CONV)							\
+		__data = jiffies_to_msecs(__data);			\
+	return maple_var_show(__data, (page));				\
+}
+SHOW_FUNCTION(maple_sync_read_expire_show, mdata->fifo_expire[SYNC][READ], 1);
+SHOW_FUNCTION(maple_sync_write_expire_show, mdata->fifo_expire[SYNC][WRITE], 1);
+SHOW_FUNCTION(maple_async_read_expire_show, mdata->fifo_expire[ASYNC][READ], 1);
+SHOW_FUNCTION(maple_async_write_expire_show, mdata->fifo_expire[ASYNC][WRITE], 1);
+SHOW_FUNCTION(maple_fifo_batch_show, mdata->fifo_batch, 0);
+SHOW_FUNCTION(maple_writes_starved_show, mdata->writes_starved, 0);
+SHOW_FUNCTION(maple_sleep_latency_multiple_show, mdata->sleep_latency_multiple, 0);
+#undef SHOW_FUNCTION
+
+#define STORE_FUNCTION(__FUNC, __PTR, MIN, MAX, __CONV)			\
+static ssize_t __FUNC(struct elevator_queue *e, const char *page, size_t count)	\
+{									\
+	struct maple_data *mdata = e->elevator_data;			\
+	int __data;							\
+	maple_var_store(&__data, (page));				\
+	if (__data < (MIN))						\
+		__data = (MIN);						\
+	else if (__data > (MAX))					\
+		__data = (MAX);						\
+	if (__CONV)							\
+		*(__PTR) = msecs_to_jiffies(__data);			\
+	else								\
+		*(__PTR) = __data;					\
+	return count;							\
+}
+STORE_FUNCTION(maple_sync_read_expire_store, &mdata->fifo_expire[SYNC][READ], 0, INT_MAX, 1);
+STORE_FUNCTION(maple_sync_write_expire_store, &mdata->fifo_expire[SYNC][WRITE], 0, INT_MAX, 1);
+STORE_FUNCTION(maple_async_read_expire_store, &mdata->fifo_expire[ASYNC][READ], 0, INT_MAX, 1);
+STORE_FUNCTION(maple_async_write_expire_store, &mdata->fifo_expire[ASYNC][WRITE], 0, INT_MAX, 1);
+STORE_FUNCTION(maple_fifo_batch_store, &mdata->fifo_batch, 1, INT_MAX, 0);
+STORE_FUNCTION(maple_writes_starved_store, &mdata->writes_starved, 1, INT_MAX, 0);
+STORE_FUNCTION(maple_sleep_latency_multiple_store, &mdata->sleep_latency_multiple, 1, INT_MAX, 0);
+#undef STORE_FUNCTION
+
+#define MAPLE_ATTR(name) \
+	__ATTR(name, S_IRUGO|S_IWUSR, maple_##name##_show, \
+				      maple_##name##_store)
+
+static struct elv_fs_entry maple_attrs[] = {
+	MAPLE_ATTR(sync_read_expire),
+	MAPLE_ATTR(sync_write_expire),
+	MAPLE_ATTR(async_read_expire),
+	MAPLE_ATTR(async_write_expire),
+	MAPLE_ATTR(fifo_batch),
+	MAPLE_ATTR(writes_starved),
+	MAPLE_ATTR(sleep_latency_multiple),
+	__ATTR_NULL
+};
+
+#ifdef CONFIG_BLK_DEBUG_FS
+static int maple_batched_show(void *data, struct seq_file *m)
+{
+	struct request_queue *q = data;
+	struct maple_data *mdata = q->elevator->elevator_data;
+
+	seq_printf(m, "%u\n", mdata->batched);
+	return 0;
+}
+
+static int maple_starved_show(void *data, struct seq_file *m)
+{
+	struct request_queue *q = data;
+	struct maple_data *mdata = q->elevator->elevator_data;
+
+	seq_printf(m, "%u\n", mdata->starved);
+	return 0;
+}
+
+static int maple_display_on_show(void *data, struct seq_file *m)
+{
+	struct request_queue *q = data;
+	struct maple_data *mdata = q->elevator->elevator_data;
+
+	seq_printf(m, "%d\n", READ_ONCE(mdata->display_on));
+	return 0;
+}
+
+static const struct blk_mq_debugfs_attr maple_queue_debugfs_attrs[] = {
+	{"batched", 0400, maple_batched_show},
+	{"starved", 0400, maple_starved_show},
+	{"display_on", 0400, maple_display_on_show},
+	{},
+};
+#endif
+
+static struct elevator_type mq_maple = {
+	.ops.mq = {
+		.insert_requests	= maple_insert_requests,
+		.dispatch_request	= maple_dispatch_request,
+		.bio_merge		= maple_bio_merge,
+		.requests_merged	= maple_merged_requests,
+		.has_work		= maple_has_work,
+		.init_sched		= maple_init_queue,
+		.exit_sched		= maple_exit_queue,
+	},
+
+	.uses_mq	= true,
+#ifdef CONFIG_BLK_DEBUG_FS
+	.queue_debugfs_attrs = maple_queue_debugfs_attrs,
+#endif
+	.elevator_attrs = maple_attrs,
+	.elevator_name = "mq-maple",
+	.elevator_owner = THIS_MODULE,
+};
+MODULE_ALIAS("mq-maple-iosched");
+
+static int __init maple_init(void)
+{
+	return elv_register(&mq_maple);
+}
+
+static void __exit maple_exit(void)
+{
+	elv_unregister(&mq_maple);
+}
+
+module_init(maple_init);
+module_exit(maple_exit);
+
+MODULE_AUTHOR("Joe Maples");
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("MQ Maple IO scheduler");
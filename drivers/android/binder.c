@@ -75,6 +75,7 @@
 #include <uapi/linux/android/binder.h>
 #include <uapi/linux/sched/types.h>
 #include "binder_alloc.h"
+#include "binder_latency.h"
 #include "binder_trace.h"
 #ifdef CONFIG_SAMSUNG_FREECESS
 #include <linux/freecess.h>
@@ -643,6 +644,10 @@ enum {
  *                        when outstanding transactions are cleaned up
  *                        (protected by @proc->inner_lock)
  * @task:                 struct task_struct for this thread
+ * @wakeup_ns:            time this thread was last woken for work
+ *                        (protected by @proc->inner_lock)
+ * @wakeup_lat_ns:        latency of the last wakeup, not yet accounted
+ *                        (only accessed by this thread)
  *
  * Bookkeeping structure for binder threads.
  */
@@ -663,6 +668,8 @@ struct binder_thread {
 	atomic_t tmp_ref;
 	bool is_dead;
 	struct task_struct *task;
+	u64 wakeup_ns;
+	u64 wakeup_lat_ns;
 };
 
 struct binder_transaction {
@@ -684,6 +691,7 @@ struct binder_transaction {
 	bool    set_priority_called;
 	kuid_t	sender_euid;
 	binder_uintptr_t security_ctx;
+	u64	enqueue_ns;	/* queued for the target, 0 for replies */
 	/**
 	 * @lock:  protects @from, @to_proc, and @to_thread
 	 *
@@ -1317,6 +1325,8 @@ static void binder_wakeup_thread_ilocked(struct binder_proc *proc,
 	assert_spin_locked(&proc->inner_lock);
 
 	if (thread) {
+		if (!thread->wakeup_ns)
+			thread->wakeup_ns = binder_latency_now();
 		if (sync)
 			wake_up_interruptible_sync(&thread->wait);
 		else
@@ -3094,6 +3104,8 @@ static bool binder_proc_transaction(struct binder_transaction *t,
 	if (!thread && !pending_async)
 		thread = binder_select_thread_ilocked(proc);
 
+	t->enqueue_ns = binder_latency_now();
+
 	if (thread) {
 		binder_transaction_priority(thread->task, t, node_prio,
 					    node->inherit_rt);
@@ -3260,6 +3272,7 @@ static void binder_transaction(struct binder_proc *proc,
 	int t_debug_id = atomic_inc_return(&binder_last_id);
 	char *secctx = NULL;
 	u32 secctx_sz = 0;
+	u64 copy_start_ns;
 
 	e = binder_transaction_log_add(&binder_transaction_log);
 	e->debug_id = t_debug_id;
@@ -3563,6 +3576,7 @@ static void binder_transaction(struct binder_proc *proc,
 				      ALIGN(tr->data_size, sizeof(void *)));
 	offp = off_start;
 
+	copy_start_ns = binder_latency_now();
 	if (copy_from_user(t->buffer->data, (const void __user *)(uintptr_t)
 			   tr->data.ptr.buffer, tr->data_size)) {
 		binder_user_error("%d:%d got transaction with invalid data ptr\n",
@@ -3581,6 +3595,10 @@ static void binder_transaction(struct binder_proc *proc,
 		return_error_line = __LINE__;
 		goto err_copy_data_failed;
 	}
+	if (!reply)
+		binder_latency_record(target_proc->pid, tr->code,
+				      BINDER_LAT_COPY,
+				      binder_latency_now() - copy_start_ns);
 	if (!IS_ALIGNED(tr->offsets_size, sizeof(binder_size_t))) {
 		binder_user_error("%d:%d got transaction with invalid offsets size, %lld\n",
 				proc->pid, thread->pid, (u64)tr->offsets_size);
@@ -4440,6 +4458,11 @@ static int binder_wait_for_work(struct binder_thread *thread,
 			break;
 		}
 	}
+	if (thread->wakeup_ns) {
+		thread->wakeup_lat_ns = binder_latency_now() -
+					thread->wakeup_ns;
+		thread->wakeup_ns = 0;
+	}
 	finish_wait(&thread->wait, &wait);
 	binder_inner_proc_unlock(proc);
 	freezer_count();
@@ -4542,6 +4565,16 @@ static int binder_thread_read(struct binder_proc *proc,
 		case BINDER_WORK_TRANSACTION: {
 			binder_inner_proc_unlock(proc);
 			t = container_of(w, struct binder_transaction, work);
+			if (t->enqueue_ns) {
+				binder_latency_record(proc->pid, t->code,
+					BINDER_LAT_QUEUE,
+					binder_latency_now() - t->enqueue_ns);
+				if (thread->wakeup_lat_ns)
+					binder_latency_record(proc->pid,
+						t->code, BINDER_LAT_WAKEUP,
+						thread->wakeup_lat_ns);
+			}
+			thread->wakeup_lat_ns = 0;
 		} break;
 		case BINDER_WORK_RETURN_ERROR: {
 			struct binder_error *e = container_of(
@@ -5594,6 +5627,24 @@ static int binder_node_release(struct binder_node *node, int refs)
 	return refs;
 }
 
+/*
+ * A process usually has binder, hwbinder and vndbinder open, with one proc
+ * each. Keep its latency histograms until the last of them goes away.
+ */
+static void binder_latency_proc_gone(struct binder_proc *proc)
+{
+	struct binder_proc *itr;
+
+	if (!IS_ENABLED(CONFIG_ANDROID_BINDER_LATENCY_STATS))
+		return;
+
+	lockdep_assert_held(&binder_procs_lock);
+	hlist_for_each_entry(itr, &binder_procs, proc_node)
+		if (itr->pid == proc->pid)
+			return;
+	binder_latency_forget(proc->pid);
+}
+
 static void binder_deferred_release(struct binder_proc *proc)
 {
 	struct binder_context *context = proc->context;
@@ -5604,6 +5655,7 @@ static void binder_deferred_release(struct binder_proc *proc)
 
 	mutex_lock(&binder_procs_lock);
 	hlist_del(&proc->proc_node);
+	binder_latency_proc_gone(proc);
 	mutex_unlock(&binder_procs_lock);
 
 	mutex_lock(&context->context_mgr_node_lock);
@@ -6491,6 +6543,7 @@ static int __init binder_init(void)
 				    binder_debugfs_dir_entry_root,
 				    &binder_transaction_log_failed,
 				    &binder_transaction_log_fops);
+		binder_latency_debugfs_init(binder_debugfs_dir_entry_root);
 #ifdef CONFIG_FAST_TRACK
 		debugfs_create_file("count",
 				    S_IRUGO,
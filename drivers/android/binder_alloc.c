@@ -76,6 +76,11 @@ static size_t binder_alloc_buffer_size(struct binder_alloc *alloc,
 	return (u8 *)binder_buffer_next(buffer)->data - (u8 *)buffer->data;
 }
 
+static unsigned int binder_alloc_size_to_bin(size_t size)
+{
+	return size / sizeof(void *) - 1;
+}
+
 static void binder_insert_free_buffer(struct binder_alloc *alloc,
 				      struct binder_buffer *new_buffer)
 {
@@ -93,6 +98,17 @@ static void binder_insert_free_buffer(struct binder_alloc *alloc,
 		     "%d: add free buffer, size %zd, at %pK\n",
 		      alloc->pid, new_buffer_size, new_buffer);
 
+	if (new_buffer_size <= BINDER_ALLOC_BIN_MAX) {
+		unsigned int bin = binder_alloc_size_to_bin(new_buffer_size);
+
+		list_add(&new_buffer->bin_entry, &alloc->free_bins[bin]);
+		__set_bit(bin, alloc->free_bins_map);
+		new_buffer->bin = bin;
+		new_buffer->binned = 1;
+		return;
+	}
+	new_buffer->binned = 0;
+
 	while (*p) {
 		parent = *p;
 		buffer = rb_entry(parent, struct binder_buffer, rb_node);
@@ -109,6 +125,47 @@ static void binder_insert_free_buffer(struct binder_alloc *alloc,
 	rb_insert_color(&new_buffer->rb_node, &alloc->free_buffers);
 }
 
+/*
+ * The bin is recorded at insert time, so the buffer can be unlinked even after
+ * its neighbour changed and its size with it.
+ */
+static void binder_erase_free_buffer(struct binder_alloc *alloc,
+				     struct binder_buffer *buffer)
+{
+	BUG_ON(!buffer->free);
+
+	if (!buffer->binned) {
+		rb_erase(&buffer->rb_node, &alloc->free_buffers);
+		return;
+	}
+
+	list_del(&buffer->bin_entry);
+	if (list_empty(&alloc->free_bins[buffer->bin]))
+		__clear_bit(buffer->bin, alloc->free_bins_map);
+	buffer->binned = 0;
+}
+
+/*
+ * Every binned buffer is smaller than every buffer in the rb tree, so the
+ * first non-empty bin that fits @size holds the best fit overall.
+ */
+static struct binder_buffer *binder_alloc_bin_fit(struct binder_alloc *alloc,
+						  size_t size)
+{
+	unsigned int bin;
+
+	if (size > BINDER_ALLOC_BIN_MAX)
+		return NULL;
+
+	bin = find_next_bit(alloc->free_bins_map, BINDER_ALLOC_NR_BINS,
+			    binder_alloc_size_to_bin(size));
+	if (bin >= BINDER_ALLOC_NR_BINS)
+		return NULL;
+
+	return list_first_entry(&alloc->free_bins[bin], struct binder_buffer,
+				bin_entry);
+}
+
 static void binder_insert_allocated_buffer_locked(
 		struct binder_alloc *alloc, struct binder_buffer *new_buffer)
 {
@@ -189,11 +246,113 @@ struct binder_buffer *binder_alloc_prepare_to_free(struct binder_alloc *alloc,
 	return buffer;
 }
 
+static int binder_alloc_map_page(struct binder_alloc *alloc,
+				 struct vm_area_struct *vma, void *page_addr,
+				 gfp_t gfp)
+{
+	size_t index = (page_addr - alloc->buffer) / PAGE_SIZE;
+	struct binder_lru_page *page = &alloc->pages[index];
+	unsigned long user_page_addr;
+	int ret;
+
+	page->page_ptr = alloc_page(gfp);
+	if (!page->page_ptr) {
+		if (!(gfp & __GFP_NOWARN))
+			pr_err("%d: binder_alloc_buf failed for page at %pK\n",
+			       alloc->pid, page_addr);
+		return -ENOMEM;
+	}
+	page->alloc = alloc;
+	INIT_LIST_HEAD(&page->lru);
+
+	ret = map_kernel_range_noflush((unsigned long)page_addr,
+				       PAGE_SIZE, PAGE_KERNEL,
+				       &page->page_ptr);
+	flush_cache_vmap((unsigned long)page_addr,
+			(unsigned long)page_addr + PAGE_SIZE);
+	if (ret != 1) {
+		pr_err("%d: binder_alloc_buf failed to map page at %pK in kernel\n",
+		       alloc->pid, page_addr);
+		goto err_map_kernel_failed;
+	}
+	user_page_addr =
+		(uintptr_t)page_addr + alloc->user_buffer_offset;
+	ret = vm_insert_page(vma, user_page_addr, page[0].page_ptr);
+	if (ret) {
+		pr_err("%d: binder_alloc_buf failed to map page at %lx in userspace\n",
+		       alloc->pid, user_page_addr);
+		goto err_vm_insert_page_failed;
+	}
+
+	if (index + 1 > alloc->pages_high)
+		alloc->pages_high = index + 1;
+
+	/* vm_insert_page does not seem to increment the refcount */
+	return 0;
+
+err_vm_insert_page_failed:
+	unmap_kernel_range((unsigned long)page_addr, PAGE_SIZE);
+err_map_kernel_failed:
+	__free_page(page->page_ptr);
+	page->page_ptr = NULL;
+	return -ENOMEM;
+}
+
+/*
+ * Maps up to the warm reserve of free pages past @addr while mmap_sem is
+ * already held, so that the transactions that follow find their pages in
+ * place. The pages go straight onto the lru like freed buffer pages do.
+ */
+static void binder_alloc_prefault(struct binder_alloc *alloc,
+				  struct vm_area_struct *vma, void *addr)
+{
+	void *buffer_end = alloc->buffer + alloc->buffer_size;
+	size_t nr, scan;
+	size_t index;
+
+	if (alloc->lru_pages >= alloc->warm_pages)
+		return;
+
+	nr = alloc->warm_pages - alloc->lru_pages;
+	for (scan = 2 * nr; nr && scan && addr < buffer_end;
+	     addr += PAGE_SIZE, scan--) {
+		index = (addr - alloc->buffer) / PAGE_SIZE;
+		if (alloc->pages[index].page_ptr)
+			continue;
+
+		if (binder_alloc_map_page(alloc, vma, addr,
+					  GFP_KERNEL | __GFP_HIGHMEM |
+					  __GFP_ZERO | __GFP_NORETRY |
+					  __GFP_NOWARN))
+			break;
+
+		if (list_lru_add(&binder_alloc_lru, &alloc->pages[index].lru))
+			alloc->lru_pages++;
+		nr--;
+	}
+}
+
+/*
+ * Feeds the size of a new buffer into the moving average of pages per
+ * transaction, kept in 1/16 page units, and sizes the warm reserve to
+ * cover BINDER_WARM_TXNS such transactions.
+ */
+static void binder_alloc_update_warm(struct binder_alloc *alloc, size_t size)
+{
+	size_t pages = min_t(size_t, DIV_ROUND_UP(size, PAGE_SIZE),
+			     alloc->warm_max);
+
+	alloc->txn_pages_avg = alloc->txn_pages_avg -
+			       (alloc->txn_pages_avg >> 3) + (pages << 1);
+	alloc->warm_pages = min_t(size_t, alloc->warm_max,
+				  DIV_ROUND_UP(alloc->txn_pages_avg *
+					       BINDER_WARM_TXNS, 16));
+}
+
 static int binder_update_page_range(struct binder_alloc *alloc, int allocate,
 				    void *start, void *end)
 {
 	void *page_addr;
-	unsigned long user_page_addr;
 	struct binder_lru_page *page;
 	struct vm_area_struct *vma = NULL;
 	struct mm_struct *mm = NULL;
@@ -239,7 +398,6 @@ static int binder_update_page_range(struct binder_alloc *alloc, int allocate,
 	}
 
 	for (page_addr = start; page_addr < end; page_addr += PAGE_SIZE) {
-		int ret;
 		bool on_lru;
 		size_t index;
 
@@ -251,6 +409,8 @@ static int binder_update_page_range(struct binder_alloc *alloc, int allocate,
 
 			on_lru = list_lru_del(&binder_alloc_lru, &page->lru);
 			WARN_ON(!on_lru);
+			if (on_lru)
+				alloc->lru_pages--;
 
 			trace_binder_alloc_lru_end(alloc, index);
 			continue;
@@ -260,42 +420,15 @@ static int binder_update_page_range(struct binder_alloc *alloc, int allocate,
 			goto err_page_ptr_cleared;
 
 		trace_binder_alloc_page_start(alloc, index);
-		page->page_ptr = alloc_page(GFP_KERNEL |
-					    __GFP_HIGHMEM |
-					    __GFP_ZERO);
-		if (!page->page_ptr) {
-			pr_err("%d: binder_alloc_buf failed for page at %pK\n",
-				alloc->pid, page_addr);
+		if (binder_alloc_map_page(alloc, vma, page_addr,
+					  GFP_KERNEL | __GFP_HIGHMEM |
+					  __GFP_ZERO))
 			goto err_alloc_page_failed;
-		}
-		page->alloc = alloc;
-		INIT_LIST_HEAD(&page->lru);
-
-		ret = map_kernel_range_noflush((unsigned long)page_addr,
-					       PAGE_SIZE, PAGE_KERNEL,
-					       &page->page_ptr);
-		flush_cache_vmap((unsigned long)page_addr,
-				(unsigned long)page_addr + PAGE_SIZE);
-		if (ret != 1) {
-			pr_err("%d: binder_alloc_buf failed to map page at %pK in kernel\n",
-			       alloc->pid, page_addr);
-			goto err_map_kernel_failed;
-		}
-		user_page_addr =
-			(uintptr_t)page_addr + alloc->user_buffer_offset;
-		ret = vm_insert_page(vma, user_page_addr, page[0].page_ptr);
-		if (ret) {
-			pr_err("%d: binder_alloc_buf failed to map page at %lx in userspace\n",
-			       alloc->pid, user_page_addr);
-			goto err_vm_insert_page_failed;
-		}
-
-		if (index + 1 > alloc->pages_high)
-			alloc->pages_high = index + 1;
 
 		trace_binder_alloc_page_end(alloc, index);
-		/* vm_insert_page does not seem to increment the refcount */
 	}
+	if (vma)
+		binder_alloc_prefault(alloc, vma, end);
 	if (mm) {
 		up_read(&mm->mmap_sem);
 		mmput(mm);
@@ -314,17 +447,14 @@ static int binder_update_page_range(struct binder_alloc *alloc, int allocate,
 
 		ret = list_lru_add(&binder_alloc_lru, &page->lru);
 		WARN_ON(!ret);
+		if (ret)
+			alloc->lru_pages++;
 
 		trace_binder_free_lru_end(alloc, index);
 		if (page_addr == start)
 			break;
 		continue;
 
-err_vm_insert_page_failed:
-		unmap_kernel_range((unsigned long)page_addr, PAGE_SIZE);
-err_map_kernel_failed:
-		__free_page(page->page_ptr);
-		page->page_ptr = NULL;
 err_alloc_page_failed:
 err_page_ptr_cleared:
 		if (page_addr == start)
@@ -377,6 +507,7 @@ static struct binder_buffer *binder_alloc_new_buf_locked(
 	struct binder_buffer *buffer;
 	size_t buffer_size;
 	struct rb_node *best_fit = NULL;
+	struct binder_buffer *bin_buffer;
 	void *has_page_addr;
 	void *end_page_addr;
 	size_t size, data_offsets_size;
@@ -434,6 +565,12 @@ static struct binder_buffer *binder_alloc_new_buf_locked(
 	/* Pad 0-size buffers so they get assigned unique addresses */
 	size = max(size, sizeof(void *));
 
+	binder_alloc_update_warm(alloc, size);
+
+	bin_buffer = binder_alloc_bin_fit(alloc, size);
+	if (bin_buffer)
+		n = NULL;
+
 	while (n) {
 		buffer = rb_entry(n, struct binder_buffer, rb_node);
 		BUG_ON(!buffer->free);
@@ -449,13 +586,14 @@ static struct binder_buffer *binder_alloc_new_buf_locked(
 			break;
 		}
 	}
-	if (best_fit == NULL) {
+	if (best_fit == NULL && bin_buffer == NULL) {
 		size_t allocated_buffers = 0;
 		size_t largest_alloc_size = 0;
 		size_t total_alloc_size = 0;
 		size_t free_buffers = 0;
 		size_t largest_free_size = 0;
 		size_t total_free_size = 0;
+		int i;
 
 		for (n = rb_first(&alloc->allocated_buffers); n != NULL;
 		     n = rb_next(n)) {
@@ -475,6 +613,17 @@ static struct binder_buffer *binder_alloc_new_buf_locked(
 			if (buffer_size > largest_free_size)
 				largest_free_size = buffer_size;
 		}
+		for (i = 0; i < BINDER_ALLOC_NR_BINS; i++) {
+			list_for_each_entry(buffer, &alloc->free_bins[i],
+					    bin_entry) {
+				buffer_size = binder_alloc_buffer_size(alloc,
+								       buffer);
+				free_buffers++;
+				total_free_size += buffer_size;
+				if (buffer_size > largest_free_size)
+					largest_free_size = buffer_size;
+			}
+		}
 		pr_err("%d: binder_alloc_buf size %zd failed, no address space\n",
 			alloc->pid, size);
 		pr_err("allocated: %zd (num: %zd largest: %zd), free: %zd (num: %zd largest: %zd)\n",
@@ -482,7 +631,10 @@ static struct binder_buffer *binder_alloc_new_buf_locked(
 		       total_free_size, free_buffers, largest_free_size);
 		return ERR_PTR(-ENOSPC);
 	}
-	if (n == NULL) {
+	if (bin_buffer) {
+		buffer = bin_buffer;
+		buffer_size = binder_alloc_buffer_size(alloc, buffer);
+	} else if (n == NULL) {
 		buffer = rb_entry(best_fit, struct binder_buffer, rb_node);
 		buffer_size = binder_alloc_buffer_size(alloc, buffer);
 	}
@@ -518,7 +670,7 @@ static struct binder_buffer *binder_alloc_new_buf_locked(
 		binder_insert_free_buffer(alloc, new_buffer);
 	}
 
-	rb_erase(best_fit, &alloc->free_buffers);
+	binder_erase_free_buffer(alloc, buffer);
 	buffer->free = 0;
 	buffer->allow_user_free = 0;
 	binder_insert_allocated_buffer_locked(alloc, buffer);
@@ -677,7 +829,7 @@ static void binder_free_buf_locked(struct binder_alloc *alloc,
 		struct binder_buffer *next = binder_buffer_next(buffer);
 
 		if (next->free) {
-			rb_erase(&next->rb_node, &alloc->free_buffers);
+			binder_erase_free_buffer(alloc, next);
 			binder_delete_free_buffer(alloc, next);
 		}
 	}
@@ -686,7 +838,7 @@ static void binder_free_buf_locked(struct binder_alloc *alloc,
 
 		if (prev->free) {
 			binder_delete_free_buffer(alloc, buffer);
-			rb_erase(&prev->rb_node, &alloc->free_buffers);
+			binder_erase_free_buffer(alloc, prev);
 			buffer = prev;
 		}
 	}
@@ -922,6 +1074,7 @@ void binder_alloc_print_pages(struct seq_file *m,
 	mutex_unlock(&alloc->mutex);
 	seq_printf(m, "  pages: %d:%d:%d\n", active, lru, free);
 	seq_printf(m, "  pages high watermark: %zu\n", alloc->pages_high);
+	seq_printf(m, "  pages warm reserve: %zu\n", alloc->warm_pages);
 }
 
 /**
@@ -978,6 +1131,7 @@ enum lru_status binder_alloc_free_page(struct list_head *item,
 	uintptr_t page_addr;
 	size_t index;
 	struct vm_area_struct *vma;
+	bool keep_warm = cb_arg && *(bool *)cb_arg;
 
 	alloc = page->alloc;
 	if (!mutex_trylock(&alloc->mutex))
@@ -986,6 +1140,11 @@ enum lru_status binder_alloc_free_page(struct list_head *item,
 	if (!page->page_ptr)
 		goto err_page_already_freed;
 
+	if (keep_warm && alloc->lru_pages <= alloc->warm_pages) {
+		mutex_unlock(&alloc->mutex);
+		return LRU_ROTATE;
+	}
+
 	index = page - alloc->pages;
 	page_addr = (uintptr_t)alloc->buffer + index * PAGE_SIZE;
 
@@ -997,6 +1156,7 @@ enum lru_status binder_alloc_free_page(struct list_head *item,
 	vma = binder_alloc_get_vma(alloc);
 
 	list_lru_isolate(lru, item);
+	alloc->lru_pages--;
 	spin_unlock(lock);
 
 	if (vma) {
@@ -1043,9 +1203,16 @@ static unsigned long
 binder_shrink_scan(struct shrinker *shrink, struct shrink_control *sc)
 {
 	unsigned long ret;
+	bool keep_warm = true;
 
+	/* spare the warm reserves unless nothing else is left to free */
 	ret = list_lru_walk(&binder_alloc_lru, binder_alloc_free_page,
-			    NULL, sc->nr_to_scan);
+			    &keep_warm, sc->nr_to_scan);
+	if (!ret) {
+		keep_warm = false;
+		ret = list_lru_walk(&binder_alloc_lru, binder_alloc_free_page,
+				    &keep_warm, sc->nr_to_scan);
+	}
 	return ret;
 }
 
@@ -1064,9 +1231,15 @@ static struct shrinker binder_shrinker = {
  */
 void binder_alloc_init(struct binder_alloc *alloc)
 {
+	int i;
+
 	alloc->pid = current->group_leader->pid;
+	alloc->warm_max = BINDER_WARM_MAX_PAGES;
 	mutex_init(&alloc->mutex);
 	INIT_LIST_HEAD(&alloc->buffers);
+	for (i = 0; i < BINDER_ALLOC_NR_BINS; i++)
+		INIT_LIST_HEAD(&alloc->free_bins[i]);
+	bitmap_zero(alloc->free_bins_map, BINDER_ALLOC_NR_BINS);
 }
 
 int binder_alloc_shrinker_init(void)
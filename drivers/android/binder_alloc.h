@@ -26,13 +26,32 @@
 extern struct list_lru binder_alloc_lru;
 struct binder_transaction;
 
+/*
+ * Free buffers up to BINDER_ALLOC_BIN_MAX bytes are kept in exact-size bins
+ * instead of the free_buffers rb tree, so the small transactions that make up
+ * most of the traffic are served without a tree walk.
+ */
+#define BINDER_ALLOC_BIN_MAX	512
+#define BINDER_ALLOC_NR_BINS	(BINDER_ALLOC_BIN_MAX / sizeof(void *))
+
+/*
+ * Each proc keeps enough free pages mapped for BINDER_WARM_TXNS transactions
+ * of its average size, up to BINDER_WARM_MAX_PAGES. The shrinker leaves this
+ * warm reserve alone until nothing else is left on binder_alloc_lru.
+ */
+#define BINDER_WARM_TXNS	8
+#define BINDER_WARM_MAX_PAGES	64
+
 /**
  * struct binder_buffer - buffer used for binder transactions
  * @entry:              entry alloc->buffers
  * @rb_node:            node for allocated_buffers/free_buffers rb trees
+ * @bin_entry:          entry in alloc->free_bins[@bin] if @binned
+ * @bin:                index of the free bin holding the buffer
  * @free:               true if buffer is free
  * @allow_user_free:    describe the second member of struct blah,
  * @async_transaction:  describe the second member of struct blah,
+ * @binned:             free buffer is in a size bin rather than the rb tree
  * @debug_id:           describe the second member of struct blah,
  * @transaction:        describe the second member of struct blah,
  * @target_node:        describe the second member of struct blah,
@@ -45,12 +64,19 @@ struct binder_transaction;
  */
 struct binder_buffer {
 	struct list_head entry; /* free and allocated entries by address */
-	struct rb_node rb_node; /* free entry by size or allocated entry */
-				/* by address */
+	union {
+		struct rb_node rb_node; /* free entry by size or allocated */
+					/* entry by address */
+		struct {
+			struct list_head bin_entry; /* small free entry */
+			unsigned int bin;
+		};
+	};
 	unsigned free:1;
 	unsigned allow_user_free:1;
 	unsigned async_transaction:1;
-	unsigned debug_id:29;
+	unsigned binned:1;
+	unsigned debug_id:28;
 
 	struct binder_transaction *transaction;
 
@@ -85,6 +111,9 @@ struct binder_lru_page {
  * @buffers:            list of all buffers for this proc
  * @free_buffers:       rb tree of buffers available for allocation
  *                      sorted by size
+ * @free_bins:          lists of free buffers of each size up to
+ *                      BINDER_ALLOC_BIN_MAX, in steps of sizeof(void *)
+ * @free_bins_map:      bitmap of the non-empty @free_bins
  * @allocated_buffers:  rb tree of allocated buffers sorted by address
  * @free_async_space:   VA space available for async buffers. This is
  *                      initialized at mmap time to 1/2 the full VA space
@@ -92,6 +121,10 @@ struct binder_lru_page {
  * @buffer_size:        size of address space specified via mmap
  * @pid:                pid for associated binder_proc (invariant after init)
  * @pages_high:         high watermark of offset in @pages
+ * @lru_pages:          number of free pages still mapped, on binder_alloc_lru
+ * @warm_pages:         number of free pages to keep mapped
+ * @warm_max:           upper bound of @warm_pages
+ * @txn_pages_avg:      moving average of pages per transaction, in 1/16 pages
  *
  * Bookkeeping structure for per-proc address space management for binder
  * buffers. It is normally initialized during binder_init() and binder_mmap()
@@ -106,6 +139,8 @@ struct binder_alloc {
 	ptrdiff_t user_buffer_offset;
 	struct list_head buffers;
 	struct rb_root free_buffers;
+	struct list_head free_bins[BINDER_ALLOC_NR_BINS];
+	DECLARE_BITMAP(free_bins_map, BINDER_ALLOC_NR_BINS);
 	struct rb_root allocated_buffers;
 	size_t free_async_space;
 	struct binder_lru_page *pages;
@@ -113,6 +148,10 @@ struct binder_alloc {
 	uint32_t buffer_free;
 	int pid;
 	size_t pages_high;
+	size_t lru_pages;
+	size_t warm_pages;
+	size_t warm_max;
+	size_t txn_pages_avg;
 };
 
 #ifdef CONFIG_ANDROID_BINDER_IPC_SELFTEST
@@ -291,6 +291,7 @@ static void binder_selftest_alloc_offset(struct binder_alloc *alloc,
 void binder_selftest_alloc(struct binder_alloc *alloc)
 {
 	size_t end_offset[BUFFER_NUM];
+	size_t warm_max;
 
 	if (!binder_selftest_run)
 		return;
@@ -298,7 +299,12 @@ void binder_selftest_alloc(struct binder_alloc *alloc)
 	if (!binder_selftest_run || !alloc->vma)
 		goto done;
 	pr_info("STARTED\n");
+	/* the checks expect no pages mapped ahead of the buffers */
+	warm_max = alloc->warm_max;
+	alloc->warm_max = 0;
+	alloc->warm_pages = 0;
 	binder_selftest_alloc_offset(alloc, end_offset, 0);
+	alloc->warm_max = warm_max;
 	binder_selftest_run = false;
 	if (binder_selftest_failures > 0)
 		pr_info("%d tests FAILED\n", binder_selftest_failures);
@@ -0,0 +1,205 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * binder_latency.c - binder transaction latency histograms
+ */
+
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/atomic.h>
+#include <linux/bitops.h>
+#include <linux/fs.h>
+#include <linux/hash.h>
+#include <linux/math64.h>
+#include <linux/module.h>
+#include <linux/seq_file.h>
+#include <linux/string.h>
+#include "binder_latency.h"
+
+/*
+ * Log2 latency histograms per (target pid, transaction code), kept in a fixed
+ * open-addressed table so that recording never allocates. Bucket 0 counts
+ * latencies below 1us, bucket b counts [2^(b-1), 2^b) us and the last bucket
+ * counts everything above.
+ */
+#define BINDER_LAT_SLOTS	256
+#define BINDER_LAT_PROBES	8
+#define BINDER_LAT_BUCKETS	20
+
+/* key of a slot being cleared, never matches a pid and can't be claimed */
+#define BINDER_LAT_KEY_BUSY	U64_MAX
+
+struct binder_lat_slot {
+	u64 key;
+	atomic_t hist[BINDER_LAT_NR][BINDER_LAT_BUCKETS];
+};
+
+static struct binder_lat_slot binder_lat_table[BINDER_LAT_SLOTS];
+static atomic_t binder_lat_dropped;
+
+static const char * const binder_lat_names[BINDER_LAT_NR] = {
+	[BINDER_LAT_QUEUE]	= "queue_wait",
+	[BINDER_LAT_WAKEUP]	= "wakeup",
+	[BINDER_LAT_COPY]	= "copy",
+};
+
+static u64 binder_lat_key(int pid, unsigned int code)
+{
+	return ((u64)(u32)pid << 32) | code;
+}
+
+static struct binder_lat_slot *binder_lat_slot_get(u64 key)
+{
+	unsigned int idx = hash_64(key, ilog2(BINDER_LAT_SLOTS));
+	struct binder_lat_slot *slot;
+	u64 old;
+	int i;
+
+	/*
+	 * Forgetting a pid empties slots in the middle of probe chains, so
+	 * look for the key in the whole chain before claiming an empty slot.
+	 */
+	for (i = 0; i < BINDER_LAT_PROBES; i++) {
+		slot = &binder_lat_table[(idx + i) & (BINDER_LAT_SLOTS - 1)];
+		if (READ_ONCE(slot->key) == key)
+			return slot;
+	}
+
+	for (i = 0; i < BINDER_LAT_PROBES; i++) {
+		slot = &binder_lat_table[(idx + i) & (BINDER_LAT_SLOTS - 1)];
+		old = READ_ONCE(slot->key);
+		if (old == key)
+			return slot;
+		if (old)
+			continue;
+		old = cmpxchg64(&slot->key, 0, key);
+		if (!old || old == key)
+			return slot;
+	}
+
+	return NULL;
+}
+
+/*
+ * Unpublish the key before zeroing the histograms, so that a new key can't
+ * claim the slot and have its first records wiped. A record racing with this
+ * on a slot it looked up before may still land after the memset.
+ */
+static void binder_lat_slot_clear(struct binder_lat_slot *slot)
+{
+	WRITE_ONCE(slot->key, BINDER_LAT_KEY_BUSY);
+	smp_wmb();
+	memset(slot->hist, 0, sizeof(slot->hist));
+	smp_wmb();
+	WRITE_ONCE(slot->key, 0);
+}
+
+void binder_latency_record(int pid, unsigned int code,
+			   enum binder_lat_type type, u64 delta_ns)
+{
+	struct binder_lat_slot *slot;
+	unsigned int bucket;
+
+	if (pid <= 0)
+		return;
+
+	slot = binder_lat_slot_get(binder_lat_key(pid, code));
+	if (!slot) {
+		atomic_inc(&binder_lat_dropped);
+		return;
+	}
+
+	bucket = min_t(unsigned int, fls64(div_u64(delta_ns, NSEC_PER_USEC)),
+		       BINDER_LAT_BUCKETS - 1);
+	atomic_inc(&slot->hist[type][bucket]);
+}
+
+/* drops the histograms of a process that went away */
+void binder_latency_forget(int pid)
+{
+	struct binder_lat_slot *slot;
+	int i;
+
+	for (i = 0; i < BINDER_LAT_SLOTS; i++) {
+		slot = &binder_lat_table[i];
+		if ((READ_ONCE(slot->key) >> 32) == (u32)pid)
+			binder_lat_slot_clear(slot);
+	}
+}
+
+static void binder_lat_print_hist(struct seq_file *m, const char *name,
+				  atomic_t *hist)
+{
+	unsigned int count;
+	bool shown = false;
+	int b;
+
+	for (b = 0; b < BINDER_LAT_BUCKETS; b++) {
+		count = atomic_read(&hist[b]);
+		if (!count)
+			continue;
+		if (!shown)
+			seq_printf(m, "  %s:", name);
+		shown = true;
+		if (b == BINDER_LAT_BUCKETS - 1)
+			seq_printf(m, " >=%luus:%u", 1UL << (b - 1), count);
+		else
+			seq_printf(m, " <%luus:%u", 1UL << b, count);
+	}
+	if (shown)
+		seq_puts(m, "\n");
+}
+
+static int binder_latency_show(struct seq_file *m, void *unused)
+{
+	struct binder_lat_slot *slot;
+	u64 key;
+	int i, t;
+
+	seq_printf(m, "dropped: %d\n", atomic_read(&binder_lat_dropped));
+	for (i = 0; i < BINDER_LAT_SLOTS; i++) {
+		slot = &binder_lat_table[i];
+		key = READ_ONCE(slot->key);
+		if (!key || key == BINDER_LAT_KEY_BUSY)
+			continue;
+
+		seq_printf(m, "pid %u code %u\n", (u32)(key >> 32), (u32)key);
+		for (t = 0; t < BINDER_LAT_NR; t++)
+			binder_lat_print_hist(m, binder_lat_names[t],
+					      slot->hist[t]);
+	}
+
+	return 0;
+}
+
+static int binder_latency_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, binder_latency_show, inode->i_private);
+}
+
+/* any write clears all the histograms */
+static ssize_t binder_latency_write(struct file *file, const char __user *buf,
+				    size_t count, loff_t *ppos)
+{
+	int i;
+
+	for (i = 0; i < BINDER_LAT_SLOTS; i++)
+		binder_lat_slot_clear(&binder_lat_table[i]);
+	atomic_set(&binder_lat_dropped, 0);
+
+	return count;
+}
+
+static const struct file_operations binder_latency_fops = {
+	.owner = THIS_MODULE,
+	.open = binder_latency_open,
+	.read = seq_read,
+	.write = binder_latency_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+void binder_latency_debugfs_init(struct dentry *root)
+{
+	debugfs_create_file("latency", 0644, root, NULL,
+			    &binder_latency_fops);
+}
@@ -0,0 +1,46 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+
+#ifndef _LINUX_BINDER_LATENCY_H
+#define _LINUX_BINDER_LATENCY_H
+
+#include <linux/debugfs.h>
+#include <linux/ktime.h>
+#include <linux/types.h>
+
+/**
+ * enum binder_lat_type - phases of a transaction that are timed
+ * @BINDER_LAT_QUEUE:   from queueing the work to a target thread picking it up
+ * @BINDER_LAT_WAKEUP:  from waking the target thread to it running again
+ * @BINDER_LAT_COPY:    copying the data and offsets into the target buffer
+ */
+enum binder_lat_type {
+	BINDER_LAT_QUEUE,
+	BINDER_LAT_WAKEUP,
+	BINDER_LAT_COPY,
+	BINDER_LAT_NR,
+};
+
+#ifdef CONFIG_ANDROID_BINDER_LATENCY_STATS
+void binder_latency_record(int pid, unsigned int code,
+			   enum binder_lat_type type, u64 delta_ns);
+void binder_latency_forget(int pid);
+void binder_latency_debugfs_init(struct dentry *root);
+
+static inline u64 binder_latency_now(void)
+{
+	return ktime_get_ns();
+}
+#else
+static inline void binder_latency_record(int pid, unsigned int code,
+					 enum binder_lat_type type,
+					 u64 delta_ns) {}
+static inline void binder_latency_forget(int pid) {}
+static inline void binder_latency_debugfs_init(struct dentry *root) {}
+
+static inline u64 binder_latency_now(void)
+{
+	return 0;
+}
+#endif
+
+#endif /* _LINUX_BINDER_LATENCY_H */
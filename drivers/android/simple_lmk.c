@@ -11,8 +11,11 @@
 #include <linux/mmu_notifier.h>
 #include <linux/moduleparam.h>
 #include <linux/oom.h>
+#include <linux/psi.h>
 #include <linux/ratelimit.h>
 #include <linux/sched/mm.h>
+#include <linux/sched/signal.h>
+#include <linux/simple_lmk.h>
 #include <linux/sort.h>
 #include <linux/vmpressure.h>
 #include <uapi/linux/sched/types.h>
@@ -26,6 +29,10 @@
 /* Timeout in jiffies for each reclaim */
 #define RECLAIM_EXPIRES msecs_to_jiffies(CONFIG_ANDROID_SIMPLE_LMK_TIMEOUT_MSEC)
 
+/* Processes with a positive adj are indexed by adj; the rest share a bucket */
+#define NR_ADJ_BUCKETS (OOM_SCORE_ADJ_MAX + 1)
+#define INELIGIBLE_BUCKET NR_ADJ_BUCKETS
+
 struct victim_info {
 	struct task_struct *tsk;
 	struct mm_struct *mm;
@@ -33,7 +40,9 @@ struct victim_info {
 };
 
 static struct victim_info victims[MAX_VICTIMS] __cacheline_aligned_in_smp;
-static struct task_struct *task_bucket[SHRT_MAX + 1] __cacheline_aligned;
+static struct hlist_head adj_bucket[NR_ADJ_BUCKETS + 1] __cacheline_aligned;
+static DECLARE_BITMAP(adj_bitmap, NR_ADJ_BUCKETS);
+static DEFINE_SPINLOCK(adj_index_lock);
 static DECLARE_WAIT_QUEUE_HEAD(oom_waitq);
 static DECLARE_WAIT_QUEUE_HEAD(reaper_waitq);
 static DECLARE_COMPLETION(reclaim_done);
@@ -43,6 +52,7 @@ static bool reclaim_active;
 static atomic_t needs_reclaim = ATOMIC_INIT(0);
 static atomic_t needs_reap = ATOMIC_INIT(0);
 static atomic_t nr_killed = ATOMIC_INIT(0);
+static atomic_long_t reclaim_target = ATOMIC_LONG_INIT(0);
 
 static int victim_cmp(const void *lhs_ptr, const void *rhs_ptr)
 {
@@ -71,58 +81,123 @@ static unsigned long get_total_mm_pages(struct mm_struct *mm)
 	return pages;
 }
 
-static unsigned long find_victims(int *vindex)
+static int adj_to_bucket(short adj)
 {
-	short i, min_adj = SHRT_MAX, max_adj = 0;
-	unsigned long pages_found = 0;
-	struct task_struct *tsk;
+	if (adj < 0)
+		return INELIGIBLE_BUCKET;
 
-	rcu_read_lock();
-	for_each_process(tsk) {
-		struct signal_struct *sig;
-		short adj;
+	return min_t(int, adj, OOM_SCORE_ADJ_MAX);
+}
 
-		/*
-		 * Search for suitable tasks with a positive adj (importance).
-		 * Since only tasks with a positive adj can be targeted, that
-		 * naturally excludes tasks which shouldn't be killed, like init
-		 * and kthreads. Although oom_score_adj can still be changed
-		 * while this code runs, it doesn't really matter; we just need
-		 * a snapshot of the task's adj.
-		 */
-		sig = tsk->signal;
-		adj = READ_ONCE(sig->oom_score_adj);
-		if (adj < 0 ||
-		    sig->flags & (SIGNAL_GROUP_EXIT | SIGNAL_GROUP_COREDUMP) ||
-		    (thread_group_empty(tsk) && tsk->flags & PF_EXITING))
-			continue;
+static void __adj_index_add(struct signal_struct *sig)
+{
+	int bucket = adj_to_bucket(READ_ONCE(sig->oom_score_adj));
+
+	sig->simple_lmk_bucket = bucket;
+	hlist_add_head(&sig->simple_lmk_node, &adj_bucket[bucket]);
+	if (bucket != INELIGIBLE_BUCKET)
+		__set_bit(bucket, adj_bitmap);
+}
 
-		/* Store the task in a linked-list bucket based on its adj */
-		tsk->simple_lmk_next = task_bucket[adj];
-		task_bucket[adj] = tsk;
+static void __adj_index_del(struct signal_struct *sig)
+{
+	int bucket = sig->simple_lmk_bucket;
+
+	hlist_del_init(&sig->simple_lmk_node);
+	if (bucket != INELIGIBLE_BUCKET && hlist_empty(&adj_bucket[bucket]))
+		__clear_bit(bucket, adj_bitmap);
+}
+
+/*
+ * The adj index holds every live thread group from fork until its leader is
+ * released, so that reclaim only needs to visit the buckets it kills from
+ * rather than walk every task in the system. A thread group is unhashed from
+ * the index if and only if it isn't tracked (anymore).
+ */
+void simple_lmk_task_add(struct task_struct *tsk)
+{
+	struct signal_struct *sig = tsk->signal;
+
+	spin_lock(&adj_index_lock);
+	if (hlist_unhashed(&sig->simple_lmk_node))
+		__adj_index_add(sig);
+	spin_unlock(&adj_index_lock);
+}
+
+void simple_lmk_task_del(struct task_struct *tsk)
+{
+	struct signal_struct *sig = tsk->signal;
 
-		/* Track the min and max adjs to speed up the loop below */
-		if (adj > max_adj)
-			max_adj = adj;
-		if (adj < min_adj)
-			min_adj = adj;
+	spin_lock(&adj_index_lock);
+	if (!hlist_unhashed(&sig->simple_lmk_node))
+		__adj_index_del(sig);
+	spin_unlock(&adj_index_lock);
+}
+
+void simple_lmk_adj_changed(struct task_struct *tsk)
+{
+	struct signal_struct *sig = tsk->signal;
+
+	spin_lock(&adj_index_lock);
+	if (!hlist_unhashed(&sig->simple_lmk_node) &&
+	    sig->simple_lmk_bucket !=
+	    adj_to_bucket(READ_ONCE(sig->oom_score_adj))) {
+		__adj_index_del(sig);
+		__adj_index_add(sig);
 	}
+	spin_unlock(&adj_index_lock);
+}
+
+/* Return the highest non-empty bucket below the given one, or -1 if none */
+static int next_adj_bucket(int bucket)
+{
+	int next;
+
+	if (!bucket)
+		return -1;
+
+	next = find_last_bit(adj_bitmap, bucket);
+	return next < bucket ? next : -1;
+}
+
+static unsigned long find_victims(int *vindex, unsigned long target)
+{
+	unsigned long pages_found = 0;
+	int i;
+
+	/*
+	 * The index lock keeps the buckets stable, and the RCU read lock keeps
+	 * the threads of each indexed thread group from being freed.
+	 */
+	spin_lock(&adj_index_lock);
+	rcu_read_lock();
 
 	/* Start searching for victims from the highest adj (least important) */
-	for (i = max_adj; i >= min_adj; i--) {
+	for (i = next_adj_bucket(NR_ADJ_BUCKETS); i >= 0;
+	     i = next_adj_bucket(i)) {
+		struct signal_struct *sig;
 		int old_vindex;
 
-		tsk = task_bucket[i];
-		if (!tsk)
-			continue;
+		/* Iterate through every thread group with this adj */
+		old_vindex = *vindex;
+		hlist_for_each_entry(sig, &adj_bucket[i], simple_lmk_node) {
+			struct task_struct *tsk, *vtsk;
 
-		/* Clear out this bucket for the next time reclaim is done */
-		task_bucket[i] = NULL;
+			/*
+			 * Although oom_score_adj can still be changed while
+			 * this code runs, it doesn't really matter; we just
+			 * need a snapshot of the task's adj.
+			 */
+			if (sig->flags & (SIGNAL_GROUP_EXIT |
+					  SIGNAL_GROUP_COREDUMP))
+				continue;
 
-		/* Iterate through every task with this adj */
-		old_vindex = *vindex;
-		do {
-			struct task_struct *vtsk;
+			tsk = list_first_or_null_rcu(&sig->thread_head,
+						     struct task_struct,
+						     thread_node);
+			if (!tsk ||
+			    (thread_group_empty(tsk) && tsk->flags & PF_EXITING))
+				continue;
 
 			vtsk = find_lock_task_mm(tsk);
 			if (!vtsk)
@@ -139,7 +214,7 @@ static unsigned long find_victims(int *vindex)
 			/* Make sure there's space left in the victim array */
 			if (++*vindex == MAX_VICTIMS)
 				break;
-		} while ((tsk = tsk->simple_lmk_next));
+		}
 
 		/* Go to the next bucket if nothing was found */
 		if (*vindex == old_vindex)
@@ -153,20 +228,17 @@ static unsigned long find_victims(int *vindex)
 		     sizeof(*victims), victim_cmp, victim_swap);
 
 		/* Stop when we are out of space or have enough pages found */
-		if (*vindex == MAX_VICTIMS || pages_found >= MIN_FREE_PAGES) {
-			/* Zero out any remaining buckets we didn't touch */
-			if (i > min_adj)
-				memset(&task_bucket[min_adj], 0,
-				       (i - min_adj) * sizeof(*task_bucket));
+		if (*vindex == MAX_VICTIMS || pages_found >= target)
 			break;
-		}
 	}
+
 	rcu_read_unlock();
+	spin_unlock(&adj_index_lock);
 
 	return pages_found;
 }
 
-static int process_victims(int vlen)
+static int process_victims(int vlen, unsigned long target)
 {
 	unsigned long pages_found = 0;
 	int i, nr_to_kill = 0;
@@ -180,7 +252,7 @@ static int process_victims(int vlen)
 		struct task_struct *vtsk = victim->tsk;
 
 		/* The victim's mm lock is taken in find_victims; release it */
-		if (pages_found >= MIN_FREE_PAGES) {
+		if (pages_found >= target) {
 			task_unlock(vtsk);
 		} else {
 			pages_found += victim->size;
@@ -200,7 +272,7 @@ static void set_task_rt_prio(struct task_struct *tsk, int priority)
 	sched_setscheduler_nocheck(tsk, SCHED_RR, &rt_prio);
 }
 
-static void scan_and_kill(void)
+static void scan_and_kill(unsigned long target)
 {
 	int i, nr_to_kill, nr_found = 0;
 	unsigned long pages_found;
@@ -214,16 +286,16 @@ static void scan_and_kill(void)
 	write_unlock(&mm_free_lock);
 
 	/* Populate the victims array with tasks sorted by adj and then size */
-	pages_found = find_victims(&nr_found);
+	pages_found = find_victims(&nr_found, target);
 	if (unlikely(!nr_found)) {
 		pr_err_ratelimited("No processes available to kill!\n");
 		return;
 	}
 
 	/* Minimize the number of victims if we found more pages than needed */
-	if (pages_found > MIN_FREE_PAGES) {
+	if (pages_found > target) {
 		/* First round of processing to weed out unneeded victims */
-		nr_to_kill = process_victims(nr_found);
+		nr_to_kill = process_victims(nr_found, target);
 
 		/*
 		 * Try to kill as few of the chosen victims as possible by
@@ -235,7 +307,7 @@ static void scan_and_kill(void)
 		     victim_swap);
 
 		/* Second round of processing to finally select the victims */
-		nr_to_kill = process_victims(nr_to_kill);
+		nr_to_kill = process_victims(nr_to_kill, target);
 	} else {
 		/* Too few pages found, so all the victims need to be killed */
 		nr_to_kill = nr_found;
@@ -323,13 +395,16 @@ static void scan_and_kill(void)
 
 static int simple_lmk_reclaim_thread(void *data)
 {
+	unsigned long target;
+
 	/* Use maximum RT priority */
 	set_task_rt_prio(current, MAX_RT_PRIO - 1);
 	set_freezable();
 
 	while (1) {
 		wait_event_freezable(oom_waitq, atomic_read(&needs_reclaim));
-		scan_and_kill();
+		target = atomic_long_xchg(&reclaim_target, 0);
+		scan_and_kill(target ?: MIN_FREE_PAGES);
 		atomic_set(&needs_reclaim, 0);
 	}
 
@@ -461,15 +536,29 @@ void simple_lmk_mm_freed(struct mm_struct *mm)
 	read_unlock(&mm_free_lock);
 }
 
+static void trigger_reclaim(unsigned long pages)
+{
+	long old = atomic_long_read(&reclaim_target), prev;
+
+	/* Keep the largest target requested until the next reclaim */
+	while (old < (long)pages) {
+		prev = atomic_long_cmpxchg(&reclaim_target, old, pages);
+		if (prev == old)
+			break;
+		old = prev;
+	}
+
+	atomic_set(&needs_reclaim, 1);
+	smp_mb__after_atomic();
+	if (waitqueue_active(&oom_waitq))
+		wake_up(&oom_waitq);
+}
+
 static int simple_lmk_vmpressure_cb(struct notifier_block *nb,
 				    unsigned long pressure, void *data)
 {
-	if (pressure == 100) {
-		atomic_set(&needs_reclaim, 1);
-		smp_mb__after_atomic();
-		if (waitqueue_active(&oom_waitq))
-			wake_up(&oom_waitq);
-	}
+	if (pressure == 100)
+		trigger_reclaim(MIN_FREE_PAGES);
 
 	return NOTIFY_OK;
 }
@@ -479,6 +568,104 @@ static struct notifier_block vmpressure_notif = {
 	.priority = INT_MAX
 };
 
+#ifdef CONFIG_ANDROID_SIMPLE_LMK_PSI
+/* System-wide memory stall thresholds, in the PSI trigger syntax */
+#define PSI_SOME_TRIGGER "some 70000 1000000"
+#define PSI_FULL_TRIGGER "full 50000 1000000"
+
+/*
+ * A partial stall asks for MIN_FREE_PAGES >> PSI_MAX_SEVERITY pages to be
+ * freed. Each partial stall within PSI_ESCALATE_EXPIRES of the previous one
+ * doubles that, up to MIN_FREE_PAGES, which a full stall asks for at once.
+ */
+#define PSI_MAX_SEVERITY 2
+#define PSI_ESCALATE_EXPIRES msecs_to_jiffies(1500)
+
+struct psi_monitor {
+	struct psi_trigger *trig;
+	struct wait_queue_entry wq;
+	bool full;
+};
+
+static struct psi_monitor psi_monitors[2];
+static unsigned long last_stall;
+static int some_severity;
+
+/* Called from the psimon kthread, which serializes the triggers of a group */
+static int simple_lmk_psi_wake(struct wait_queue_entry *wq, unsigned int mode,
+			       int sync, void *key)
+{
+	struct psi_monitor *mon = container_of(wq, typeof(*mon), wq);
+	unsigned long pages;
+
+	/* Consume the event so the trigger can fire again */
+	if (cmpxchg(&mon->trig->event, 1, 0) != 1)
+		return 0;
+
+	if (mon->full) {
+		some_severity = PSI_MAX_SEVERITY;
+		pages = MIN_FREE_PAGES;
+	} else {
+		if (time_before(jiffies, last_stall + PSI_ESCALATE_EXPIRES))
+			some_severity = min(some_severity + 1,
+					    PSI_MAX_SEVERITY);
+		else
+			some_severity = 0;
+		pages = MIN_FREE_PAGES >> (PSI_MAX_SEVERITY - some_severity);
+	}
+	last_stall = jiffies;
+
+	trigger_reclaim(pages);
+	return 0;
+}
+
+static bool simple_lmk_psi_init(void)
+{
+	static const struct {
+		const char *trigger;
+		bool full;
+	} psi_triggers[ARRAY_SIZE(psi_monitors)] = {
+		{ PSI_SOME_TRIGGER, false },
+		{ PSI_FULL_TRIGGER, true }
+	};
+	char buf[32];
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(psi_monitors); i++) {
+		struct psi_monitor *mon = &psi_monitors[i];
+
+		/* psi_trigger_create() wants a writable buffer */
+		strlcpy(buf, psi_triggers[i].trigger, sizeof(buf));
+		mon->trig = psi_trigger_create(&psi_system, buf, strlen(buf),
+					       PSI_MEM);
+		if (IS_ERR(mon->trig)) {
+			pr_err("Failed to arm PSI trigger \"%s\", err: %ld\n",
+			       psi_triggers[i].trigger, PTR_ERR(mon->trig));
+			goto err;
+		}
+
+		mon->full = psi_triggers[i].full;
+		init_waitqueue_func_entry(&mon->wq, simple_lmk_psi_wake);
+		add_wait_queue(&mon->trig->event_wait, &mon->wq);
+	}
+
+	return true;
+
+err:
+	while (i--) {
+		remove_wait_queue(&psi_monitors[i].trig->event_wait,
+				  &psi_monitors[i].wq);
+		psi_trigger_destroy(psi_monitors[i].trig);
+	}
+	return false;
+}
+#else
+static bool simple_lmk_psi_init(void)
+{
+	return false;
+}
+#endif
+
 /* Initialize Simple LMK when lmkd in Android writes to the minfree parameter */
 static int simple_lmk_init_set(const char *val, const struct kernel_param *kp)
 {
@@ -492,7 +679,8 @@ static int simple_lmk_init_set(const char *val, const struct kernel_param *kp)
 		thread = kthread_run(simple_lmk_reclaim_thread, NULL,
 				     "simple_lmkd");
 		BUG_ON(IS_ERR(thread));
-		BUG_ON(vmpressure_notifier_register(&vmpressure_notif));
+		if (!simple_lmk_psi_init())
+			BUG_ON(vmpressure_notifier_register(&vmpressure_notif));
 	}
 
 	return 0;
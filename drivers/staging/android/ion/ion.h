@@ -25,8 +25,11 @@
 #include <linux/rbtree.h>
 #include <linux/sched.h>
 #include <linux/shrinker.h>
+#include <linux/sizes.h>
+#include <linux/spinlock.h>
 #include <linux/types.h>
 #include <linux/miscdevice.h>
+#include <linux/workqueue.h>
 
 #include "../uapi/ion.h"
 
@@ -320,6 +323,23 @@ size_t ion_heap_freelist_size(struct ion_heap *heap);
  * many systems
  */
 
+#define ION_PAGE_POOL_PCP_MAX	32
+#define ION_PAGE_POOL_PCP_SIZE	SZ_256K
+
+/**
+ * struct ion_page_pool_pcp - per-cpu cache in front of a page pool
+ * @lock:		protects this cache, only contended while draining
+ * @count:		number of items in @pages
+ * @high_count:		number of highmem items in @pages
+ * @pages:		cached items, the most recently freed one last
+ */
+struct ion_page_pool_pcp {
+	spinlock_t lock;
+	int count;
+	int high_count;
+	struct page *pages[ION_PAGE_POOL_PCP_MAX];
+};
+
 /**
  * struct ion_page_pool - pagepool struct
  * @high_count:		number of highmem items in the pool
@@ -332,6 +352,13 @@ size_t ion_heap_freelist_size(struct ion_heap *heap);
  * @order:		order of pages in the pool
  * @list:		plist node for list of pools
  * @cached:		it's cached pool or not
+ * @low_mark:		refill the pool in the background below this many items
+ * @high_mark:		number of items the background refill stops at
+ * @refill_work:	work that tops the pool up with zeroed pages
+ * @pcp:		per-cpu caches, NULL if the order is too large for them
+ * @pcp_high:		capacity of each per-cpu cache
+ * @pcp_batch:		number of items moved between a per-cpu cache and
+ *			the shared lists at once
  *
  * Allows you to keep a pool of pre allocated pages to use from your heap.
  * Keeping a pool of pages that is ready for dma, ie any cached mapping have
@@ -348,6 +375,12 @@ struct ion_page_pool {
 	gfp_t gfp_mask;
 	unsigned int order;
 	struct plist_node list;
+	unsigned int low_mark;
+	unsigned int high_mark;
+	struct work_struct refill_work;
+	struct ion_page_pool_pcp __percpu *pcp;
+	unsigned int pcp_high;
+	unsigned int pcp_batch;
 };
 
 struct ion_page_pool *ion_page_pool_create(gfp_t gfp_mask, unsigned int order,
@@ -355,6 +388,31 @@ struct ion_page_pool *ion_page_pool_create(gfp_t gfp_mask, unsigned int order,
 void ion_page_pool_destroy(struct ion_page_pool *pool);
 struct page *ion_page_pool_alloc(struct ion_page_pool *pool, bool nozero);
 void ion_page_pool_free(struct ion_page_pool *pool, struct page *page);
+int ion_page_pool_pcp_count(struct ion_page_pool *pool);
+
+/** ion_page_pool_alloc_bulk - allocates several pages from the pool
+ * @pool:		the pool
+ * @nozero:		pages allocated from the buddy need not be zeroed
+ * @pages:		list the allocated pages are appended to
+ * @nr_pages:		number of pages wanted
+ *
+ * Takes as many pages as possible from the pool under a single lock hold and
+ * falls back to the buddy allocator for the rest. Stops at the first failure.
+ *
+ * returns the number of pages appended to @pages
+ */
+int ion_page_pool_alloc_bulk(struct ion_page_pool *pool, bool nozero,
+			     struct list_head *pages, int nr_pages);
+
+/** ion_page_pool_set_watermark - keeps a stock of zeroed pages in the pool
+ * @pool:		the pool
+ * @low_mark:		background refill starts below this many items
+ * @high_mark:		background refill stops at this many items
+ *
+ * A high_mark of 0 disables the background refill.
+ */
+void ion_page_pool_set_watermark(struct ion_page_pool *pool,
+				 unsigned int low_mark, unsigned int high_mark);
 
 /** ion_page_pool_shrink - shrinks the size of the memory cached in the pool
  * @pool:		the pool
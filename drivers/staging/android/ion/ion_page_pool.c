@@ -20,13 +20,17 @@
 #include <linux/fs.h>
 #include <linux/list.h>
 #include <linux/init.h>
+#include <linux/percpu.h>
 #include <linux/slab.h>
 #include <linux/swap.h>
+#include <linux/workqueue.h>
 
 #include <asm/cacheflush.h>
 
 #include "ion.h"
 
+static struct workqueue_struct *ion_page_pool_wq;
+
 static void *ion_page_pool_alloc_pages(struct ion_page_pool *pool, bool nozero)
 {
 	gfp_t gfpmask = pool->gfp_mask;
@@ -50,9 +54,8 @@ static void ion_page_pool_free_pages(struct ion_page_pool *pool,
 	__free_pages(page, pool->order);
 }
 
-static int ion_page_pool_add(struct ion_page_pool *pool, struct page *page)
+static void __ion_page_pool_add(struct ion_page_pool *pool, struct page *page)
 {
-	mutex_lock(&pool->mutex);
 	if (PageHighMem(page)) {
 		list_add_tail(&page->lru, &pool->high_items);
 		pool->high_count++;
@@ -60,10 +63,32 @@ static int ion_page_pool_add(struct ion_page_pool *pool, struct page *page)
 		list_add_tail(&page->lru, &pool->low_items);
 		pool->low_count++;
 	}
+}
+
+static int ion_page_pool_add(struct ion_page_pool *pool, struct page *page)
+{
+	mutex_lock(&pool->mutex);
+	__ion_page_pool_add(pool, page);
 	mutex_unlock(&pool->mutex);
 	return 0;
 }
 
+static void ion_page_pool_add_list(struct ion_page_pool *pool,
+				   struct list_head *pages)
+{
+	struct page *page, *tmp;
+
+	if (list_empty(pages))
+		return;
+
+	mutex_lock(&pool->mutex);
+	list_for_each_entry_safe(page, tmp, pages, lru) {
+		list_del(&page->lru);
+		__ion_page_pool_add(pool, page);
+	}
+	mutex_unlock(&pool->mutex);
+}
+
 static struct page *ion_page_pool_remove(struct ion_page_pool *pool, bool high)
 {
 	struct page *page;
@@ -82,26 +107,227 @@ static struct page *ion_page_pool_remove(struct ion_page_pool *pool, bool high)
 	return page;
 }
 
-struct page *ion_page_pool_alloc(struct ion_page_pool *pool, bool nozero)
+/* moves up to @nr_pages items from the shared lists to @pages */
+static int __ion_page_pool_take(struct ion_page_pool *pool,
+				struct list_head *pages, int nr_pages)
+{
+	int nr = 0;
+
+	while (nr < nr_pages && pool->high_count) {
+		list_add_tail(&ion_page_pool_remove(pool, true)->lru, pages);
+		nr++;
+	}
+	while (nr < nr_pages && pool->low_count) {
+		list_add_tail(&ion_page_pool_remove(pool, false)->lru, pages);
+		nr++;
+	}
+
+	return nr;
+}
+
+static void ion_page_pool_pcp_push(struct ion_page_pool_pcp *pcp,
+				   struct page *page)
+{
+	if (PageHighMem(page))
+		pcp->high_count++;
+	pcp->pages[pcp->count++] = page;
+}
+
+static struct page *ion_page_pool_pcp_pop(struct ion_page_pool_pcp *pcp)
+{
+	struct page *page = pcp->pages[--pcp->count];
+
+	if (PageHighMem(page))
+		pcp->high_count--;
+	return page;
+}
+
+/*
+ * The per-cpu caches sit in front of the shared lists so that concurrent
+ * allocators don't serialise on pool->mutex. Each cache has its own lock which
+ * is only contended when the shrinker drains the caches of all cpus. A task
+ * that migrates after picking a cache simply keeps using the cache of the cpu
+ * it started on.
+ */
+static int ion_page_pool_pcp_alloc(struct ion_page_pool *pool,
+				   struct list_head *pages, int nr_pages)
+{
+	struct ion_page_pool_pcp *pcp;
+	int nr = 0;
+
+	if (!pool->pcp)
+		return 0;
+
+	pcp = raw_cpu_ptr(pool->pcp);
+	spin_lock(&pcp->lock);
+	while (nr < nr_pages && pcp->count) {
+		list_add_tail(&ion_page_pool_pcp_pop(pcp)->lru, pages);
+		nr++;
+	}
+	spin_unlock(&pcp->lock);
+
+	return nr;
+}
+
+/* puts @pages in the local cache, returning what doesn't fit to the pool */
+static void ion_page_pool_pcp_fill(struct ion_page_pool *pool,
+				   struct list_head *pages)
+{
+	struct ion_page_pool_pcp *pcp = raw_cpu_ptr(pool->pcp);
+	struct page *page, *tmp;
+
+	spin_lock(&pcp->lock);
+	list_for_each_entry_safe(page, tmp, pages, lru) {
+		if (pcp->count == pool->pcp_high)
+			break;
+		list_del(&page->lru);
+		ion_page_pool_pcp_push(pcp, page);
+	}
+	spin_unlock(&pcp->lock);
+
+	ion_page_pool_add_list(pool, pages);
+}
+
+static bool ion_page_pool_pcp_free(struct ion_page_pool *pool,
+				   struct page *page)
+{
+	struct ion_page_pool_pcp *pcp;
+	LIST_HEAD(drain);
+	int i;
+
+	if (!pool->pcp)
+		return false;
+
+	pcp = raw_cpu_ptr(pool->pcp);
+	spin_lock(&pcp->lock);
+	if (pcp->count == pool->pcp_high) {
+		/* hand the oldest batch back to the shared lists */
+		for (i = 0; i < pool->pcp_batch; i++) {
+			if (PageHighMem(pcp->pages[i]))
+				pcp->high_count--;
+			list_add_tail(&pcp->pages[i]->lru, &drain);
+		}
+		pcp->count -= pool->pcp_batch;
+		memmove(pcp->pages, pcp->pages + pool->pcp_batch,
+			pcp->count * sizeof(pcp->pages[0]));
+	}
+	ion_page_pool_pcp_push(pcp, page);
+	spin_unlock(&pcp->lock);
+
+	ion_page_pool_add_list(pool, &drain);
+	return true;
+}
+
+static void ion_page_pool_pcp_drain(struct ion_page_pool *pool)
+{
+	struct ion_page_pool_pcp *pcp;
+	LIST_HEAD(drain);
+	int cpu;
+
+	if (!pool->pcp)
+		return;
+
+	for_each_possible_cpu(cpu) {
+		pcp = per_cpu_ptr(pool->pcp, cpu);
+		spin_lock(&pcp->lock);
+		while (pcp->count)
+			list_add_tail(&ion_page_pool_pcp_pop(pcp)->lru, &drain);
+		spin_unlock(&pcp->lock);
+	}
+
+	ion_page_pool_add_list(pool, &drain);
+}
+
+int ion_page_pool_pcp_count(struct ion_page_pool *pool)
+{
+	int cpu, count = 0;
+
+	if (!pool->pcp)
+		return 0;
+
+	for_each_possible_cpu(cpu)
+		count += READ_ONCE(per_cpu_ptr(pool->pcp, cpu)->count);
+
+	return count;
+}
+
+static int ion_page_pool_pcp_high_count(struct ion_page_pool *pool)
 {
-	struct page *page = NULL;
+	int cpu, count = 0;
+
+	if (!pool->pcp)
+		return 0;
+
+	for_each_possible_cpu(cpu)
+		count += READ_ONCE(per_cpu_ptr(pool->pcp, cpu)->high_count);
+
+	return count;
+}
+
+/* items in the pool, including those in the per-cpu caches */
+static int ion_page_pool_count(struct ion_page_pool *pool)
+{
+	return READ_ONCE(pool->high_count) + READ_ONCE(pool->low_count) +
+	       ion_page_pool_pcp_count(pool);
+}
+
+static void ion_page_pool_kick_refill(struct ion_page_pool *pool)
+{
+	if (!pool->high_mark || !ion_page_pool_wq)
+		return;
+
+	if (ion_page_pool_count(pool) < pool->low_mark)
+		queue_work(ion_page_pool_wq, &pool->refill_work);
+}
+
+int ion_page_pool_alloc_bulk(struct ion_page_pool *pool, bool nozero,
+			     struct list_head *pages, int nr_pages)
+{
+	struct page *page;
+	LIST_HEAD(refill);
+	int nr;
 
 	BUG_ON(!pool);
 
+	nr = ion_page_pool_pcp_alloc(pool, pages, nr_pages);
+	if (nr == nr_pages)
+		return nr;
+
 	mutex_lock(&pool->mutex);
-	if (pool->high_count)
-		page = ion_page_pool_remove(pool, true);
-	else if (pool->low_count)
-		page = ion_page_pool_remove(pool, false);
+	nr += __ion_page_pool_take(pool, pages, nr_pages - nr);
+	if (pool->pcp)
+		__ion_page_pool_take(pool, &refill, pool->pcp_batch);
 	mutex_unlock(&pool->mutex);
 
-	if (!page) {
+	if (!list_empty(&refill))
+		ion_page_pool_pcp_fill(pool, &refill);
+
+	ion_page_pool_kick_refill(pool);
+
+	for (; nr < nr_pages; nr++) {
 		page = ion_page_pool_alloc_pages(pool, nozero);
-		if (page && !pool->cached)
+		if (!page)
+			break;
+		if (!pool->cached)
 			__flush_dcache_area(page_to_virt(page),
 					    1 << (PAGE_SHIFT + pool->order));
+		list_add_tail(&page->lru, pages);
 	}
 
+	return nr;
+}
+
+struct page *ion_page_pool_alloc(struct ion_page_pool *pool, bool nozero)
+{
+	struct page *page;
+	LIST_HEAD(pages);
+
+	if (!ion_page_pool_alloc_bulk(pool, nozero, &pages, 1))
+		return NULL;
+
+	page = list_first_entry(&pages, struct page, lru);
+	list_del(&page->lru);
+
 	return page;
 }
 
@@ -111,6 +337,9 @@ void ion_page_pool_free(struct ion_page_pool *pool, struct page *page)
 
 	BUG_ON(pool->order != compound_order(page));
 
+	if (ion_page_pool_pcp_free(pool, page))
+		return;
+
 	ret = ion_page_pool_add(pool, page);
 	if (ret)
 		ion_page_pool_free_pages(pool, page);
@@ -119,9 +348,14 @@ void ion_page_pool_free(struct ion_page_pool *pool, struct page *page)
 static int ion_page_pool_total(struct ion_page_pool *pool, bool high)
 {
 	int count = pool->low_count;
+	int nr_pcp = ion_page_pool_pcp_count(pool);
 
 	if (high)
 		count += pool->high_count;
+	else
+		nr_pcp -= ion_page_pool_pcp_high_count(pool);
+	/* the per-cpu counts are read locklessly */
+	count += max(nr_pcp, 0);
 
 	return count << pool->order;
 }
@@ -140,6 +374,8 @@ int ion_page_pool_shrink(struct ion_page_pool *pool, gfp_t gfp_mask,
 	if (nr_to_scan == 0)
 		return ion_page_pool_total(pool, high);
 
+	ion_page_pool_pcp_drain(pool);
+
 	while (freed < nr_to_scan) {
 		struct page *page;
 
@@ -160,6 +396,39 @@ int ion_page_pool_shrink(struct ion_page_pool *pool, gfp_t gfp_mask,
 	return freed;
 }
 
+/*
+ * Tops the pool up to its high mark with zeroed pages so that allocations
+ * don't have to clear them. Only pages that are free without any reclaim are
+ * taken: the refill stops as soon as the zone watermarks are hit, which also
+ * keeps it from racing with the shrinker for the same memory.
+ */
+static void ion_page_pool_refill(struct work_struct *work)
+{
+	struct ion_page_pool *pool = container_of(work, struct ion_page_pool,
+						  refill_work);
+	gfp_t gfpmask = (pool->gfp_mask | __GFP_ZERO | __GFP_NOWARN |
+			 __GFP_NORETRY) & ~__GFP_RECLAIM;
+	struct page *page;
+
+	while (ion_page_pool_count(pool) < pool->high_mark) {
+		page = alloc_pages(gfpmask, pool->order);
+		if (!page)
+			break;
+		if (!pool->cached)
+			__flush_dcache_area(page_to_virt(page),
+					    1 << (PAGE_SHIFT + pool->order));
+		ion_page_pool_add(pool, page);
+		cond_resched();
+	}
+}
+
+void ion_page_pool_set_watermark(struct ion_page_pool *pool,
+				 unsigned int low_mark, unsigned int high_mark)
+{
+	pool->low_mark = min(low_mark, high_mark);
+	pool->high_mark = high_mark;
+}
+
 struct ion_page_pool *ion_page_pool_create(gfp_t gfp_mask, unsigned int order,
 					   bool cached)
 {
@@ -176,17 +445,43 @@ struct ion_page_pool *ion_page_pool_create(gfp_t gfp_mask, unsigned int order,
 	mutex_init(&pool->mutex);
 	plist_node_init(&pool->list, order);
 	pool->cached = cached;
+	pool->low_mark = 0;
+	pool->high_mark = 0;
+	INIT_WORK(&pool->refill_work, ion_page_pool_refill);
+
+	pool->pcp_high = min_t(unsigned int, ION_PAGE_POOL_PCP_MAX,
+			       ION_PAGE_POOL_PCP_SIZE >> (PAGE_SHIFT + order));
+	pool->pcp_batch = max(pool->pcp_high / 2, 1U);
+	pool->pcp = NULL;
+	if (pool->pcp_high) {
+		int cpu;
+
+		pool->pcp = alloc_percpu(struct ion_page_pool_pcp);
+		if (!pool->pcp) {
+			kfree(pool);
+			return NULL;
+		}
+		for_each_possible_cpu(cpu)
+			spin_lock_init(&per_cpu_ptr(pool->pcp, cpu)->lock);
+	}
 
 	return pool;
 }
 
 void ion_page_pool_destroy(struct ion_page_pool *pool)
 {
+	cancel_work_sync(&pool->refill_work);
+	free_percpu(pool->pcp);
 	kfree(pool);
 }
 
 static int __init ion_page_pool_init(void)
 {
+	ion_page_pool_wq = alloc_workqueue("ion_page_pool",
+					   WQ_UNBOUND | WQ_FREEZABLE, 0);
+	if (!ion_page_pool_wq)
+		return -ENOMEM;
+
 	return 0;
 }
 device_initcall(ion_page_pool_init);
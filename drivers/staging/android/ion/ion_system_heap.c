@@ -21,6 +21,7 @@
 #include <linux/mm.h>
 #include <linux/scatterlist.h>
 #include <linux/seq_file.h>
+#include <linux/sizes.h>
 #include <linux/slab.h>
 #include <linux/vmalloc.h>
 #include "ion.h"
@@ -32,6 +33,8 @@ static gfp_t high_order_gfp_flags = (GFP_HIGHUSER | __GFP_ZERO | __GFP_NOWARN |
 static gfp_t low_order_gfp_flags  = GFP_HIGHUSER | __GFP_ZERO;
 static const unsigned int orders[] = {8, 4, 0};
 
+#define PREZERO_POOL_SIZE	(CONFIG_ION_SYSTEM_HEAP_PREZERO_KB * SZ_1K)
+
 static int order_to_index(unsigned int order)
 {
 	int i;
@@ -59,24 +62,21 @@ struct ion_system_heap {
  * clean for cached buffer. The uncached buffer are always non-cached
  * since it's allocated. So no need for non-cached pages.
  */
-static struct page *alloc_buffer_page(struct ion_system_heap *heap,
-				      struct ion_buffer *buffer,
-				      unsigned long order)
+static int alloc_buffer_pages(struct ion_system_heap *heap,
+			      struct ion_buffer *buffer, unsigned long order,
+			      struct list_head *pages, int nr_pages)
 {
 	bool cached = ion_buffer_cached(buffer);
 	bool nozero = buffer->flags & ION_FLAG_NOZEROED;
 	bool cleancache = buffer->flags & ION_FLAG_SYNC_FORCE;
 	struct ion_page_pool *pool;
-	struct page *page;
 
 	if (!cached || cleancache)
 		pool = heap->uncached_pools[order_to_index(order)];
 	else
 		pool = heap->cached_pools[order_to_index(order)];
 
-	page = ion_page_pool_alloc(pool, nozero);
-
-	return page;
+	return ion_page_pool_alloc_bulk(pool, nozero, pages, nr_pages);
 }
 
 static void free_buffer_page(struct ion_system_heap *heap,
@@ -106,30 +106,6 @@ static void free_buffer_page(struct ion_system_heap *heap,
 	ion_page_pool_free(pool, page);
 }
 
-static struct page *alloc_largest_available(struct ion_system_heap *heap,
-					    struct ion_buffer *buffer,
-					    unsigned long size,
-					    unsigned int max_order)
-{
-	struct page *page;
-	int i;
-
-	for (i = 0; i < NUM_ORDERS; i++) {
-		if (size < order_to_size(orders[i]))
-			continue;
-		if (max_order < orders[i])
-			continue;
-
-		page = alloc_buffer_page(heap, buffer, orders[i]);
-		if (!page)
-			continue;
-
-		return page;
-	}
-
-	return NULL;
-}
-
 static int ion_system_heap_allocate(struct ion_heap *heap,
 				    struct ion_buffer *buffer,
 				    unsigned long size,
@@ -142,32 +118,40 @@ static int ion_system_heap_allocate(struct ion_heap *heap,
 	struct scatterlist *sg;
 	struct list_head pages;
 	struct page *page, *tmp_page;
-	int i = 0;
+	int i, nents = 0;
 	unsigned long size_remaining = PAGE_ALIGN(size);
-	unsigned int max_order = orders[0];
 
 	if (size / PAGE_SIZE > totalram_pages / 2) {
 		perrfn("too large allocation, %zu bytes", size);
 		return -ENOMEM;
 	}
 
+	/*
+	 * Take as many pages of each order as fit, largest order first. Once an
+	 * order runs dry, only the smaller orders are tried for the remainder.
+	 */
 	INIT_LIST_HEAD(&pages);
-	while (size_remaining > 0) {
-		page = alloc_largest_available(sys_heap, buffer, size_remaining,
-					       max_order);
-		if (!page)
-			goto free_pages;
-		list_add_tail(&page->lru, &pages);
-		size_remaining -= PAGE_SIZE << compound_order(page);
-		max_order = compound_order(page);
-		i++;
+	for (i = 0; i < NUM_ORDERS && size_remaining > 0; i++) {
+		int nr_pages = size_remaining / order_to_size(orders[i]);
+
+		if (!nr_pages)
+			continue;
+
+		nr_pages = alloc_buffer_pages(sys_heap, buffer, orders[i],
+					      &pages, nr_pages);
+		size_remaining -= (unsigned long)nr_pages *
+						order_to_size(orders[i]);
+		nents += nr_pages;
 	}
+	if (size_remaining > 0)
+		goto free_pages;
+
 	table = kmalloc(sizeof(*table), GFP_KERNEL);
 	if (!table)
 		goto free_pages;
 
-	if (sg_alloc_table(table, i, GFP_KERNEL)) {
-		perrfn("failed to alloc sgtable of %d nent", i);
+	if (sg_alloc_table(table, nents, GFP_KERNEL)) {
+		perrfn("failed to alloc sgtable of %d nent", nents);
 		goto free_table;
 	}
 
@@ -270,7 +254,7 @@ static int ion_system_heap_debug_show(struct ion_heap *heap, struct seq_file *s,
 	struct ion_system_heap *sys_heap = container_of(heap,
 							struct ion_system_heap,
 							heap);
-	int i;
+	int i, nr_pcp;
 	struct ion_page_pool *pool;
 
 	for (i = 0; i < NUM_ORDERS; i++) {
@@ -282,6 +266,10 @@ static int ion_system_heap_debug_show(struct ion_heap *heap, struct seq_file *s,
 		seq_printf(s, "%d order %u lowmem pages uncached %lu total\n",
 			   pool->low_count, pool->order,
 			   (PAGE_SIZE << pool->order) * pool->low_count);
+		nr_pcp = ion_page_pool_pcp_count(pool);
+		seq_printf(s, "%d order %u per-cpu pages uncached %lu total\n",
+			   nr_pcp, pool->order,
+			   (PAGE_SIZE << pool->order) * nr_pcp);
 	}
 
 	for (i = 0; i < NUM_ORDERS; i++) {
@@ -293,6 +281,10 @@ static int ion_system_heap_debug_show(struct ion_heap *heap, struct seq_file *s,
 		seq_printf(s, "%d order %u lowmem pages cached %lu total\n",
 			   pool->low_count, pool->order,
 			   (PAGE_SIZE << pool->order) * pool->low_count);
+		nr_pcp = ion_page_pool_pcp_count(pool);
+		seq_printf(s, "%d order %u per-cpu pages cached %lu total\n",
+			   nr_pcp, pool->order,
+			   (PAGE_SIZE << pool->order) * nr_pcp);
 	}
 	return 0;
 }
@@ -321,6 +313,12 @@ static int ion_system_heap_create_pools(struct ion_page_pool **pools,
 		pool = ion_page_pool_create(gfp_flags, orders[i], cached);
 		if (!pool)
 			goto err_create_pool;
+		if (!cached) {
+			unsigned int stock = PREZERO_POOL_SIZE /
+						order_to_size(orders[i]);
+
+			ion_page_pool_set_watermark(pool, stock / 2, stock);
+		}
 		pools[i] = pool;
 	}
 	return 0;
@@ -348,12 +346,14 @@ void show_ion_system_heap_pool_size(struct seq_file *s)
 		pool = system_heap->uncached_pools[i];
 		uncached += (1 << pool->order) * pool->high_count;
 		uncached += (1 << pool->order) * pool->low_count;
+		uncached += (1 << pool->order) * ion_page_pool_pcp_count(pool);
 	}
 
 	for (i = 0; i < NUM_ORDERS; i++) {
 		pool = system_heap->cached_pools[i];
 		cached += (1 << pool->order) * pool->high_count;
 		cached += (1 << pool->order) * pool->low_count;
+		cached += (1 << pool->order) * ion_page_pool_pcp_count(pool);
 	}
 
 	if (s)
@@ -0,0 +1,1024 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * fs/f2fs/compress.c
+ *
+ * Transparent compression of regular file data, one cluster at a time.
+ *
+ * A cluster of a compressed file is either laid out like any other data,
+ * one block per page, or compressed: its first block address is then
+ * COMPRESS_ADDR, the following slots point to the blocks holding the
+ * compressed payload and the rest of the cluster is NULL_ADDR.
+ */
+#include <linux/fs.h>
+#include <linux/f2fs_fs.h>
+#include <linux/writeback.h>
+#include <linux/pagemap.h>
+#include <linux/highmem.h>
+#include <linux/scatterlist.h>
+#include <linux/sched/mm.h>
+#include <linux/lzo.h>
+#include <linux/lz4.h>
+#include <crypto/acompress.h>
+
+#include "f2fs.h"
+#include "node.h"
+#include "segment.h"
+
+/* worst case of compressed pages per cluster, header included */
+#define MAX_COMPRESS_PAGES	(MAX_COMPRESS_CLUSTER_SIZE + 2)
+
+/* page_private() tag of a compressed page under writeback */
+#define COMPRESS_PAGE_TAG	1UL
+
+struct f2fs_acomp_ctx {
+	struct acomp_req *req;
+	struct crypto_wait wait;
+	struct mutex mutex;		/* serializes users of this context */
+	struct page *scratch;		/* sink for unwanted output */
+	struct scatterlist src[MAX_COMPRESS_PAGES];
+	struct scatterlist dst[MAX_COMPRESS_PAGES];
+};
+
+struct f2fs_compressor {
+	const char *name;		/* crypto algorithm name */
+	unsigned int (*worst_size)(unsigned int len);
+	struct crypto_acomp *tfm;
+	struct f2fs_acomp_ctx __percpu *ctx;
+};
+
+/* tracks the raw pages of a cluster while its compressed pages are written */
+struct compress_io_ctx {
+	struct inode *inode;
+	atomic_t pending_pages;		/* compressed pages under writeback */
+	unsigned int nr_rpages;
+	struct page *rpages[MAX_COMPRESS_CLUSTER_SIZE];
+};
+
+#ifdef CONFIG_F2FS_FS_LZO
+static unsigned int lzo_worst_size(unsigned int len)
+{
+	return lzo1x_worst_compress(len);
+}
+#endif
+
+#ifdef CONFIG_F2FS_FS_LZ4
+static unsigned int lz4_worst_size(unsigned int len)
+{
+	return LZ4_COMPRESSBOUND(len);
+}
+#endif
+
+static struct f2fs_compressor f2fs_compressors[COMPRESS_MAX] = {
+#ifdef CONFIG_F2FS_FS_LZO
+	[COMPRESS_LZO] = { .name = "lzo", .worst_size = lzo_worst_size },
+#endif
+#ifdef CONFIG_F2FS_FS_LZ4
+	[COMPRESS_LZ4] = { .name = "lz4", .worst_size = lz4_worst_size },
+#endif
+};
+
+static DEFINE_MUTEX(f2fs_compress_mutex);
+
+static void free_acomp_ctx(struct f2fs_acomp_ctx __percpu *actx)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct f2fs_acomp_ctx *ctx = per_cpu_ptr(actx, cpu);
+
+		if (ctx->req)
+			acomp_request_free(ctx->req);
+		if (ctx->scratch)
+			__free_page(ctx->scratch);
+	}
+	free_percpu(actx);
+}
+
+static int init_compressor(struct f2fs_compressor *comp)
+{
+	struct f2fs_acomp_ctx __percpu *actx;
+	struct crypto_acomp *tfm;
+	int cpu;
+
+	tfm = crypto_alloc_acomp(comp->name, 0, 0);
+	if (IS_ERR(tfm))
+		return PTR_ERR(tfm);
+
+	actx = alloc_percpu(struct f2fs_acomp_ctx);
+	if (!actx)
+		goto free_tfm;
+
+	for_each_possible_cpu(cpu) {
+		struct f2fs_acomp_ctx *ctx = per_cpu_ptr(actx, cpu);
+
+		ctx->req = acomp_request_alloc(tfm);
+		ctx->scratch = alloc_page(GFP_KERNEL);
+		if (!ctx->req || !ctx->scratch)
+			goto free_ctx;
+
+		crypto_init_wait(&ctx->wait);
+		acomp_request_set_callback(ctx->req, CRYPTO_TFM_REQ_MAY_BACKLOG,
+						crypto_req_done, &ctx->wait);
+		mutex_init(&ctx->mutex);
+	}
+
+	comp->tfm = tfm;
+	/* pairs with smp_load_acquire() in get_compressor() */
+	smp_store_release(&comp->ctx, actx);
+	return 0;
+
+free_ctx:
+	free_acomp_ctx(actx);
+free_tfm:
+	crypto_free_acomp(tfm);
+	return -ENOMEM;
+}
+
+static struct f2fs_compressor *get_compressor(unsigned char algorithm)
+{
+	struct f2fs_compressor *comp;
+
+	if (algorithm >= COMPRESS_MAX)
+		return ERR_PTR(-EOPNOTSUPP);
+
+	/* set up by f2fs_init_compress_ctx() when the filesystem was mounted */
+	comp = &f2fs_compressors[algorithm];
+	if (!smp_load_acquire(&comp->ctx))
+		return ERR_PTR(-EOPNOTSUPP);
+	return comp;
+}
+
+/*
+ * Set up the transforms of all the supported algorithms when a filesystem
+ * with the compression feature is mounted, as every file keeps the algorithm
+ * it was created with. This keeps crypto_alloc_acomp(), which may load a
+ * module, out of the read and writeback paths where page locks are held.
+ * The transforms are shared by all mounts and freed on module unload.
+ */
+int f2fs_init_compress_ctx(struct f2fs_sb_info *sbi)
+{
+	int i, err = 0;
+
+	if (!f2fs_sb_has_compression(sbi->sb))
+		return 0;
+
+	mutex_lock(&f2fs_compress_mutex);
+	for (i = 0; i < COMPRESS_MAX; i++) {
+		struct f2fs_compressor *comp = &f2fs_compressors[i];
+
+		if (!comp->name || comp->ctx)
+			continue;
+
+		err = init_compressor(comp);
+		if (err) {
+			f2fs_msg(sbi->sb, KERN_ERR,
+				"Failed to set up %s compression, err:%d",
+				comp->name, err);
+			break;
+		}
+	}
+	mutex_unlock(&f2fs_compress_mutex);
+
+	return err;
+}
+
+void f2fs_destroy_compress_ctx(void)
+{
+	int i;
+
+	for (i = 0; i < COMPRESS_MAX; i++) {
+		struct f2fs_compressor *comp = &f2fs_compressors[i];
+
+		if (!comp->ctx)
+			continue;
+		free_acomp_ctx(comp->ctx);
+		crypto_free_acomp(comp->tfm);
+		comp->ctx = NULL;
+		comp->tfm = NULL;
+	}
+}
+
+static struct f2fs_acomp_ctx *get_acomp_ctx(struct f2fs_compressor *comp)
+{
+	struct f2fs_acomp_ctx *ctx = raw_cpu_ptr(comp->ctx);
+
+	mutex_lock(&ctx->mutex);
+	return ctx;
+}
+
+static void put_acomp_ctx(struct f2fs_acomp_ctx *ctx)
+{
+	mutex_unlock(&ctx->mutex);
+}
+
+static int run_acomp(struct f2fs_acomp_ctx *ctx, unsigned int slen,
+				unsigned int *dlen, bool compress)
+{
+	int err;
+
+	acomp_request_set_params(ctx->req, ctx->src, ctx->dst, slen, *dlen);
+	if (compress)
+		err = crypto_acomp_compress(ctx->req);
+	else
+		err = crypto_acomp_decompress(ctx->req);
+	err = crypto_wait_req(err, &ctx->wait);
+	*dlen = ctx->req->dlen;
+	return err;
+}
+
+bool f2fs_is_compressed_page(struct page *page)
+{
+	if (page->mapping || !PagePrivate(page))
+		return false;
+	return page_private(page) & COMPRESS_PAGE_TAG;
+}
+
+static struct compress_io_ctx *compress_io_ctx(struct page *page)
+{
+	return (struct compress_io_ctx *)
+			(page_private(page) & ~COMPRESS_PAGE_TAG);
+}
+
+bool f2fs_compressed_page_match(struct page *page, struct inode *inode,
+							struct page *target)
+{
+	struct compress_io_ctx *cic = compress_io_ctx(page);
+	int i;
+
+	if (inode && inode == cic->inode)
+		return true;
+
+	for (i = 0; target && i < cic->nr_rpages; i++)
+		if (cic->rpages[i] == target)
+			return true;
+	return false;
+}
+
+void f2fs_compress_write_end_io(struct bio *bio, struct page *page)
+{
+	struct compress_io_ctx *cic = compress_io_ctx(page);
+	int i;
+
+	if (unlikely(bio->bi_status))
+		mapping_set_error(cic->inode->i_mapping, -EIO);
+
+	set_page_private(page, (unsigned long)NULL);
+	ClearPagePrivate(page);
+	__free_page(page);
+
+	if (atomic_dec_return(&cic->pending_pages))
+		return;
+
+	for (i = 0; i < cic->nr_rpages; i++) {
+		clear_cold_data(cic->rpages[i]);
+		end_page_writeback(cic->rpages[i]);
+	}
+	kfree(cic);
+}
+
+/*
+ * Read the block addresses of the cluster starting at @start. A cluster
+ * whose node block does not exist yet is reported as a hole.
+ */
+static int get_cluster_addrs(struct inode *inode, pgoff_t start,
+							block_t *blkaddrs)
+{
+	unsigned int cluster_size = F2FS_I(inode)->i_cluster_size;
+	struct dnode_of_data dn;
+	int i, err;
+
+	set_new_dnode(&dn, inode, NULL, NULL, 0);
+	err = f2fs_get_dnode_of_data(&dn, start, LOOKUP_NODE);
+	if (err == -ENOENT) {
+		for (i = 0; i < cluster_size; i++)
+			blkaddrs[i] = NULL_ADDR;
+		return 0;
+	}
+	if (err)
+		return err;
+
+	for (i = 0; i < cluster_size; i++)
+		blkaddrs[i] = datablock_addr(dn.inode, dn.node_page,
+							dn.ofs_in_node + i);
+	f2fs_put_dnode(&dn);
+	return 0;
+}
+
+int f2fs_is_compressed_cluster(struct inode *inode, pgoff_t index)
+{
+	block_t blkaddrs[MAX_COMPRESS_CLUSTER_SIZE];
+	int err;
+
+	err = get_cluster_addrs(inode,
+			round_down(index, F2FS_I(inode)->i_cluster_size),
+			blkaddrs);
+	if (err)
+		return err;
+	return blkaddrs[0] == COMPRESS_ADDR;
+}
+
+/* Return the number of blocks backing a compressed cluster. */
+static int cluster_nr_cpages(struct inode *inode, block_t *blkaddrs)
+{
+	struct f2fs_sb_info *sbi = F2FS_I_SB(inode);
+	unsigned int cluster_size = F2FS_I(inode)->i_cluster_size;
+	unsigned int i, nr_cpages;
+
+	for (i = 1; i < cluster_size; i++) {
+		if (!__is_valid_data_blkaddr(blkaddrs[i]))
+			break;
+		if (!f2fs_is_valid_blkaddr(sbi, blkaddrs[i], DATA_GENERIC))
+			goto corrupted;
+	}
+	nr_cpages = i - 1;
+	if (!nr_cpages)
+		goto corrupted;
+
+	for (; i < cluster_size; i++)
+		if (blkaddrs[i] != NULL_ADDR)
+			goto corrupted;
+	return nr_cpages;
+
+corrupted:
+	set_sbi_flag(sbi, SBI_NEED_FSCK);
+	f2fs_msg(sbi->sb, KERN_WARNING,
+		"%s: inode (ino=%lx) has corrupted compressed cluster",
+		__func__, inode->i_ino);
+	return -EFSCORRUPTED;
+}
+
+static void put_cpages(struct f2fs_sb_info *sbi, struct page **cpages,
+				block_t *blkaddrs, unsigned int nr_cpages)
+{
+	unsigned int i;
+
+	for (i = 0; i < nr_cpages && cpages[i]; i++) {
+		/* wait for the read in flight, if any */
+		lock_page(cpages[i]);
+		f2fs_put_page(cpages[i], 1);
+		invalidate_mapping_pages(META_MAPPING(sbi),
+					blkaddrs[i], blkaddrs[i]);
+	}
+}
+
+/*
+ * Read the compressed blocks via META_MAPPING, like GC does for blocks
+ * whose contents cannot go through the page cache of the file.
+ */
+static int read_cpages(struct inode *inode, struct page *page,
+		block_t *blkaddrs, unsigned int nr_cpages, struct page **cpages)
+{
+	struct f2fs_sb_info *sbi = F2FS_I_SB(inode);
+	unsigned int i;
+	int err = 0;
+
+	for (i = 0; i < nr_cpages; i++) {
+		struct f2fs_io_info fio = {
+			.sbi = sbi,
+			.ino = inode->i_ino,
+			.type = DATA,
+			.temp = COLD,
+			.op = REQ_OP_READ,
+			.op_flags = 0,
+			.old_blkaddr = blkaddrs[i],
+			.new_blkaddr = blkaddrs[i],
+			.page = page,
+			.in_list = false,
+			.retry = false,
+		};
+
+		/* wait for GCed page writeback via META_MAPPING */
+		f2fs_wait_on_block_writeback(inode, blkaddrs[i]);
+
+		cpages[i] = f2fs_pagecache_get_page(META_MAPPING(sbi),
+				blkaddrs[i], FGP_LOCK | FGP_CREAT, GFP_NOFS);
+		if (!cpages[i])
+			return -ENOMEM;
+
+		if (PageUptodate(cpages[i])) {
+			unlock_page(cpages[i]);
+			continue;
+		}
+
+		fio.encrypted_page = cpages[i];
+		err = f2fs_submit_page_bio(&fio);
+		if (err) {
+			unlock_page(cpages[i]);
+			return err;
+		}
+	}
+
+	for (i = 0; i < nr_cpages; i++) {
+		lock_page(cpages[i]);
+		if (unlikely(!PageUptodate(cpages[i])))
+			err = -EIO;
+		unlock_page(cpages[i]);
+	}
+	return err;
+}
+
+/*
+ * Decompress the cluster at @blkaddrs into the pages of @rpages that are
+ * not uptodate yet. Entries of @rpages may be NULL; their part of the
+ * output is discarded. All pages in @rpages are locked by the caller.
+ */
+static int decompress_cluster(struct inode *inode, block_t *blkaddrs,
+							struct page **rpages)
+{
+	struct f2fs_sb_info *sbi = F2FS_I_SB(inode);
+	struct f2fs_inode_info *fi = F2FS_I(inode);
+	unsigned int cluster_size = fi->i_cluster_size;
+	struct page *cpages[MAX_COMPRESS_CLUSTER_SIZE] = { NULL, };
+	struct page *page = NULL;
+	struct f2fs_compressor *comp;
+	struct f2fs_acomp_ctx *ctx;
+	struct compress_data *cd;
+	unsigned int nr_cpages, clen, dlen, i;
+	unsigned int nofs_flag;
+	int err;
+
+	for (i = 0; i < cluster_size; i++) {
+		if (rpages[i] && !PageUptodate(rpages[i])) {
+			page = rpages[i];
+			break;
+		}
+	}
+	if (!page)
+		return 0;
+
+	comp = get_compressor(fi->i_compress_algorithm);
+	if (IS_ERR(comp))
+		return PTR_ERR(comp);
+
+	err = cluster_nr_cpages(inode, blkaddrs);
+	if (err < 0)
+		return err;
+	nr_cpages = err;
+
+	err = read_cpages(inode, page, blkaddrs + 1, nr_cpages, cpages);
+	if (err)
+		goto out;
+
+	cd = page_address(cpages[0]);
+	clen = le32_to_cpu(cd->clen);
+	if (unlikely(!clen ||
+		clen > nr_cpages * PAGE_SIZE - COMPRESS_HEADER_SIZE)) {
+		set_sbi_flag(sbi, SBI_NEED_FSCK);
+		err = -EFSCORRUPTED;
+		goto out;
+	}
+
+	nofs_flag = memalloc_nofs_save();
+	ctx = get_acomp_ctx(comp);
+
+	sg_init_table(ctx->src, nr_cpages);
+	sg_set_page(&ctx->src[0], cpages[0],
+			PAGE_SIZE - COMPRESS_HEADER_SIZE, COMPRESS_HEADER_SIZE);
+	for (i = 1; i < nr_cpages; i++)
+		sg_set_page(&ctx->src[i], cpages[i], PAGE_SIZE, 0);
+
+	sg_init_table(ctx->dst, cluster_size);
+	for (i = 0; i < cluster_size; i++) {
+		bool wanted = rpages[i] && !PageUptodate(rpages[i]);
+
+		sg_set_page(&ctx->dst[i], wanted ? rpages[i] : ctx->scratch,
+								PAGE_SIZE, 0);
+	}
+
+	dlen = cluster_size << PAGE_SHIFT;
+	err = run_acomp(ctx, clen, &dlen, false);
+
+	put_acomp_ctx(ctx);
+	memalloc_nofs_restore(nofs_flag);
+
+	if (!err && dlen != cluster_size << PAGE_SHIFT)
+		err = -EFSCORRUPTED;
+	if (err) {
+		f2fs_msg(sbi->sb, KERN_WARNING,
+			"%s: failed to decompress cluster, ino=%lx, err=%d",
+			__func__, inode->i_ino, err);
+		if (err == -EFSCORRUPTED || err == -EINVAL) {
+			set_sbi_flag(sbi, SBI_NEED_FSCK);
+			err = -EFSCORRUPTED;
+		}
+		goto out;
+	}
+
+	for (i = 0; i < cluster_size; i++) {
+		if (!rpages[i] || PageUptodate(rpages[i]))
+			continue;
+		flush_dcache_page(rpages[i]);
+		SetPageUptodate(rpages[i]);
+	}
+out:
+	put_cpages(sbi, cpages, blkaddrs + 1, nr_cpages);
+	return err;
+}
+
+/*
+ * Fill the locked @page, which belongs to a compressed cluster, with its
+ * data. Other pages of the cluster are filled along the way when they can
+ * be locked without waiting. @page is left locked.
+ */
+int f2fs_read_compressed_page(struct inode *inode, struct page *page)
+{
+	unsigned int cluster_size = F2FS_I(inode)->i_cluster_size;
+	pgoff_t start = round_down(page->index, cluster_size);
+	struct page *rpages[MAX_COMPRESS_CLUSTER_SIZE] = { NULL, };
+	block_t blkaddrs[MAX_COMPRESS_CLUSTER_SIZE];
+	int i, err;
+
+	err = get_cluster_addrs(inode, start, blkaddrs);
+	if (err)
+		return err;
+
+	for (i = 0; i < cluster_size; i++) {
+		if (start + i == page->index) {
+			rpages[i] = page;
+			continue;
+		}
+		/* avoid deadlocks, we already hold one page of the cluster */
+		rpages[i] = grab_cache_page_nowait(inode->i_mapping, start + i);
+		if (rpages[i] && PageUptodate(rpages[i])) {
+			f2fs_put_page(rpages[i], 1);
+			rpages[i] = NULL;
+		}
+	}
+
+	err = decompress_cluster(inode, blkaddrs, rpages);
+
+	for (i = 0; i < cluster_size; i++)
+		if (rpages[i] && rpages[i] != page)
+			f2fs_put_page(rpages[i], 1);
+	return err;
+}
+
+/*
+ * Compress the first @nr_rpages pages of the cluster, the remaining ones
+ * being past EOF. Return the number of pages in @cpages on success, or
+ * -EAGAIN if compression does not save any block.
+ */
+static int compress_pages(struct inode *inode, struct page **rpages,
+			unsigned int nr_rpages, struct page **cpages)
+{
+	unsigned int cluster_size = F2FS_I(inode)->i_cluster_size;
+	unsigned int rlen = cluster_size << PAGE_SHIFT;
+	struct f2fs_compressor *comp;
+	struct f2fs_acomp_ctx *ctx;
+	struct compress_data *cd;
+	unsigned int max_cpages, nr_cpages, dlen, offset, i;
+	unsigned int nofs_flag;
+	int err;
+
+	comp = get_compressor(F2FS_I(inode)->i_compress_algorithm);
+	if (IS_ERR(comp))
+		return PTR_ERR(comp);
+
+	/* the output is never truncated, so room for the worst case */
+	max_cpages = DIV_ROUND_UP(COMPRESS_HEADER_SIZE + comp->worst_size(rlen),
+								PAGE_SIZE);
+	if (WARN_ON(max_cpages > MAX_COMPRESS_PAGES))
+		return -EINVAL;
+
+	for (i = 0; i < max_cpages; i++) {
+		cpages[i] = alloc_page(GFP_NOFS);
+		if (!cpages[i]) {
+			err = -ENOMEM;
+			goto out;
+		}
+	}
+
+	nofs_flag = memalloc_nofs_save();
+	ctx = get_acomp_ctx(comp);
+
+	sg_init_table(ctx->src, cluster_size);
+	for (i = 0; i < cluster_size; i++)
+		sg_set_page(&ctx->src[i], i < nr_rpages ?
+				rpages[i] : ZERO_PAGE(0), PAGE_SIZE, 0);
+
+	sg_init_table(ctx->dst, max_cpages);
+	sg_set_page(&ctx->dst[0], cpages[0],
+			PAGE_SIZE - COMPRESS_HEADER_SIZE, COMPRESS_HEADER_SIZE);
+	for (i = 1; i < max_cpages; i++)
+		sg_set_page(&ctx->dst[i], cpages[i], PAGE_SIZE, 0);
+
+	dlen = max_cpages * PAGE_SIZE - COMPRESS_HEADER_SIZE;
+	err = run_acomp(ctx, rlen, &dlen, true);
+
+	put_acomp_ctx(ctx);
+	memalloc_nofs_restore(nofs_flag);
+
+	if (err)
+		goto out;
+
+	nr_cpages = DIV_ROUND_UP(COMPRESS_HEADER_SIZE + dlen, PAGE_SIZE);
+	if (nr_cpages >= nr_rpages) {
+		err = -EAGAIN;
+		goto out;
+	}
+
+	cd = page_address(cpages[0]);
+	cd->clen = cpu_to_le32(dlen);
+	memset(cd->reserved, 0, sizeof(cd->reserved));
+
+	/* don't leak stale memory to disk */
+	offset = (COMPRESS_HEADER_SIZE + dlen) & (PAGE_SIZE - 1);
+	if (offset)
+		memset(page_address(cpages[nr_cpages - 1]) + offset, 0,
+							PAGE_SIZE - offset);
+
+	for (i = nr_cpages; i < max_cpages; i++) {
+		__free_page(cpages[i]);
+		cpages[i] = NULL;
+	}
+	return nr_cpages;
+out:
+	for (i = 0; i < max_cpages && cpages[i]; i++) {
+		__free_page(cpages[i]);
+		cpages[i] = NULL;
+	}
+	return err;
+}
+
+/*
+ * Lay the cluster out again on disk, either as @nr_cpages compressed pages
+ * or, when @nr_cpages is zero, as its @nr_rpages raw pages. @blkaddrs is
+ * the layout the cluster had when its pages were locked; if GC or truncate
+ * changed it since, nothing is written and -EAGAIN is returned.
+ */
+static int write_cluster(struct inode *inode, pgoff_t start,
+			block_t *blkaddrs, struct page **rpages,
+			unsigned int nr_rpages, struct page **cpages,
+			unsigned int nr_cpages, bool *submitted,
+			struct writeback_control *wbc,
+			enum iostat_type io_type)
+{
+	struct f2fs_sb_info *sbi = F2FS_I_SB(inode);
+	struct f2fs_inode_info *fi = F2FS_I(inode);
+	unsigned int cluster_size = fi->i_cluster_size;
+	unsigned int first = nr_cpages ? 1 : 0;
+	unsigned int nr_blocks = nr_cpages ? nr_cpages : nr_rpages;
+	struct compress_io_ctx *cic = NULL;
+	struct dnode_of_data dn;
+	struct node_info ni;
+	unsigned int ofs, i;
+	blkcnt_t alloc = 0, count;
+	block_t release = 0;
+	int old_saved = 0, new_saved = 0;
+	loff_t psize;
+	struct f2fs_io_info fio = {
+		.sbi = sbi,
+		.ino = inode->i_ino,
+		.type = DATA,
+		.op = REQ_OP_WRITE,
+		.op_flags = wbc_to_write_flags(wbc),
+		.encrypted_page = NULL,
+		.submitted = false,
+		.need_lock = LOCK_DONE,
+		.io_type = io_type,
+		.io_wbc = wbc,
+	};
+	int err;
+
+	if (nr_cpages) {
+		cic = f2fs_kmalloc(sbi, sizeof(*cic), GFP_NOFS);
+		if (!cic)
+			return -ENOMEM;
+		cic->inode = inode;
+		atomic_set(&cic->pending_pages, nr_cpages);
+		cic->nr_rpages = nr_rpages;
+		memcpy(cic->rpages, rpages, nr_rpages * sizeof(struct page *));
+	}
+
+	/* Deadlock due to between page->lock and f2fs_lock_op */
+	if (!f2fs_trylock_op(sbi)) {
+		err = -EAGAIN;
+		goto out_free;
+	}
+
+	set_new_dnode(&dn, inode, NULL, NULL, 0);
+	err = f2fs_get_dnode_of_data(&dn, start, ALLOC_NODE);
+	if (err)
+		goto out_unlock;
+	ofs = dn.ofs_in_node;
+
+	for (i = 0; i < cluster_size; i++) {
+		block_t blkaddr = datablock_addr(dn.inode, dn.node_page, ofs + i);
+		bool written = i >= first && i < first + nr_blocks;
+		bool owned = blkaddr != NULL_ADDR && blkaddr != COMPRESS_ADDR;
+
+		if (blkaddr != blkaddrs[i]) {
+			err = -EAGAIN;
+			goto out_put_dnode;
+		}
+		if (written && !owned)
+			alloc++;
+		else if (!written && owned)
+			release++;
+		if (i && blkaddrs[0] == COMPRESS_ADDR && owned)
+			old_saved++;
+	}
+	if (blkaddrs[0] == COMPRESS_ADDR)
+		old_saved = cluster_size - old_saved;
+	if (nr_cpages)
+		new_saved = cluster_size - nr_cpages;
+
+	err = f2fs_get_node_info(sbi, dn.nid, &ni);
+	if (err)
+		goto out_put_dnode;
+
+	if (alloc) {
+		count = alloc;
+		err = inc_valid_block_count(sbi, inode, &count);
+		if (err)
+			goto out_put_dnode;
+		if (count < alloc) {
+			dec_valid_block_count(sbi, inode, count);
+			err = -ENOSPC;
+			goto out_put_dnode;
+		}
+	}
+
+	/* nothing can fail from here on */
+	for (i = 0; i < cluster_size; i++) {
+		block_t blkaddr = NULL_ADDR;
+
+		if (i >= first && i < first + nr_blocks)
+			continue;
+		if (!i && nr_cpages)
+			blkaddr = COMPRESS_ADDR;
+		if (blkaddrs[i] == blkaddr)
+			continue;
+
+		dn.ofs_in_node = ofs + i;
+		dn.data_blkaddr = blkaddr;
+		f2fs_set_data_blkaddr(&dn);
+		if (blkaddrs[i] != NULL_ADDR && blkaddrs[i] != COMPRESS_ADDR)
+			f2fs_invalidate_blocks(sbi, blkaddrs[i]);
+	}
+	if (release)
+		dec_valid_block_count(sbi, inode, release);
+
+	for (i = 0; i < nr_rpages; i++) {
+		set_page_writeback(rpages[i]);
+		ClearPageError(rpages[i]);
+	}
+
+	fio.version = ni.version;
+	for (i = 0; i < nr_blocks; i++) {
+		unsigned int slot = first + i;
+
+		dn.ofs_in_node = ofs + slot;
+		dn.data_blkaddr = blkaddrs[slot];
+		if (dn.data_blkaddr == NULL_ADDR ||
+				dn.data_blkaddr == COMPRESS_ADDR) {
+			dn.data_blkaddr = NEW_ADDR;
+			f2fs_set_data_blkaddr(&dn);
+		}
+		fio.old_blkaddr = dn.data_blkaddr;
+
+		if (nr_cpages) {
+			fio.page = rpages[0];
+			fio.encrypted_page = cpages[i];
+			set_page_private(cpages[i],
+				(unsigned long)cic | COMPRESS_PAGE_TAG);
+			SetPagePrivate(cpages[i]);
+		} else {
+			fio.page = rpages[i];
+		}
+		f2fs_outplace_write_data(&dn, &fio);
+	}
+
+	f2fs_i_compr_blocks_update(inode, new_saved - old_saved);
+	f2fs_put_dnode(&dn);
+	f2fs_unlock_op(sbi);
+
+	set_inode_flag(inode, FI_APPEND_WRITE);
+	if (start == 0)
+		set_inode_flag(inode, FI_FIRST_BLOCK_WRITTEN);
+
+	psize = (loff_t)(start + nr_rpages) << PAGE_SHIFT;
+	down_write(&fi->i_sem);
+	if (fi->last_disk_size < psize)
+		fi->last_disk_size = psize;
+	up_write(&fi->i_sem);
+
+	if (submitted)
+		*submitted = fio.submitted;
+	return 0;
+
+out_put_dnode:
+	f2fs_put_dnode(&dn);
+out_unlock:
+	f2fs_unlock_op(sbi);
+out_free:
+	kfree(cic);
+	return err;
+}
+
+/*
+ * Write the pages of a cluster which stays uncompressed. Pages set in
+ * @dirty have already been cleared for I/O by the caller.
+ */
+static int write_raw_pages(struct page **rpages, unsigned int nr_rpages,
+			unsigned long dirty, bool *submitted,
+			struct writeback_control *wbc, enum iostat_type io_type)
+{
+	unsigned int i;
+	int err = 0;
+
+	for (i = 0; i < nr_rpages; i++) {
+		struct page *page = rpages[i];
+		bool page_submitted = false;
+		int ret;
+
+		if (!page || !test_bit(i, &dirty))
+			continue;
+		rpages[i] = NULL;
+
+		ret = f2fs_write_single_data_page(page, &page_submitted,
+							wbc, io_type);
+		if (ret == AOP_WRITEPAGE_ACTIVATE)
+			unlock_page(page);
+		else if (ret && !err)
+			err = ret;
+		put_page(page);
+
+		if (page_submitted && submitted)
+			*submitted = true;
+	}
+	return err;
+}
+
+/*
+ * Called from ->writepages with the dirty @page locked. The cluster it
+ * belongs to is written out as a whole, compressed when that saves blocks
+ * and the cluster is either fully cached or was compressed before.
+ *
+ * Return AOP_WRITEPAGE_ACTIVATE with @page still locked when the cluster
+ * should be retried later; otherwise @page is unlocked on return.
+ */
+int f2fs_write_compressed_cluster(struct page *page, bool *submitted,
+				struct writeback_control *wbc,
+				enum iostat_type io_type)
+{
+	struct address_space *mapping = page->mapping;
+	struct inode *inode = mapping->host;
+	struct f2fs_sb_info *sbi = F2FS_I_SB(inode);
+	unsigned int cluster_size = F2FS_I(inode)->i_cluster_size;
+	pgoff_t start = round_down(page->index, cluster_size);
+	loff_t i_size = i_size_read(inode);
+	pgoff_t nr_pages = DIV_ROUND_UP(i_size, PAGE_SIZE);
+	struct page *rpages[MAX_COMPRESS_CLUSTER_SIZE] = { NULL, };
+	struct page *cpages[MAX_COMPRESS_PAGES] = { NULL, };
+	block_t blkaddrs[MAX_COMPRESS_CLUSTER_SIZE];
+	unsigned long dirty = 0;
+	unsigned int nr_rpages, offset, i;
+	bool compressed, cached = true;
+	int nr_cpages;
+	int err;
+
+	/* pages past EOF and cp errors are dealt with by the regular path */
+	if (page->index >= nr_pages || unlikely(f2fs_cp_error(sbi))) {
+		if (!clear_page_dirty_for_io(page)) {
+			unlock_page(page);
+			return 0;
+		}
+		return f2fs_write_single_data_page(page, submitted,
+							wbc, io_type);
+	}
+
+	if (unlikely(is_sbi_flag_set(sbi, SBI_POR_DOING)) ||
+			(wbc->for_reclaim &&
+			has_not_enough_free_secs(sbi, 0, 0)))
+		return AOP_WRITEPAGE_ACTIVATE;
+
+	/* lock the pages of the cluster in order */
+	unlock_page(page);
+
+	nr_rpages = min_t(pgoff_t, cluster_size, nr_pages - start);
+	for (i = 0; i < nr_rpages; i++) {
+		rpages[i] = find_lock_page(mapping, start + i);
+		if (!rpages[i])
+			continue;
+		f2fs_wait_on_page_writeback(rpages[i], DATA, true);
+		if (PageDirty(rpages[i]))
+			__set_bit(i, &dirty);
+	}
+
+	/* someone else wrote the cluster while it was unlocked */
+	err = 0;
+	if (!dirty)
+		goto out_put;
+
+	err = get_cluster_addrs(inode, start, blkaddrs);
+	if (err)
+		goto out_put;
+	compressed = blkaddrs[0] == COMPRESS_ADDR;
+
+	for (i = 0; i < nr_rpages; i++) {
+		if (rpages[i] && PageUptodate(rpages[i]))
+			continue;
+		if (!compressed) {
+			cached = false;
+			break;
+		}
+		/* a compressed cluster is rewritten as a whole */
+		if (!rpages[i]) {
+			rpages[i] = f2fs_grab_cache_page(mapping, start + i,
+									true);
+			if (!rpages[i]) {
+				err = -ENOMEM;
+				goto out_put;
+			}
+		}
+	}
+
+	if (compressed) {
+		err = decompress_cluster(inode, blkaddrs, rpages);
+		if (err)
+			goto out_put;
+	}
+
+	for (i = 0; i < nr_rpages; i++)
+		if (test_bit(i, &dirty) && !clear_page_dirty_for_io(rpages[i]))
+			__clear_bit(i, &dirty);
+
+	if (!cached) {
+		err = write_raw_pages(rpages, nr_rpages, dirty, submitted,
+							wbc, io_type);
+		goto out_put;
+	}
+
+	/* zero the tail of the last page, as the regular path does */
+	offset = i_size & (PAGE_SIZE - 1);
+	if (offset && start + nr_rpages == nr_pages)
+		zero_user_segment(rpages[nr_rpages - 1], offset, PAGE_SIZE);
+
+	nr_cpages = compress_pages(inode, rpages, nr_rpages, cpages);
+	if (nr_cpages < 0) {
+		/* a plain cluster is simply left plain */
+		if (!compressed) {
+			err = write_raw_pages(rpages, nr_rpages, dirty,
+						submitted, wbc, io_type);
+			goto out_put;
+		}
+		nr_cpages = 0;
+	}
+
+	err = write_cluster(inode, start, blkaddrs, rpages, nr_rpages,
+				cpages, nr_cpages, submitted, wbc, io_type);
+	if (err) {
+		for (i = 0; i < nr_cpages; i++)
+			__free_page(cpages[i]);
+		for (i = 0; i < nr_rpages; i++)
+			if (test_bit(i, &dirty))
+				redirty_page_for_writepage(wbc, rpages[i]);
+		goto out_put;
+	}
+
+	for (i = 0; i < nr_rpages; i++)
+		if (test_bit(i, &dirty))
+			inode_dec_dirty_pages(inode);
+out_put:
+	for (i = 0; i < nr_rpages; i++)
+		if (rpages[i])
+			f2fs_put_page(rpages[i], 1);
+
+	if (!wbc->for_reclaim && !IS_NOQUOTA(inode))
+		f2fs_balance_fs(sbi, true);
+	return err;
+}
+
+int f2fs_truncate_partial_cluster(struct inode *inode, u64 from)
+{
+	unsigned int cluster_size = F2FS_I(inode)->i_cluster_size;
+	struct page *page;
+	loff_t start;
+	int err;
+
+	if (!(from & ((cluster_size << PAGE_SHIFT) - 1)))
+		return 0;
+
+	err = f2fs_is_compressed_cluster(inode, from >> PAGE_SHIFT);
+	if (err <= 0)
+		return err;
+
+	/*
+	 * Part of the cluster survives, so keep its blocks and rewrite it for
+	 * the new size right away; a later extension must read zeroes past
+	 * the current EOF, not what the old compressed data held there.
+	 */
+	page = f2fs_get_lock_data_page(inode, (from - 1) >> PAGE_SHIFT, true);
+	if (IS_ERR(page))
+		return PTR_ERR(page);
+
+	f2fs_wait_on_page_writeback(page, DATA, true);
+	set_page_dirty(page);
+	f2fs_put_page(page, 1);
+
+	start = round_down(from, (u64)cluster_size << PAGE_SHIFT);
+	err = filemap_write_and_wait_range(inode->i_mapping, start,
+				start + (cluster_size << PAGE_SHIFT) - 1);
+	return err ? err : 1;
+}
@@ -256,6 +256,12 @@ static void f2fs_write_end_io(struct bio *bio)
 			continue;
 		}
 
+		if (f2fs_is_compressed_page(page)) {
+			f2fs_compress_write_end_io(bio, page);
+			dec_page_count(sbi, type);
+			continue;
+		}
+
 		fscrypt_pullback_bio_page(&page, true);
 
 		if (unlikely(bio->bi_status)) {
@@ -437,6 +443,13 @@ static bool __has_merged_page(struct f2fs_bio_info *io, struct inode *inode,
 
 	bio_for_each_segment_all(bvec, io->bio, i) {
 
+		if (f2fs_is_compressed_page(bvec->bv_page)) {
+			if (f2fs_compressed_page_match(bvec->bv_page,
+							inode, page))
+				return true;
+			continue;
+		}
+
 		if (bvec->bv_page->mapping)
 			target = bvec->bv_page;
 		else
@@ -846,6 +859,21 @@ struct page *f2fs_get_read_data_page(struct inode *inode, pgoff_t index,
 	if (!page)
 		return ERR_PTR(-ENOMEM);
 
+	if (f2fs_compressed_file(inode)) {
+		err = f2fs_is_compressed_cluster(inode, index);
+		if (err < 0)
+			goto put_err;
+		if (err) {
+			if (!PageUptodate(page)) {
+				err = f2fs_read_compressed_page(inode, page);
+				if (err)
+					goto put_err;
+			}
+			unlock_page(page);
+			return page;
+		}
+	}
+
 	if (f2fs_lookup_extent_cache(inode, index, &ei)) {
 		dn.data_blkaddr = ei.blk + index - ei.fofs;
 		goto got_it;
@@ -1620,6 +1648,7 @@ static int f2fs_mpage_readpages(struct address_space *mapping,
 	sector_t last_block_in_file;
 	sector_t block_nr;
 	struct f2fs_map_blocks map;
+	pgoff_t raw_cluster = ULONG_MAX;
 	bool enc;
 	u64 dun;
 
@@ -1650,6 +1679,33 @@ static int f2fs_mpage_readpages(struct address_space *mapping,
 		if (last_block > last_block_in_file)
 			last_block = last_block_in_file;
 
+		if (f2fs_compressed_file(inode)) {
+			unsigned int log_size = F2FS_I(inode)->i_log_cluster_size;
+			pgoff_t cluster = block_in_file >> log_size;
+			int ret;
+
+			/* never map across a cluster which may be compressed */
+			if (last_block > (cluster + 1) << log_size)
+				last_block = (cluster + 1) << log_size;
+
+			ret = cluster == raw_cluster ? 0 :
+				f2fs_is_compressed_cluster(inode, page->index);
+			if (ret < 0)
+				goto set_error_page;
+			if (ret) {
+				/* the cluster is read synchronously */
+				if (bio) {
+					__submit_bio(F2FS_I_SB(inode), bio, DATA);
+					bio = NULL;
+				}
+				if (f2fs_read_compressed_page(inode, page))
+					goto set_error_page;
+				unlock_page(page);
+				goto next_page;
+			}
+			raw_cluster = cluster;
+		}
+
 		/*
 		 * Map blocks using the previous result first.
 		 */
@@ -2027,7 +2083,7 @@ int f2fs_do_write_data_page(struct f2fs_io_info *fio)
 	return err;
 }
 
-static int __write_data_page(struct page *page, bool *submitted,
+int f2fs_write_single_data_page(struct page *page, bool *submitted,
 				struct writeback_control *wbc,
 				enum iostat_type io_type)
 {
@@ -2180,7 +2236,19 @@ static int __write_data_page(struct page *page, bool *submitted,
 static int f2fs_write_data_page(struct page *page,
 					struct writeback_control *wbc)
 {
-	return __write_data_page(page, NULL, wbc, FS_DATA_IO);
+	struct inode *inode = page->mapping->host;
+
+	/*
+	 * A compressed cluster is only written as a whole, by ->writepages.
+	 * Pages of a cluster laid out raw are written like any other page.
+	 */
+	if (f2fs_compressed_file(inode) &&
+			f2fs_is_compressed_cluster(inode, page->index)) {
+		redirty_page_for_writepage(wbc, page);
+		return AOP_WRITEPAGE_ACTIVATE;
+	}
+
+	return f2fs_write_single_data_page(page, NULL, wbc, FS_DATA_IO);
 }
 
 /*
@@ -2280,10 +2348,16 @@ static int f2fs_write_cache_pages(struct address_space *mapping,
 			}
 
 			BUG_ON(PageWriteback(page));
-			if (!clear_page_dirty_for_io(page))
-				goto continue_unlock;
+			if (f2fs_compressed_file(mapping->host)) {
+				ret = f2fs_write_compressed_cluster(page,
+						&submitted, wbc, io_type);
+			} else {
+				if (!clear_page_dirty_for_io(page))
+					goto continue_unlock;
 
-			ret = __write_data_page(page, &submitted, wbc, io_type);
+				ret = f2fs_write_single_data_page(page,
+						&submitted, wbc, io_type);
+			}
 			if (unlikely(ret)) {
 				/*
 				 * keep nr_to_write, since vfs uses this to
@@ -2588,6 +2662,23 @@ static int f2fs_write_begin(struct file *file, struct address_space *mapping,
 
 	*pagep = page;
 
+	if (f2fs_compressed_file(inode)) {
+		err = f2fs_is_compressed_cluster(inode, index);
+		if (err < 0)
+			goto fail;
+		/* blocks of a compressed cluster are allocated at writeback */
+		if (err) {
+			err = 0;
+			f2fs_wait_on_page_writeback(page, DATA, false);
+			if (len != PAGE_SIZE && !PageUptodate(page)) {
+				err = f2fs_read_compressed_page(inode, page);
+				if (err)
+					goto fail;
+			}
+			return 0;
+		}
+	}
+
 	err = prepare_write_begin(sbi, page, pos, len,
 					&blkaddr, &need_balance);
 	if (err)
@@ -2881,6 +2972,10 @@ static sector_t f2fs_bmap(struct address_space *mapping, sector_t block)
 	if (f2fs_has_inline_data(inode))
 		return 0;
 
+	/* blocks of a compressed cluster don't map to its pages */
+	if (f2fs_compressed_file(inode))
+		return 0;
+
 	/* make sure allocating whole blocks */
 	if (mapping_tagged(mapping, PAGECACHE_TAG_DIRTY))
 		filemap_write_and_wait(mapping);
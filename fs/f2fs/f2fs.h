@@ -140,6 +140,8 @@ typedef u32 block_t;	/*
 			 */
 typedef u32 nid_t;
 
+#define COMPRESS_EXT_NUM		16
+
 struct f2fs_mount_info {
 	unsigned int opt;
 	int write_io_size_bits;		/* Write IO size bits */
@@ -163,6 +165,13 @@ struct f2fs_mount_info {
 	int alloc_mode;			/* segment allocation policy */
 	int fsync_mode;			/* fsync policy */
 	bool test_dummy_encryption;	/* test dummy encryption */
+
+	/* For compression */
+	unsigned char compress_algorithm;	/* algorithm type */
+	unsigned char compress_log_size;	/* cluster log size */
+	unsigned char compress_ext_cnt;		/* extension count */
+	unsigned char extensions[COMPRESS_EXT_NUM][F2FS_EXTENSION_LEN];
+						/* extensions */
 };
 
 #define F2FS_FEATURE_ENCRYPT		0x0001
@@ -177,6 +186,7 @@ struct f2fs_mount_info {
 #define F2FS_FEATURE_LOST_FOUND		0x0200
 #define F2FS_FEATURE_VERITY		0x0400	/* reserved */
 #define F2FS_FEATURE_SB_CHKSUM		0x0800
+#define F2FS_FEATURE_COMPRESSION	0x2000
 
 #define F2FS_HAS_FEATURE(sb, mask)					\
 	((F2FS_SB(sb)->raw_super->feature & cpu_to_le32(mask)) != 0)
@@ -432,6 +442,7 @@ static inline bool __has_cursum_space(struct f2fs_journal *journal,
 #define F2FS_IOC_SET_PIN_FILE		_IOW(F2FS_IOCTL_MAGIC, 13, __u32)
 #define F2FS_IOC_GET_PIN_FILE		_IOR(F2FS_IOCTL_MAGIC, 14, __u32)
 #define F2FS_IOC_PRECACHE_EXTENTS	_IO(F2FS_IOCTL_MAGIC, 15)
+#define F2FS_IOC_GET_COMPRESS_BLOCKS	_IOR(F2FS_IOCTL_MAGIC, 17, __u64)
 #define F2FS_IOC_GET_VALID_NODE_COUNT	_IOR(F2FS_IOCTL_MAGIC, 32, __u32)
 
 #define F2FS_IOC_SET_ENCRYPTION_POLICY	FS_IOC_SET_ENCRYPTION_POLICY
@@ -729,6 +740,12 @@ struct f2fs_inode_info {
 	int i_inline_xattr_size;	/* inline xattr size */
 	struct timespec i_crtime;	/* inode creation time */
 	struct timespec i_disk_time[4];	/* inode disk times */
+
+	/* for file compress */
+	atomic_t i_compr_blocks;		/* # of compressed blocks */
+	unsigned char i_compress_algorithm;	/* algorithm type */
+	unsigned char i_log_cluster_size;	/* log of cluster size */
+	unsigned int i_cluster_size;		/* cluster size */
 };
 
 static inline void get_extent_info(struct extent_info *ext,
@@ -2585,6 +2602,7 @@ enum {
 	FI_PROJ_INHERIT,	/* indicate file inherits projectid */
 	FI_PIN_FILE,		/* indicate file should not be gced */
 	FI_ATOMIC_REVOKE_REQUEST, /* request to drop atomic data */
+	FI_COMPRESSED_FILE,	/* indicate file's data can be compressed */
 };
 
 static inline void __mark_inode_dirty_flag(struct inode *inode,
@@ -2749,9 +2767,31 @@ static inline int f2fs_has_inline_xattr(struct inode *inode)
 	return is_inode_flag_set(inode, FI_INLINE_XATTR);
 }
 
+static inline bool f2fs_compressed_file(struct inode *inode)
+{
+	return S_ISREG(inode->i_mode) &&
+		is_inode_flag_set(inode, FI_COMPRESSED_FILE);
+}
+
+/*
+ * Clusters of a compressed file must not straddle two node blocks, so the
+ * number of usable slots in each node is rounded down to the cluster size.
+ */
 static inline unsigned int addrs_per_inode(struct inode *inode)
 {
-	return CUR_ADDRS_PER_INODE(inode) - get_inline_xattr_addrs(inode);
+	unsigned int addrs = CUR_ADDRS_PER_INODE(inode) -
+					get_inline_xattr_addrs(inode);
+
+	if (!f2fs_compressed_file(inode))
+		return addrs;
+	return ALIGN_DOWN(addrs, F2FS_I(inode)->i_cluster_size);
+}
+
+static inline unsigned int addrs_per_block(struct inode *inode)
+{
+	if (!f2fs_compressed_file(inode))
+		return DEF_ADDRS_PER_BLOCK;
+	return ALIGN_DOWN(DEF_ADDRS_PER_BLOCK, F2FS_I(inode)->i_cluster_size);
 }
 
 static inline void *inline_xattr_addr(struct inode *inode, struct page *page)
@@ -3007,7 +3047,8 @@ static inline void verify_blkaddr(struct f2fs_sb_info *sbi,
 
 static inline bool __is_valid_data_blkaddr(block_t blkaddr)
 {
-	if (blkaddr == NEW_ADDR || blkaddr == NULL_ADDR)
+	if (blkaddr == NEW_ADDR || blkaddr == NULL_ADDR ||
+					blkaddr == COMPRESS_ADDR)
 		return false;
 	return true;
 }
@@ -3324,6 +3365,9 @@ struct page *f2fs_get_lock_data_page(struct inode *inode, pgoff_t index,
 struct page *f2fs_get_new_data_page(struct inode *inode,
 			struct page *ipage, pgoff_t index, bool new_i_size);
 int f2fs_do_write_data_page(struct f2fs_io_info *fio);
+int f2fs_write_single_data_page(struct page *page, bool *submitted,
+			struct writeback_control *wbc,
+			enum iostat_type io_type);
 void __do_map_lock(struct f2fs_sb_info *sbi, int flag, bool lock);
 int f2fs_map_blocks(struct inode *inode, struct f2fs_map_blocks *map,
 			int create, int flag);
@@ -3687,7 +3731,7 @@ static inline void f2fs_set_encrypted_inode(struct inode *inode)
  */
 static inline bool f2fs_post_read_required(struct inode *inode)
 {
-	return f2fs_encrypted_file(inode);
+	return f2fs_encrypted_file(inode) || f2fs_compressed_file(inode);
 }
 
 #define F2FS_FEATURE_FUNCS(name, flagname) \
@@ -3706,6 +3750,7 @@ F2FS_FEATURE_FUNCS(quota_ino, QUOTA_INO);
 F2FS_FEATURE_FUNCS(inode_crtime, INODE_CRTIME);
 F2FS_FEATURE_FUNCS(lost_found, LOST_FOUND);
 F2FS_FEATURE_FUNCS(sb_chksum, SB_CHKSUM);
+F2FS_FEATURE_FUNCS(compression, COMPRESSION);
 
 #ifdef CONFIG_BLK_DEV_ZONED
 static inline int get_blkz_type(struct f2fs_sb_info *sbi,
@@ -3793,6 +3838,8 @@ static inline bool f2fs_force_buffered_io(struct inode *inode,
 	if (f2fs_post_read_required(inode) &&
 			!fscrypt_inline_encrypted(inode))
 		return true;
+	if (f2fs_compressed_file(inode))
+		return true;
 	if (sbi->s_ndevs)
 		return true;
 	/*
@@ -3810,6 +3857,125 @@ static inline bool f2fs_force_buffered_io(struct inode *inode,
 	return false;
 }
 
+/*
+ * compress.c
+ */
+#define MIN_COMPRESS_LOG_SIZE		2
+#define MAX_COMPRESS_LOG_SIZE		4
+#define MAX_COMPRESS_CLUSTER_SIZE	(1 << MAX_COMPRESS_LOG_SIZE)
+
+enum compress_algorithm_type {
+	COMPRESS_LZO,
+	COMPRESS_LZ4,
+	COMPRESS_MAX,
+};
+
+/*
+ * Header stored at the start of the first block of a compressed cluster,
+ * followed by the compressed payload spanning the remaining blocks.
+ */
+struct compress_data {
+	__le32 clen;			/* compressed data size */
+	__le32 reserved[5];		/* reserved */
+	u8 cdata[];			/* compressed data */
+};
+
+#define COMPRESS_HEADER_SIZE	(sizeof(struct compress_data))
+
+static inline bool f2fs_may_compress(struct inode *inode)
+{
+	if (!f2fs_sb_has_compression(inode->i_sb))
+		return false;
+	if (!S_ISREG(inode->i_mode) || IS_SWAPFILE(inode))
+		return false;
+	if (f2fs_encrypted_inode(inode) || f2fs_is_pinned_file(inode) ||
+			f2fs_is_atomic_file(inode) ||
+			f2fs_is_volatile_file(inode))
+		return false;
+	return f2fs_has_extra_attr(inode) &&
+		F2FS_FITS_IN_INODE((struct f2fs_inode *)NULL,
+				F2FS_I(inode)->i_extra_isize,
+				i_log_cluster_size);
+}
+
+/*
+ * Caller should make sure the inode has no data block yet, since the
+ * layout of the node blocks depends on the cluster size.
+ */
+static inline void set_compress_context(struct inode *inode)
+{
+	struct f2fs_sb_info *sbi = F2FS_I_SB(inode);
+	struct f2fs_inode_info *fi = F2FS_I(inode);
+
+	fi->i_compress_algorithm = F2FS_OPTION(sbi).compress_algorithm;
+	fi->i_log_cluster_size = F2FS_OPTION(sbi).compress_log_size;
+	fi->i_cluster_size = 1 << fi->i_log_cluster_size;
+	atomic_set(&fi->i_compr_blocks, 0);
+	fi->i_flags |= F2FS_COMPR_FL;
+	set_inode_flag(inode, FI_NO_EXTENT);
+	set_inode_flag(inode, FI_COMPRESSED_FILE);
+}
+
+static inline void f2fs_i_compr_blocks_update(struct inode *inode, int diff)
+{
+	if (!diff)
+		return;
+	atomic_add(diff, &F2FS_I(inode)->i_compr_blocks);
+	f2fs_mark_inode_dirty_sync(inode, true);
+}
+
+#ifdef CONFIG_F2FS_FS_COMPRESSION
+bool f2fs_is_compressed_page(struct page *page);
+bool f2fs_compressed_page_match(struct page *page, struct inode *inode,
+							struct page *target);
+void f2fs_compress_write_end_io(struct bio *bio, struct page *page);
+int f2fs_is_compressed_cluster(struct inode *inode, pgoff_t index);
+int f2fs_read_compressed_page(struct inode *inode, struct page *page);
+int f2fs_write_compressed_cluster(struct page *page, bool *submitted,
+				struct writeback_control *wbc,
+				enum iostat_type io_type);
+int f2fs_truncate_partial_cluster(struct inode *inode, u64 from);
+int f2fs_init_compress_ctx(struct f2fs_sb_info *sbi);
+void f2fs_destroy_compress_ctx(void);
+#else
+static inline bool f2fs_is_compressed_page(struct page *page)
+{
+	return false;
+}
+static inline bool f2fs_compressed_page_match(struct page *page,
+				struct inode *inode, struct page *target)
+{
+	return false;
+}
+static inline void f2fs_compress_write_end_io(struct bio *bio,
+						struct page *page) { }
+static inline int f2fs_is_compressed_cluster(struct inode *inode,
+							pgoff_t index)
+{
+	return 0;
+}
+static inline int f2fs_read_compressed_page(struct inode *inode,
+							struct page *page)
+{
+	return -EOPNOTSUPP;
+}
+static inline int f2fs_write_compressed_cluster(struct page *page,
+				bool *submitted, struct writeback_control *wbc,
+				enum iostat_type io_type)
+{
+	return -EOPNOTSUPP;
+}
+static inline int f2fs_truncate_partial_cluster(struct inode *inode, u64 from)
+{
+	return 0;
+}
+static inline int f2fs_init_compress_ctx(struct f2fs_sb_info *sbi)
+{
+	return 0;
+}
+static inline void f2fs_destroy_compress_ctx(void) { }
+#endif
+
 #ifdef CONFIG_F2FS_FAULT_INJECTION
 extern void f2fs_build_fault_attr(struct f2fs_sb_info *sbi, unsigned int rate,
 							unsigned int type);
@@ -74,12 +74,18 @@ static int f2fs_vm_page_mkwrite(struct vm_fault *vmf)
 		goto out_sem;
 	}
 
-	/* block allocation */
-	__do_map_lock(sbi, F2FS_GET_BLOCK_PRE_AIO, true);
-	set_new_dnode(&dn, inode, NULL, NULL, 0);
-	err = f2fs_get_block(&dn, page->index);
-	f2fs_put_dnode(&dn);
-	__do_map_lock(sbi, F2FS_GET_BLOCK_PRE_AIO, false);
+	/* block allocation, deferred to writeback in a compressed cluster */
+	err = f2fs_compressed_file(inode) ?
+		f2fs_is_compressed_cluster(inode, page->index) : 0;
+	if (err > 0) {
+		err = 0;
+	} else if (!err) {
+		__do_map_lock(sbi, F2FS_GET_BLOCK_PRE_AIO, true);
+		set_new_dnode(&dn, inode, NULL, NULL, 0);
+		err = f2fs_get_block(&dn, page->index);
+		f2fs_put_dnode(&dn);
+		__do_map_lock(sbi, F2FS_GET_BLOCK_PRE_AIO, false);
+	}
 	if (err) {
 		unlock_page(page);
 		goto out_sem;
@@ -487,6 +493,10 @@ static loff_t f2fs_llseek(struct file *file, loff_t offset, int whence)
 	case SEEK_HOLE:
 		if (offset < 0)
 			return -ENXIO;
+		/* a compressed cluster has no holes even where it has no blocks */
+		if (f2fs_compressed_file(inode))
+			return generic_file_llseek_size(file, offset, whence,
+						maxbytes, i_size_read(inode));
 		return f2fs_seek_block(file, offset, whence);
 	}
 
@@ -530,6 +540,9 @@ void f2fs_truncate_data_blocks_range(struct dnode_of_data *dn, int count)
 	int nr_free = 0, ofs = dn->ofs_in_node, len = count;
 	__le32 *addr;
 	int base = 0;
+	bool compressed_cluster = false;
+	int cluster_size = F2FS_I(dn->inode)->i_cluster_size;
+	int saved_blocks = 0;
 
 	if (IS_INODE(dn->node_page) && f2fs_has_extra_attr(dn->inode))
 		base = get_extra_isize(dn->inode);
@@ -540,12 +553,25 @@ void f2fs_truncate_data_blocks_range(struct dnode_of_data *dn, int count)
 	for (; count > 0; count--, addr++, dn->ofs_in_node++) {
 		block_t blkaddr = le32_to_cpu(*addr);
 
+		if (f2fs_compressed_file(dn->inode) &&
+				!(dn->ofs_in_node & (cluster_size - 1))) {
+			compressed_cluster = blkaddr == COMPRESS_ADDR;
+			if (compressed_cluster)
+				saved_blocks += cluster_size;
+		}
+
 		if (blkaddr == NULL_ADDR)
 			continue;
 
 		dn->data_blkaddr = NULL_ADDR;
 		f2fs_set_data_blkaddr(dn);
 
+		/* the head of a compressed cluster owns no block */
+		if (blkaddr == COMPRESS_ADDR)
+			continue;
+		if (compressed_cluster)
+			saved_blocks--;
+
 		if (__is_valid_data_blkaddr(blkaddr) &&
 			!f2fs_is_valid_blkaddr(sbi, blkaddr, DATA_GENERIC))
 			continue;
@@ -569,6 +595,9 @@ void f2fs_truncate_data_blocks_range(struct dnode_of_data *dn, int count)
 	}
 	dn->ofs_in_node = ofs;
 
+	if (saved_blocks)
+		f2fs_i_compr_blocks_update(dn->inode, -saved_blocks);
+
 	f2fs_update_time(sbi, REQ_TIME);
 	trace_f2fs_truncate_data_blocks_range(dn->inode, dn->nid,
 					 dn->ofs_in_node, nr_free);
@@ -576,7 +605,7 @@ void f2fs_truncate_data_blocks_range(struct dnode_of_data *dn, int count)
 
 void f2fs_truncate_data_blocks(struct dnode_of_data *dn)
 {
-	f2fs_truncate_data_blocks_range(dn, ADDRS_PER_BLOCK);
+	f2fs_truncate_data_blocks_range(dn, ADDRS_PER_BLOCK(dn->inode));
 }
 
 static int truncate_partial_data_page(struct inode *inode, u64 from,
@@ -628,6 +657,17 @@ int f2fs_truncate_blocks(struct inode *inode, u64 from, bool lock,
 
 	free_from = (pgoff_t)F2FS_BLK_ALIGN(from);
 
+	if (f2fs_compressed_file(inode)) {
+		/* a compressed cluster is freed as a whole or not at all */
+		err = f2fs_truncate_partial_cluster(inode, from);
+		if (err < 0)
+			goto out_trace;
+		if (err)
+			free_from = round_up(free_from,
+					F2FS_I(inode)->i_cluster_size);
+		err = 0;
+	}
+
 	if (free_from >= sbi->max_file_blocks)
 		goto free_partial;
 
@@ -675,7 +715,7 @@ int f2fs_truncate_blocks(struct inode *inode, u64 from, bool lock,
 	/* lastly zero out the first data page */
 	if (!err)
 		err = truncate_partial_data_page(inode, from, truncate_page);
-
+out_trace:
 	trace_f2fs_truncate_blocks_exit(inode, err);
 	return err;
 }
@@ -1036,7 +1076,7 @@ static int __read_out_blkaddrs(struct inode *inode, block_t *blkaddr,
 	} else if (ret == -ENOENT) {
 		if (dn.max_level == 0)
 			return -ENOENT;
-		done = min((pgoff_t)ADDRS_PER_BLOCK - dn.ofs_in_node, len);
+		done = min((pgoff_t)ADDRS_PER_BLOCK(inode) - dn.ofs_in_node, len);
 		blkaddr += done;
 		do_replace += done;
 		goto next;
@@ -1187,7 +1227,7 @@ static int __exchange_data_block(struct inode *src_inode,
 	int ret;
 
 	while (len) {
-		olen = min((pgoff_t)4 * ADDRS_PER_BLOCK, len);
+		olen = min((pgoff_t)4 * ADDRS_PER_BLOCK(src_inode), len);
 
 		src_blkaddr = f2fs_kvzalloc(F2FS_I_SB(src_inode),
 					array_size(olen, sizeof(block_t)),
@@ -1591,6 +1631,9 @@ static long f2fs_fallocate(struct file *file, int mode,
 		(mode & (FALLOC_FL_COLLAPSE_RANGE | FALLOC_FL_INSERT_RANGE)))
 		return -EOPNOTSUPP;
 
+	if (f2fs_compressed_file(inode))
+		return -EOPNOTSUPP;
+
 	if (mode & ~(FALLOC_FL_KEEP_SIZE | FALLOC_FL_PUNCH_HOLE |
 			FALLOC_FL_COLLAPSE_RANGE | FALLOC_FL_ZERO_RANGE |
 			FALLOC_FL_INSERT_RANGE))
@@ -1683,6 +1726,36 @@ static int f2fs_ioc_getflags(struct file *filp, unsigned long arg)
 	return put_user(flags, (int __user *)arg);
 }
 
+static int f2fs_set_compress_flag(struct inode *inode, bool set)
+{
+	int err;
+
+	/* directories only pass the flag on to new files */
+	if (!S_ISREG(inode->i_mode))
+		return 0;
+
+	/* the layout of the node blocks depends on the cluster size */
+	if (i_size_read(inode) || F2FS_HAS_BLOCKS(inode))
+		return -EINVAL;
+
+	if (!set) {
+		clear_inode_flag(inode, FI_COMPRESSED_FILE);
+		atomic_set(&F2FS_I(inode)->i_compr_blocks, 0);
+		return 0;
+	}
+
+	if (!f2fs_may_compress(inode))
+		return -EINVAL;
+
+	err = f2fs_convert_inline_inode(inode);
+	if (err)
+		return err;
+
+	f2fs_drop_extent_tree(inode);
+	set_compress_context(inode);
+	return 0;
+}
+
 static int __f2fs_ioc_setflags(struct inode *inode, unsigned int flags)
 {
 	struct f2fs_inode_info *fi = F2FS_I(inode);
@@ -1700,6 +1773,15 @@ static int __f2fs_ioc_setflags(struct inode *inode, unsigned int flags)
 		if (!capable(CAP_LINUX_IMMUTABLE))
 			return -EPERM;
 
+	if (f2fs_sb_has_compression(inode->i_sb) &&
+			((flags ^ oldflags) & F2FS_COMPR_FL)) {
+		int err = f2fs_set_compress_flag(inode,
+						flags & F2FS_COMPR_FL);
+
+		if (err)
+			return err;
+	}
+
 	flags = flags & F2FS_FL_USER_MODIFIABLE;
 	flags |= oldflags & ~F2FS_FL_USER_MODIFIABLE;
 	fi->i_flags = flags;
@@ -1764,6 +1846,11 @@ static int f2fs_ioc_start_atomic_write(struct file *filp)
 
 	inode_lock(inode);
 
+	if (f2fs_compressed_file(inode)) {
+		ret = -EOPNOTSUPP;
+		goto out;
+	}
+
 	if (f2fs_is_atomic_file(inode)) {
 		if (is_inode_flag_set(inode, FI_ATOMIC_REVOKE_REQUEST))
 			ret = -EINVAL;
@@ -1866,6 +1953,11 @@ static int f2fs_ioc_start_volatile_write(struct file *filp)
 
 	inode_lock(inode);
 
+	if (f2fs_compressed_file(inode)) {
+		ret = -EOPNOTSUPP;
+		goto out;
+	}
+
 	if (f2fs_is_volatile_file(inode))
 		goto out;
 
@@ -2065,6 +2157,9 @@ static int f2fs_ioc_set_encryption_policy(struct file *filp, unsigned long arg)
 	if (!f2fs_sb_has_encrypt(inode->i_sb))
 		return -EOPNOTSUPP;
 
+	if (f2fs_compressed_file(inode))
+		return -EOPNOTSUPP;
+
 	f2fs_update_time(F2FS_I_SB(inode), REQ_TIME);
 
 	return fscrypt_ioctl_set_policy(filp, (const void __user *)arg);
@@ -2381,6 +2476,9 @@ static int f2fs_ioc_defragment(struct file *filp, unsigned long arg)
 	if (!S_ISREG(inode->i_mode) || f2fs_is_atomic_file(inode))
 		return -EINVAL;
 
+	if (f2fs_compressed_file(inode))
+		return -EOPNOTSUPP;
+
 	if (f2fs_readonly(sbi->sb))
 		return -EROFS;
 
@@ -2437,6 +2535,9 @@ static int f2fs_move_file_range(struct file *file_in, loff_t pos_in,
 	if (f2fs_encrypted_inode(src) || f2fs_encrypted_inode(dst))
 		return -EOPNOTSUPP;
 
+	if (f2fs_compressed_file(src) || f2fs_compressed_file(dst))
+		return -EOPNOTSUPP;
+
 	if (src == dst) {
 		if (pos_in == pos_out)
 			return 0;
@@ -2921,6 +3022,11 @@ static int f2fs_ioc_set_pin_file(struct file *filp, unsigned long arg)
 		goto out;
 	}
 
+	if (f2fs_compressed_file(inode)) {
+		ret = -EOPNOTSUPP;
+		goto out;
+	}
+
 	if (f2fs_pin_file_control(inode, false)) {
 		ret = -EAGAIN;
 		goto out;
@@ -2986,6 +3092,21 @@ static int f2fs_ioc_precache_extents(struct file *filp, unsigned long arg)
 	return f2fs_precache_extents(file_inode(filp));
 }
 
+static int f2fs_ioc_get_compress_blocks(struct file *filp, unsigned long arg)
+{
+	struct inode *inode = file_inode(filp);
+	__u64 blocks;
+
+	if (!f2fs_sb_has_compression(inode->i_sb))
+		return -EOPNOTSUPP;
+
+	if (!f2fs_compressed_file(inode))
+		return -EINVAL;
+
+	blocks = atomic_read(&F2FS_I(inode)->i_compr_blocks);
+	return put_user(blocks, (u64 __user *)arg);
+}
+
 static int f2fs_ioc_get_valid_node_count(struct file *filp, unsigned long arg)
 {
 	struct f2fs_sb_info *sbi = F2FS_I_SB(file_inode(filp));
@@ -3052,6 +3173,8 @@ long f2fs_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 		return f2fs_ioc_precache_extents(filp, arg);
 	case F2FS_IOC_GET_VALID_NODE_COUNT:
 		return f2fs_ioc_get_valid_node_count(filp, arg);
+	case F2FS_IOC_GET_COMPRESS_BLOCKS:
+		return f2fs_ioc_get_compress_blocks(filp, arg);
 #ifdef CONFIG_FSCRYPT_SDP
 	case FS_IOC_GET_SDP_INFO:
 	case FS_IOC_SET_SDP_POLICY:
@@ -3093,6 +3216,10 @@ static ssize_t f2fs_file_write_iter(struct kiocb *iocb, struct iov_iter *from)
 		if (iov_iter_fault_in_readable(from, iov_iter_count(from)))
 			set_inode_flag(inode, FI_NO_PREALLOC);
 
+		/* compressed clusters get their blocks at writeback */
+		if (f2fs_compressed_file(inode))
+			set_inode_flag(inode, FI_NO_PREALLOC);
+
 		if ((iocb->ki_flags & IOCB_NOWAIT) &&
 			(iocb->ki_flags & IOCB_DIRECT)) {
 				if (!f2fs_overwrite_io(inode, iocb->ki_pos,
@@ -3169,6 +3296,7 @@ long f2fs_compat_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 	case F2FS_IOC_SET_PIN_FILE:
 	case F2FS_IOC_PRECACHE_EXTENTS:
 	case F2FS_IOC_GET_VALID_NODE_COUNT:
+	case F2FS_IOC_GET_COMPRESS_BLOCKS:
 #ifdef CONFIG_FSCRYPT_SDP
 	case FS_IOC_GET_SDP_INFO:
 	case FS_IOC_SET_SDP_POLICY:
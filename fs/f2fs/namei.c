@@ -88,6 +88,9 @@ static struct inode *f2fs_new_inode(struct inode *dir, umode_t mode)
 		F2FS_I(inode)->i_extra_isize = F2FS_TOTAL_EXTRA_ATTR_SIZE;
 	}
 
+	if ((F2FS_I(dir)->i_flags & F2FS_COMPR_FL) && f2fs_may_compress(inode))
+		set_compress_context(inode);
+
 	if (test_opt(sbi, INLINE_XATTR))
 		set_inode_flag(inode, FI_INLINE_XATTR);
 
@@ -119,6 +122,11 @@ static struct inode *f2fs_new_inode(struct inode *dir, umode_t mode)
 	if (S_ISDIR(inode->i_mode))
 		F2FS_I(inode)->i_flags |= F2FS_INDEX_FL;
 
+	/* a file which can't be compressed must not claim to be */
+	if (f2fs_sb_has_compression(sbi->sb) && S_ISREG(inode->i_mode) &&
+					!f2fs_compressed_file(inode))
+		F2FS_I(inode)->i_flags &= ~F2FS_COMPR_FL;
+
 	if (F2FS_I(inode)->i_flags & F2FS_PROJINHERIT_FL)
 		set_inode_flag(inode, FI_PROJ_INHERIT);
 
@@ -199,6 +207,34 @@ static inline void set_file_temperature(struct f2fs_sb_info *sbi, struct inode *
 		file_set_hot(inode);
 }
 
+/*
+ * Compress files matching the compress_extension mount option
+ */
+static void set_compress_inode(struct f2fs_sb_info *sbi, struct inode *inode,
+						const unsigned char *name)
+{
+	unsigned char (*ext)[F2FS_EXTENSION_LEN] =
+					F2FS_OPTION(sbi).extensions;
+	int i;
+
+	if (f2fs_compressed_file(inode) || !f2fs_may_compress(inode))
+		return;
+
+	for (i = 0; i < F2FS_OPTION(sbi).compress_ext_cnt; i++) {
+		if (!is_extension_exist(name, ext[i]))
+			continue;
+
+		/* a new file has no inline data to convert yet */
+		if (f2fs_has_inline_data(inode)) {
+			clear_inode_flag(inode, FI_INLINE_DATA);
+			stat_dec_inline_inode(inode);
+		}
+		f2fs_drop_extent_tree(inode);
+		set_compress_context(inode);
+		return;
+	}
+}
+
 int f2fs_update_extension_list(struct f2fs_sb_info *sbi, const char *name,
 							bool hot, bool set)
 {
@@ -290,6 +326,8 @@ static int f2fs_create(struct inode *dir, struct dentry *dentry, umode_t mode,
 	if (!test_opt(sbi, DISABLE_EXT_IDENTIFY))
 		set_file_temperature(sbi, inode, dentry->d_name.name);
 
+	set_compress_inode(sbi, inode, dentry->d_name.name);
+
 	inode->i_op = &f2fs_file_inode_operations;
 	inode->i_fop = &f2fs_file_operations;
 	inode->i_mapping->a_ops = &f2fs_dblock_aops;
@@ -267,6 +267,12 @@ static int recover_inode(struct inode *inode, struct page *page)
 				F2FS_I(inode)->i_projid = kprojid;
 			}
 		}
+
+		if (f2fs_sb_has_compression(F2FS_I_SB(inode)->sb) &&
+			F2FS_FITS_IN_INODE(raw, le16_to_cpu(raw->i_extra_isize),
+							i_compr_blocks))
+			atomic_set(&F2FS_I(inode)->i_compr_blocks,
+					le64_to_cpu(raw->i_compr_blocks));
 	}
 
 	f2fs_i_size_write(inode, le64_to_cpu(raw->i_size));
@@ -574,6 +580,14 @@ static int do_recover_data(struct f2fs_sb_info *sbi, struct inode *inode,
 			continue;
 		}
 
+		/* dest is the header of a compressed cluster, no data block */
+		if (dest == COMPRESS_ADDR) {
+			f2fs_truncate_data_blocks_range(&dn, 1);
+			dn.data_blkaddr = COMPRESS_ADDR;
+			f2fs_set_data_blkaddr(&dn);
+			continue;
+		}
+
 		if (!file_keep_isize(inode) &&
 			(i_size_read(inode) <= ((loff_t)start << PAGE_SHIFT)))
 			f2fs_i_size_write(inode,
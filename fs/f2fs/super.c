@@ -144,6 +144,9 @@ enum {
 	Opt_test_dummy_encryption,
 	Opt_checkpoint,
 	Opt_checkpoint_ioprio,
+	Opt_compress_algorithm,
+	Opt_compress_log_size,
+	Opt_compress_extension,
 	Opt_err,
 };
 
@@ -205,6 +208,9 @@ static match_table_t f2fs_tokens = {
 	{Opt_test_dummy_encryption, "test_dummy_encryption"},
 	{Opt_checkpoint, "checkpoint=%s"},
 	{Opt_checkpoint_ioprio, "checkpoint_ioprio=%u"},
+	{Opt_compress_algorithm, "compress_algorithm=%s"},
+	{Opt_compress_log_size, "compress_log_size=%u"},
+	{Opt_compress_extension, "compress_extension=%s"},
 	{Opt_err, NULL},
 };
 
@@ -478,6 +484,9 @@ static int parse_options(struct super_block *sb, char *options)
 #ifdef CONFIG_QUOTA
 	int ret;
 #endif
+#ifdef CONFIG_F2FS_FS_COMPRESSION
+	unsigned char ext_cnt;
+#endif
 
 	if (!options)
 		return 0;
@@ -919,6 +928,79 @@ static int parse_options(struct super_block *sb, char *options)
 			}
 			F2FS_OPTION(sbi).ckpt_ioprio = (unsigned int)arg;
 			break;
+#ifdef CONFIG_F2FS_FS_COMPRESSION
+		case Opt_compress_algorithm:
+			if (!f2fs_sb_has_compression(sb)) {
+				f2fs_msg(sb, KERN_ERR,
+					"Compression feature is off");
+				return -EINVAL;
+			}
+			name = match_strdup(&args[0]);
+			if (!name)
+				return -ENOMEM;
+			if (IS_ENABLED(CONFIG_F2FS_FS_LZO) &&
+					strlen(name) == 3 &&
+					!strncmp(name, "lzo", 3)) {
+				F2FS_OPTION(sbi).compress_algorithm =
+								COMPRESS_LZO;
+			} else if (IS_ENABLED(CONFIG_F2FS_FS_LZ4) &&
+					strlen(name) == 3 &&
+					!strncmp(name, "lz4", 3)) {
+				F2FS_OPTION(sbi).compress_algorithm =
+								COMPRESS_LZ4;
+			} else {
+				kfree(name);
+				return -EINVAL;
+			}
+			kfree(name);
+			break;
+		case Opt_compress_log_size:
+			if (!f2fs_sb_has_compression(sb)) {
+				f2fs_msg(sb, KERN_ERR,
+					"Compression feature is off");
+				return -EINVAL;
+			}
+			if (args->from && match_int(args, &arg))
+				return -EINVAL;
+			if (arg < MIN_COMPRESS_LOG_SIZE ||
+					arg > MAX_COMPRESS_LOG_SIZE) {
+				f2fs_msg(sb, KERN_ERR,
+					"Compress cluster log size is out of range");
+				return -EINVAL;
+			}
+			F2FS_OPTION(sbi).compress_log_size = arg;
+			break;
+		case Opt_compress_extension:
+			if (!f2fs_sb_has_compression(sb)) {
+				f2fs_msg(sb, KERN_ERR,
+					"Compression feature is off");
+				return -EINVAL;
+			}
+			name = match_strdup(&args[0]);
+			if (!name)
+				return -ENOMEM;
+
+			ext_cnt = F2FS_OPTION(sbi).compress_ext_cnt;
+			if (strlen(name) >= F2FS_EXTENSION_LEN ||
+					ext_cnt >= COMPRESS_EXT_NUM) {
+				f2fs_msg(sb, KERN_ERR,
+					"invalid extension length/number");
+				kfree(name);
+				return -EINVAL;
+			}
+
+			strcpy(F2FS_OPTION(sbi).extensions[ext_cnt], name);
+			F2FS_OPTION(sbi).compress_ext_cnt++;
+			kfree(name);
+			break;
+#else
+		case Opt_compress_algorithm:
+		case Opt_compress_log_size:
+		case Opt_compress_extension:
+			f2fs_msg(sb, KERN_INFO,
+				"compression options not supported");
+			break;
+#endif
 		default:
 			f2fs_msg(sb, KERN_ERR,
 				"Unrecognized mount option \"%s\" or missing value",
@@ -943,6 +1025,14 @@ static int parse_options(struct super_block *sb, char *options)
 		return -EINVAL;
 	}
 #endif
+#ifndef CONFIG_F2FS_FS_COMPRESSION
+	if (f2fs_sb_has_compression(sbi->sb) && !f2fs_readonly(sbi->sb)) {
+		f2fs_msg(sb, KERN_ERR,
+			"Filesystem with compression feature cannot be "
+			"mounted RDWR without CONFIG_F2FS_FS_COMPRESSION");
+		return -EINVAL;
+	}
+#endif
 
 	if (F2FS_IO_SIZE_BITS(sbi) && !test_opt(sbi, LFS)) {
 		f2fs_msg(sb, KERN_ERR,
@@ -1558,6 +1648,21 @@ static int f2fs_show_options(struct seq_file *seq, struct dentry *root)
 	if (F2FS_OPTION(sbi).test_dummy_encryption)
 		seq_puts(seq, ",test_dummy_encryption");
 #endif
+#ifdef CONFIG_F2FS_FS_COMPRESSION
+	if (f2fs_sb_has_compression(sbi->sb)) {
+		int i;
+
+		if (F2FS_OPTION(sbi).compress_algorithm == COMPRESS_LZO)
+			seq_printf(seq, ",compress_algorithm=%s", "lzo");
+		else if (F2FS_OPTION(sbi).compress_algorithm == COMPRESS_LZ4)
+			seq_printf(seq, ",compress_algorithm=%s", "lz4");
+		seq_printf(seq, ",compress_log_size=%u",
+				F2FS_OPTION(sbi).compress_log_size);
+		for (i = 0; i < F2FS_OPTION(sbi).compress_ext_cnt; i++)
+			seq_printf(seq, ",compress_extension=%s",
+					F2FS_OPTION(sbi).extensions[i]);
+	}
+#endif
 
 	if (F2FS_OPTION(sbi).alloc_mode == ALLOC_MODE_DEFAULT)
 		seq_printf(seq, ",alloc_mode=%s", "default");
@@ -1593,6 +1698,10 @@ static void default_options(struct f2fs_sb_info *sbi, bool remount)
 	F2FS_OPTION(sbi).alloc_mode = ALLOC_MODE_DEFAULT;
 	F2FS_OPTION(sbi).fsync_mode = FSYNC_MODE_POSIX;
 	F2FS_OPTION(sbi).test_dummy_encryption = false;
+	F2FS_OPTION(sbi).compress_algorithm = IS_ENABLED(CONFIG_F2FS_FS_LZ4) ?
+						COMPRESS_LZ4 : COMPRESS_LZO;
+	F2FS_OPTION(sbi).compress_log_size = MIN_COMPRESS_LOG_SIZE;
+	F2FS_OPTION(sbi).compress_ext_cnt = 0;
 	F2FS_OPTION(sbi).s_resuid = make_kuid(&init_user_ns, F2FS_DEF_RESUID);
 	F2FS_OPTION(sbi).s_resgid = make_kgid(&init_user_ns, F2FS_DEF_RESGID);
 	F2FS_OPTION(sbi).flush_group = make_kgid(&init_user_ns, F2FS_DEF_FLUSHGROUP);
@@ -2495,7 +2604,7 @@ static const struct export_operations f2fs_export_ops = {
 static loff_t max_file_blocks(void)
 {
 	loff_t result = 0;
-	loff_t leaf_count = ADDRS_PER_BLOCK;
+	loff_t leaf_count = DEF_ADDRS_PER_BLOCK;
 
 	/*
 	 * note: previously, result is equal to (DEF_ADDRS_PER_INODE -
@@ -3356,6 +3465,10 @@ static int f2fs_fill_super(struct super_block *sb, void *data, int silent)
 	if (err)
 		goto free_options;
 
+	err = f2fs_init_compress_ctx(sbi);
+	if (err)
+		goto free_options;
+
 	sbi->max_file_blocks = max_file_blocks();
 	sb->s_maxbytes = sbi->max_file_blocks <<
 				le32_to_cpu(raw_super->log_blocksize);
@@ -3858,6 +3971,7 @@ static int __init init_f2fs_fs(void)
 
 static void __exit exit_f2fs_fs(void)
 {
+	f2fs_destroy_compress_ctx();
 	f2fs_destroy_post_read_processing();
 	f2fs_destroy_root_stats();
 	unregister_filesystem(&f2fs_fs_type);
@@ -0,0 +1,1528 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Shared application/kernel submission and completion ring pairs, for
+ * supporting fast/efficient IO.
+ *
+ * A note on the read/write ordering memory barriers that are matched between
+ * the application and kernel side. When the application reads the CQ ring
+ * tail, it must use an appropriate smp_rmb() to order with the smp_wmb()
+ * the kernel uses after writing the tail. Failure to do so could cause a
+ * delay in when the application notices that completion events available.
+ * This isn't a fatal condition. Likewise, the application must use an
+ * appropriate smp_wmb() both before writing the SQ tail, and after writing
+ * the SQ tail. The first one orders the sqe writes with the tail write, and
+ * the latter is paired with the smp_rmb() the kernel will issue before
+ * reading the SQ tail on submission.
+ *
+ * Requests are first issued inline from io_uring_enter(). Reads on files
+ * that support IOCB_NOWAIT are attempted without blocking; anything that
+ * would block (and all writes and fsyncs) is handed off to a per-ring
+ * workqueue, which issues it with the mm and credentials of the task that
+ * created the ring. Polled submission (IORING_SETUP_SQPOLL) and polled
+ * completion (IORING_SETUP_IOPOLL) are not supported.
+ *
+ * Also see the examples in the liburing library:
+ *
+ *	git://git.kernel.dk/liburing
+ */
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/errno.h>
+#include <linux/syscalls.h>
+#include <linux/compat.h>
+#include <linux/refcount.h>
+#include <linux/uio.h>
+
+#include <linux/sched/signal.h>
+#include <linux/sched/mm.h>
+#include <linux/fs.h>
+#include <linux/file.h>
+#include <linux/mm.h>
+#include <linux/mmu_context.h>
+#include <linux/slab.h>
+#include <linux/workqueue.h>
+#include <linux/bvec.h>
+#include <linux/anon_inodes.h>
+#include <linux/uaccess.h>
+#include <linux/nospec.h>
+#include <linux/sizes.h>
+#include <linux/hugetlb.h>
+#include <linux/poll.h>
+#include <linux/fsnotify.h>
+#include <linux/cred.h>
+
+#include <uapi/linux/io_uring.h>
+
+#include "internal.h"
+
+#define IORING_MAX_ENTRIES	4096
+#define IORING_MAX_FIXED_FILES	1024
+
+struct io_uring {
+	u32 head ____cacheline_aligned_in_smp;
+	u32 tail ____cacheline_aligned_in_smp;
+};
+
+struct io_sq_ring {
+	struct io_uring		r;
+	u32			ring_mask;
+	u32			ring_entries;
+	u32			dropped;
+	u32			flags;
+	u32			array[];
+};
+
+struct io_cq_ring {
+	struct io_uring		r;
+	u32			ring_mask;
+	u32			ring_entries;
+	u32			overflow;
+	struct io_uring_cqe	cqes[];
+};
+
+struct io_mapped_ubuf {
+	u64		ubuf;
+	size_t		len;
+	struct bio_vec	*bvec;
+	unsigned int	nr_bvecs;
+};
+
+struct io_ring_ctx {
+	struct {
+		/* submission side, serialized by uring_lock */
+		struct io_sq_ring	*sq_ring;
+		unsigned		cached_sq_head;
+		unsigned		sq_entries;
+		unsigned		sq_mask;
+		struct io_uring_sqe	*sq_sqes;
+	} ____cacheline_aligned_in_smp;
+
+	struct {
+		/* completion side, serialized by completion_lock */
+		struct io_cq_ring	*cq_ring;
+		unsigned		cached_cq_tail;
+		unsigned		cq_entries;
+		unsigned		cq_mask;
+		wait_queue_head_t	cq_wait;
+	} ____cacheline_aligned_in_smp;
+
+	struct {
+		spinlock_t		completion_lock;
+		/* armed poll requests, for cancellation */
+		struct list_head	cancel_list;
+	} ____cacheline_aligned_in_smp;
+
+	struct mutex		uring_lock;
+
+	/* if used, fixed file set */
+	struct file		**user_files;
+	unsigned		nr_user_files;
+
+	/* if used, fixed mapped user buffers */
+	unsigned		nr_user_bufs;
+	struct io_mapped_ubuf	*user_bufs;
+
+	struct user_struct	*user;
+	bool			account_mem;
+
+	/* context the workqueue issues punted requests in */
+	const struct cred	*creds;
+	struct mm_struct	*sqo_mm;
+	struct workqueue_struct	*sqo_wq;
+};
+
+struct io_poll_iocb {
+	struct wait_queue_head		*head;
+	unsigned int			events;
+	bool				done;
+	bool				canceled;
+	struct wait_queue_entry		wait;
+};
+
+struct io_kiocb {
+	union {
+		struct kiocb		rw;
+		struct io_poll_iocb	poll;
+	};
+
+	/* stable copy of the sqe, userspace may reuse the slot */
+	struct io_uring_sqe	sqe;
+	struct file		*file;
+	struct io_ring_ctx	*ctx;
+	struct list_head	list;
+	unsigned int		flags;
+	refcount_t		refs;
+#define REQ_F_FILE_REF		1	/* holds a reference to ->file */
+	u64			user_data;
+
+	struct work_struct	work;
+};
+
+static struct kmem_cache *req_cachep;
+
+static const struct file_operations io_uring_fops;
+
+static size_t io_sq_ring_size(unsigned int entries)
+{
+	return sizeof(struct io_sq_ring) + entries * sizeof(u32);
+}
+
+static size_t io_sqes_size(unsigned int entries)
+{
+	return entries * sizeof(struct io_uring_sqe);
+}
+
+static size_t io_cq_ring_size(unsigned int entries)
+{
+	return sizeof(struct io_cq_ring) + entries * sizeof(struct io_uring_cqe);
+}
+
+static void *io_mem_alloc(size_t size)
+{
+	gfp_t gfp_flags = GFP_KERNEL | __GFP_ZERO | __GFP_NOWARN |
+				__GFP_NORETRY;
+
+	return (void *) __get_free_pages(gfp_flags, get_order(size));
+}
+
+static void io_mem_free(void *ptr, size_t size)
+{
+	if (ptr)
+		free_pages((unsigned long) ptr, get_order(size));
+}
+
+static struct io_ring_ctx *io_ring_ctx_alloc(void)
+{
+	struct io_ring_ctx *ctx;
+
+	ctx = kzalloc(sizeof(*ctx), GFP_KERNEL);
+	if (!ctx)
+		return NULL;
+
+	init_waitqueue_head(&ctx->cq_wait);
+	spin_lock_init(&ctx->completion_lock);
+	INIT_LIST_HEAD(&ctx->cancel_list);
+	mutex_init(&ctx->uring_lock);
+	return ctx;
+}
+
+static void io_cqring_fill_event(struct io_ring_ctx *ctx, u64 user_data,
+				 long res)
+{
+	struct io_cq_ring *ring = ctx->cq_ring;
+	struct io_uring_cqe *cqe;
+	unsigned tail;
+
+	/*
+	 * If the CQ ring is full, drop the event and bump the overflow
+	 * counter so the application can tell it missed completions.
+	 */
+	tail = ctx->cached_cq_tail;
+	if (tail - READ_ONCE(ring->r.head) == ring->ring_entries) {
+		WRITE_ONCE(ring->overflow, ring->overflow + 1);
+		return;
+	}
+
+	cqe = &ring->cqes[tail & ctx->cq_mask];
+	WRITE_ONCE(cqe->user_data, user_data);
+	WRITE_ONCE(cqe->res, res);
+	WRITE_ONCE(cqe->flags, 0);
+
+	ctx->cached_cq_tail++;
+	/* order cqe stores with ring update */
+	smp_store_release(&ring->r.tail, ctx->cached_cq_tail);
+}
+
+static void io_cqring_ev_posted(struct io_ring_ctx *ctx)
+{
+	if (wq_has_sleeper(&ctx->cq_wait))
+		wake_up(&ctx->cq_wait);
+}
+
+static void io_cqring_add_event(struct io_ring_ctx *ctx, u64 user_data,
+				long res)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&ctx->completion_lock, flags);
+	io_cqring_fill_event(ctx, user_data, res);
+	spin_unlock_irqrestore(&ctx->completion_lock, flags);
+
+	io_cqring_ev_posted(ctx);
+}
+
+static void io_put_req(struct io_kiocb *req)
+{
+	if (refcount_dec_and_test(&req->refs)) {
+		if (req->flags & REQ_F_FILE_REF)
+			fput(req->file);
+		kmem_cache_free(req_cachep, req);
+	}
+}
+
+/*
+ * Requests that outlive the io_uring_enter() call that issued them must pin
+ * their file, as a fixed file may be unregistered while they are in flight.
+ */
+static void io_req_grab_file(struct io_kiocb *req)
+{
+	if (!(req->flags & REQ_F_FILE_REF)) {
+		get_file(req->file);
+		req->flags |= REQ_F_FILE_REF;
+	}
+}
+
+static int io_prep_rw(struct io_kiocb *req, bool force_nonblock)
+{
+	const struct io_uring_sqe *sqe = &req->sqe;
+	struct kiocb *kiocb = &req->rw;
+	int ret;
+
+	/* kiocb has no io priority in this kernel */
+	if (sqe->ioprio)
+		return -EINVAL;
+
+	init_sync_kiocb(kiocb, req->file);
+	kiocb->ki_pos = sqe->off;
+
+	ret = kiocb_set_rw_flags(kiocb, sqe->rw_flags);
+	if (unlikely(ret))
+		return ret;
+
+	if (force_nonblock)
+		kiocb->ki_flags |= IOCB_NOWAIT;
+	return 0;
+}
+
+static int io_import_fixed(struct io_ring_ctx *ctx, int rw,
+			   const struct io_uring_sqe *sqe,
+			   struct iov_iter *iter)
+{
+	size_t len = sqe->len;
+	struct io_mapped_ubuf *imu;
+	unsigned index, buf_index;
+	size_t offset;
+	u64 buf_addr;
+
+	/* attempt to use fixed buffers without having provided iovecs */
+	if (unlikely(!ctx->user_bufs))
+		return -EFAULT;
+
+	buf_index = sqe->buf_index;
+	if (unlikely(buf_index >= ctx->nr_user_bufs))
+		return -EFAULT;
+
+	index = array_index_nospec(buf_index, ctx->nr_user_bufs);
+	imu = &ctx->user_bufs[index];
+	buf_addr = sqe->addr;
+
+	/* overflow */
+	if (buf_addr + len < buf_addr)
+		return -EFAULT;
+	/* not inside the mapped region */
+	if (buf_addr < imu->ubuf || buf_addr + len > imu->ubuf + imu->len)
+		return -EFAULT;
+
+	/*
+	 * May not be a start of buffer, set size appropriately
+	 * and advance us to the beginning.
+	 */
+	offset = buf_addr - imu->ubuf;
+	iov_iter_bvec(iter, rw | ITER_BVEC, imu->bvec, imu->nr_bvecs,
+		      offset + len);
+	if (offset)
+		iov_iter_advance(iter, offset);
+	return 0;
+}
+
+static int io_import_iovec(struct io_ring_ctx *ctx, int rw,
+			   const struct io_uring_sqe *sqe,
+			   struct iovec **iovec, struct iov_iter *iter)
+{
+	void __user *buf = u64_to_user_ptr(sqe->addr);
+	u8 opcode = sqe->opcode;
+
+	if (opcode == IORING_OP_READ_FIXED ||
+	    opcode == IORING_OP_WRITE_FIXED) {
+		*iovec = NULL;
+		return io_import_fixed(ctx, rw, sqe, iter);
+	}
+
+	return import_iovec(rw, buf, sqe->len, UIO_FASTIOV, iovec, iter);
+}
+
+static ssize_t io_read(struct io_kiocb *req, bool force_nonblock)
+{
+	struct iovec inline_vecs[UIO_FASTIOV], *iovec = inline_vecs;
+	struct kiocb *kiocb = &req->rw;
+	struct file *file = req->file;
+	struct iov_iter iter;
+	ssize_t ret;
+
+	if (unlikely(!(file->f_mode & FMODE_READ)))
+		return -EBADF;
+	if (unlikely(!file->f_op->read_iter))
+		return -EINVAL;
+	/* only files that can honour IOCB_NOWAIT are read inline */
+	if (force_nonblock && !(file->f_mode & FMODE_NOWAIT))
+		return -EAGAIN;
+
+	ret = io_prep_rw(req, force_nonblock);
+	if (ret)
+		return ret;
+
+	ret = io_import_iovec(req->ctx, READ, &req->sqe, &iovec, &iter);
+	if (ret)
+		return ret;
+
+	ret = rw_verify_area(READ, file, &kiocb->ki_pos, iov_iter_count(&iter));
+	if (!ret) {
+		ret = call_read_iter(file, kiocb, &iter);
+		if (ret > 0)
+			fsnotify_access(file);
+	}
+	kfree(iovec);
+	return ret;
+}
+
+static ssize_t io_write(struct io_kiocb *req, bool force_nonblock)
+{
+	struct iovec inline_vecs[UIO_FASTIOV], *iovec = inline_vecs;
+	struct kiocb *kiocb = &req->rw;
+	struct file *file = req->file;
+	struct iov_iter iter;
+	ssize_t ret;
+
+	if (unlikely(!(file->f_mode & FMODE_WRITE)))
+		return -EBADF;
+	if (unlikely(!file->f_op->write_iter))
+		return -EINVAL;
+	/*
+	 * Buffered writes can block on page allocation, dirty throttling or
+	 * the inode lock even with IOCB_NOWAIT, so always issue them from
+	 * the workqueue.
+	 */
+	if (force_nonblock)
+		return -EAGAIN;
+
+	ret = io_prep_rw(req, false);
+	if (ret)
+		return ret;
+
+	ret = io_import_iovec(req->ctx, WRITE, &req->sqe, &iovec, &iter);
+	if (ret)
+		return ret;
+
+	ret = rw_verify_area(WRITE, file, &kiocb->ki_pos,
+			     iov_iter_count(&iter));
+	if (!ret) {
+		file_start_write(file);
+		ret = call_write_iter(file, kiocb, &iter);
+		file_end_write(file);
+		if (ret > 0)
+			fsnotify_modify(file);
+	}
+	kfree(iovec);
+	return ret;
+}
+
+static int io_fsync(struct io_kiocb *req, bool force_nonblock)
+{
+	const struct io_uring_sqe *sqe = &req->sqe;
+	loff_t sqe_off = sqe->off;
+	loff_t sqe_len = sqe->len;
+	loff_t end = sqe_off + sqe_len;
+	unsigned fsync_flags = sqe->fsync_flags;
+
+	if (unlikely(sqe->addr || sqe->ioprio || sqe->buf_index))
+		return -EINVAL;
+	if (unlikely(fsync_flags & ~IORING_FSYNC_DATASYNC))
+		return -EINVAL;
+
+	/* fsync always requires a blocking context */
+	if (force_nonblock)
+		return -EAGAIN;
+
+	return vfs_fsync_range(req->file, sqe_off, end > 0 ? end : LLONG_MAX,
+			       fsync_flags & IORING_FSYNC_DATASYNC);
+}
+
+static void io_poll_complete(struct io_ring_ctx *ctx, struct io_kiocb *req,
+			     unsigned int mask)
+{
+	req->poll.done = true;
+	io_cqring_fill_event(ctx, req->user_data, mask);
+}
+
+/*
+ * Must be called with completion_lock held. If the request is still queued
+ * on the waitqueue, the work item completes it with a zero mask.
+ */
+static void io_poll_remove_one(struct io_kiocb *req)
+{
+	struct io_poll_iocb *poll = &req->poll;
+
+	spin_lock(&poll->head->lock);
+	WRITE_ONCE(poll->canceled, true);
+	if (!list_empty(&poll->wait.entry)) {
+		list_del_init(&poll->wait.entry);
+		queue_work(req->ctx->sqo_wq, &req->work);
+	}
+	spin_unlock(&poll->head->lock);
+
+	list_del_init(&req->list);
+}
+
+static void io_poll_remove_all(struct io_ring_ctx *ctx)
+{
+	struct io_kiocb *req;
+
+	spin_lock_irq(&ctx->completion_lock);
+	while (!list_empty(&ctx->cancel_list)) {
+		req = list_first_entry(&ctx->cancel_list, struct io_kiocb,
+				       list);
+		io_poll_remove_one(req);
+	}
+	spin_unlock_irq(&ctx->completion_lock);
+}
+
+static int io_poll_remove(struct io_kiocb *req)
+{
+	const struct io_uring_sqe *sqe = &req->sqe;
+	struct io_ring_ctx *ctx = req->ctx;
+	struct io_kiocb *poll_req, *next;
+	int ret = -ENOENT;
+
+	if (sqe->ioprio || sqe->off || sqe->len || sqe->buf_index ||
+	    sqe->poll_events)
+		return -EINVAL;
+
+	spin_lock_irq(&ctx->completion_lock);
+	list_for_each_entry_safe(poll_req, next, &ctx->cancel_list, list) {
+		if (sqe->addr == poll_req->user_data) {
+			io_poll_remove_one(poll_req);
+			ret = 0;
+			break;
+		}
+	}
+	spin_unlock_irq(&ctx->completion_lock);
+
+	return ret;
+}
+
+static void io_poll_complete_work(struct work_struct *work)
+{
+	struct io_kiocb *req = container_of(work, struct io_kiocb, work);
+	struct io_poll_iocb *poll = &req->poll;
+	struct io_ring_ctx *ctx = req->ctx;
+	struct file *file = req->file;
+	unsigned int mask = 0;
+
+	if (!READ_ONCE(poll->canceled))
+		mask = file->f_op->poll(file, NULL) & poll->events;
+
+	spin_lock_irq(&ctx->completion_lock);
+	if (!mask && !READ_ONCE(poll->canceled)) {
+		/* spurious wakeup, wait for the next event */
+		add_wait_queue(poll->head, &poll->wait);
+		spin_unlock_irq(&ctx->completion_lock);
+		return;
+	}
+	list_del_init(&req->list);
+	io_poll_complete(ctx, req, mask);
+	spin_unlock_irq(&ctx->completion_lock);
+
+	io_cqring_ev_posted(ctx);
+	io_put_req(req);
+}
+
+static int io_poll_wake(struct wait_queue_entry *wait, unsigned mode, int sync,
+			void *key)
+{
+	struct io_poll_iocb *poll = container_of(wait, struct io_poll_iocb,
+							wait);
+	struct io_kiocb *req = container_of(poll, struct io_kiocb, poll);
+	struct io_ring_ctx *ctx = req->ctx;
+	unsigned int mask = (unsigned long) key;
+	unsigned long flags;
+
+	/* for instances that support it check for an event match first: */
+	if (mask && !(mask & poll->events))
+		return 0;
+
+	list_del_init(&poll->wait.entry);
+
+	/*
+	 * The waitqueue lock is held here, so only complete inline if the
+	 * completion lock can be had without inverting the lock order.
+	 */
+	if (mask && spin_trylock_irqsave(&ctx->completion_lock, flags)) {
+		list_del_init(&req->list);
+		io_poll_complete(ctx, req, mask);
+		spin_unlock_irqrestore(&ctx->completion_lock, flags);
+
+		io_cqring_ev_posted(ctx);
+		io_put_req(req);
+	} else {
+		queue_work(ctx->sqo_wq, &req->work);
+	}
+
+	return 1;
+}
+
+struct io_poll_table {
+	struct poll_table_struct pt;
+	struct io_kiocb *req;
+	int error;
+};
+
+static void io_poll_queue_proc(struct file *file, struct wait_queue_head *head,
+			       struct poll_table_struct *p)
+{
+	struct io_poll_table *pt = container_of(p, struct io_poll_table, pt);
+
+	if (unlikely(pt->req->poll.head)) {
+		/* multiple waitqueues per file are not supported */
+		pt->error = -EINVAL;
+		return;
+	}
+
+	pt->error = 0;
+	pt->req->poll.head = head;
+	add_wait_queue(head, &pt->req->poll.wait);
+}
+
+static int io_poll_add(struct io_kiocb *req)
+{
+	const struct io_uring_sqe *sqe = &req->sqe;
+	struct io_poll_iocb *poll = &req->poll;
+	struct io_ring_ctx *ctx = req->ctx;
+	struct file *file = req->file;
+	struct io_poll_table ipt;
+	bool cancel = false;
+	unsigned int mask;
+
+	if (sqe->addr || sqe->ioprio || sqe->off || sqe->len || sqe->buf_index)
+		return -EINVAL;
+
+	io_req_grab_file(req);
+	INIT_WORK(&req->work, io_poll_complete_work);
+	poll->events = sqe->poll_events | POLLERR | POLLHUP;
+	poll->head = NULL;
+	poll->done = false;
+	poll->canceled = false;
+
+	init_poll_funcptr(&ipt.pt, io_poll_queue_proc);
+	ipt.pt._key = poll->events;
+	ipt.req = req;
+	ipt.error = -EINVAL; /* same as no support for a waitqueue */
+
+	/* initialized the list so that we can do list_empty checks */
+	INIT_LIST_HEAD(&poll->wait.entry);
+	init_waitqueue_func_entry(&poll->wait, io_poll_wake);
+
+	/* the submission path holds a reference until the poll is armed */
+	refcount_inc(&req->refs);
+
+	if (file->f_op->poll)
+		mask = file->f_op->poll(file, &ipt.pt) & poll->events;
+	else
+		mask = DEFAULT_POLLMASK & poll->events;
+
+	spin_lock_irq(&ctx->completion_lock);
+	if (likely(poll->head)) {
+		spin_lock(&poll->head->lock);
+		if (unlikely(list_empty(&poll->wait.entry))) {
+			/* already woken, the wake path completes it */
+			if (ipt.error)
+				cancel = true;
+			ipt.error = 0;
+			mask = 0;
+		}
+		if (mask || ipt.error)
+			list_del_init(&poll->wait.entry);
+		else if (cancel)
+			WRITE_ONCE(poll->canceled, true);
+		else if (!poll->done) /* actually waiting for an event */
+			list_add_tail(&req->list, &ctx->cancel_list);
+		spin_unlock(&poll->head->lock);
+	}
+	if (mask) { /* no async, we'd stolen it */
+		ipt.error = 0;
+		io_poll_complete(ctx, req, mask);
+	}
+	spin_unlock_irq(&ctx->completion_lock);
+
+	if (mask) {
+		io_cqring_ev_posted(ctx);
+		io_put_req(req);
+	}
+	io_put_req(req);
+	return ipt.error;
+}
+
+/*
+ * Returns the result to post for @req, -EAGAIN if @force_nonblock is set and
+ * the request has to be retried from the workqueue, or -EIOCBQUEUED if the
+ * request posts its own completion.
+ */
+static long __io_submit_sqe(struct io_ring_ctx *ctx, struct io_kiocb *req,
+			    bool force_nonblock)
+{
+	long ret;
+
+	switch (req->sqe.opcode) {
+	case IORING_OP_NOP:
+		ret = 0;
+		break;
+	case IORING_OP_READV:
+	case IORING_OP_READ_FIXED:
+		ret = io_read(req, force_nonblock);
+		break;
+	case IORING_OP_WRITEV:
+	case IORING_OP_WRITE_FIXED:
+		ret = io_write(req, force_nonblock);
+		break;
+	case IORING_OP_FSYNC:
+		ret = io_fsync(req, force_nonblock);
+		break;
+	case IORING_OP_POLL_ADD:
+		ret = io_poll_add(req);
+		if (!ret)
+			ret = -EIOCBQUEUED;
+		break;
+	case IORING_OP_POLL_REMOVE:
+		ret = io_poll_remove(req);
+		break;
+	default:
+		ret = -EINVAL;
+		break;
+	}
+
+	return ret;
+}
+
+static void io_sq_wq_submit_work(struct work_struct *work)
+{
+	struct io_kiocb *req = container_of(work, struct io_kiocb, work);
+	struct io_ring_ctx *ctx = req->ctx;
+	const struct cred *old_cred;
+	mm_segment_t old_fs;
+	long ret = -EFAULT;
+
+	old_cred = override_creds(ctx->creds);
+	if (mmget_not_zero(ctx->sqo_mm)) {
+		use_mm(ctx->sqo_mm);
+		old_fs = get_fs();
+		set_fs(USER_DS);
+
+		ret = __io_submit_sqe(ctx, req, false);
+
+		set_fs(old_fs);
+		unuse_mm(ctx->sqo_mm);
+		mmput(ctx->sqo_mm);
+	}
+	revert_creds(old_cred);
+
+	io_cqring_add_event(ctx, req->user_data, ret);
+	io_put_req(req);
+}
+
+static int io_req_set_file(struct io_ring_ctx *ctx, struct io_kiocb *req)
+{
+	const struct io_uring_sqe *sqe = &req->sqe;
+	unsigned int index;
+
+	if (sqe->opcode == IORING_OP_NOP || sqe->opcode == IORING_OP_POLL_REMOVE)
+		return 0;
+
+	if (sqe->flags & IOSQE_FIXED_FILE) {
+		if (unlikely(!ctx->user_files ||
+		    (unsigned) sqe->fd >= ctx->nr_user_files))
+			return -EBADF;
+		index = array_index_nospec(sqe->fd, ctx->nr_user_files);
+		req->file = ctx->user_files[index];
+	} else {
+		req->file = fget(sqe->fd);
+		if (unlikely(!req->file))
+			return -EBADF;
+		/*
+		 * Like in io_sqe_files_register(), a request on the ring itself
+		 * (e.g. a poll) would hold a reference that keeps it from ever
+		 * being released.
+		 */
+		if (unlikely(req->file->f_op == &io_uring_fops)) {
+			fput(req->file);
+			req->file = NULL;
+			return -EBADF;
+		}
+		req->flags |= REQ_F_FILE_REF;
+	}
+
+	return 0;
+}
+
+static void io_submit_sqe(struct io_ring_ctx *ctx, struct io_kiocb *req)
+{
+	long ret;
+
+	req->ctx = ctx;
+	req->file = NULL;
+	req->flags = 0;
+	req->user_data = req->sqe.user_data;
+	refcount_set(&req->refs, 1);
+	INIT_LIST_HEAD(&req->list);
+
+	ret = -EINVAL;
+	if (unlikely(req->sqe.flags & ~IOSQE_FIXED_FILE))
+		goto out;
+
+	ret = io_req_set_file(ctx, req);
+	if (unlikely(ret))
+		goto out;
+
+	ret = __io_submit_sqe(ctx, req, true);
+	if (ret == -EAGAIN) {
+		/* would block, retry from the workqueue */
+		if (req->file)
+			io_req_grab_file(req);
+		INIT_WORK(&req->work, io_sq_wq_submit_work);
+		queue_work(ctx->sqo_wq, &req->work);
+		return;
+	}
+	if (ret == -EIOCBQUEUED)
+		return;
+out:
+	io_cqring_add_event(ctx, req->user_data, ret);
+	io_put_req(req);
+}
+
+static int io_submit_sqes(struct io_ring_ctx *ctx, unsigned int to_submit)
+{
+	struct io_sq_ring *ring = ctx->sq_ring;
+	struct io_kiocb *req;
+	unsigned head, tail;
+	int submitted = 0;
+
+	head = ctx->cached_sq_head;
+	/* pairs with the smp_wmb() userspace issues before updating the tail */
+	tail = smp_load_acquire(&ring->r.tail);
+
+	while (submitted < to_submit && head != tail) {
+		unsigned index = READ_ONCE(ring->array[head & ctx->sq_mask]);
+
+		if (unlikely(index >= ctx->sq_entries)) {
+			/* drop invalid entries */
+			WRITE_ONCE(ring->dropped, ring->dropped + 1);
+			head++;
+			continue;
+		}
+
+		req = kmem_cache_alloc(req_cachep, GFP_KERNEL);
+		if (unlikely(!req)) {
+			if (!submitted)
+				submitted = -EAGAIN;
+			break;
+		}
+
+		memcpy(&req->sqe, &ctx->sq_sqes[index], sizeof(req->sqe));
+		head++;
+		io_submit_sqe(ctx, req);
+		submitted++;
+	}
+
+	/*
+	 * The cached head lets us batch the user visible head update, and
+	 * track the head on our side even though the application writes
+	 * the same cacheline.
+	 */
+	if (ctx->cached_sq_head != head) {
+		ctx->cached_sq_head = head;
+		smp_store_release(&ring->r.head, head);
+	}
+
+	return submitted;
+}
+
+static unsigned io_cqring_events(struct io_cq_ring *ring)
+{
+	/* see the comment at the top of this file */
+	smp_rmb();
+	return READ_ONCE(ring->r.tail) - READ_ONCE(ring->r.head);
+}
+
+/*
+ * Wait until events become available, if we don't already have some. The
+ * application must reap them itself, as they reside on the shared cq ring.
+ */
+static int io_cqring_wait(struct io_ring_ctx *ctx, int min_events,
+			  const sigset_t __user *sig, size_t sigsz)
+{
+	struct io_cq_ring *ring = ctx->cq_ring;
+	sigset_t ksigmask, sigsaved;
+	int ret;
+
+	if (io_cqring_events(ring) >= min_events)
+		return 0;
+
+	if (sig) {
+		if (sigsz != sizeof(sigset_t))
+			return -EINVAL;
+		if (copy_from_user(&ksigmask, sig, sizeof(ksigmask)))
+			return -EFAULT;
+		sigsaved = current->blocked;
+		set_current_blocked(&ksigmask);
+	}
+
+	ret = wait_event_interruptible(ctx->cq_wait,
+				io_cqring_events(ring) >= min_events);
+	if (ret == -ERESTARTSYS)
+		ret = -EINTR;
+
+	/*
+	 * As in epoll_pwait(), leave the caller's mask in place until the
+	 * signal that interrupted the wait has been delivered.
+	 */
+	if (sig) {
+		if (ret == -EINTR) {
+			memcpy(&current->saved_sigmask, &sigsaved,
+			       sizeof(sigsaved));
+			set_restore_sigmask();
+		} else
+			set_current_blocked(&sigsaved);
+	}
+
+	return ret;
+}
+
+static void __io_sqe_files_unregister(struct io_ring_ctx *ctx)
+{
+	unsigned i;
+
+	for (i = 0; i < ctx->nr_user_files; i++)
+		fput(ctx->user_files[i]);
+
+	kfree(ctx->user_files);
+	ctx->user_files = NULL;
+	ctx->nr_user_files = 0;
+}
+
+static int io_sqe_files_unregister(struct io_ring_ctx *ctx)
+{
+	if (!ctx->user_files)
+		return -ENXIO;
+
+	__io_sqe_files_unregister(ctx);
+	return 0;
+}
+
+static int io_sqe_files_register(struct io_ring_ctx *ctx, void __user *arg,
+				 unsigned nr_args)
+{
+	__s32 __user *fds = (__s32 __user *) arg;
+	struct file *file;
+	int ret = 0;
+	unsigned i;
+	__s32 fd;
+
+	if (ctx->user_files)
+		return -EBUSY;
+	if (!nr_args)
+		return -EINVAL;
+	if (nr_args > IORING_MAX_FIXED_FILES)
+		return -EMFILE;
+
+	ctx->user_files = kcalloc(nr_args, sizeof(struct file *), GFP_KERNEL);
+	if (!ctx->user_files)
+		return -ENOMEM;
+
+	for (i = 0; i < nr_args; i++) {
+		ret = -EFAULT;
+		if (copy_from_user(&fd, &fds[i], sizeof(fd)))
+			break;
+
+		ret = -EBADF;
+		file = fget(fd);
+		if (!file)
+			break;
+		/*
+		 * Don't allow io_uring instances to be registered. A ring
+		 * holding a reference to itself would never be released.
+		 */
+		if (file->f_op == &io_uring_fops) {
+			fput(file);
+			break;
+		}
+		ctx->user_files[i] = file;
+		ctx->nr_user_files++;
+		ret = 0;
+	}
+
+	if (ret)
+		__io_sqe_files_unregister(ctx);
+
+	return ret;
+}
+
+static int io_account_mem(struct user_struct *user, unsigned long nr_pages)
+{
+	unsigned long page_limit, cur_pages, new_pages;
+
+	/* Don't allow more pages than we can safely lock */
+	page_limit = rlimit(RLIMIT_MEMLOCK) >> PAGE_SHIFT;
+
+	do {
+		cur_pages = atomic_long_read(&user->locked_vm);
+		new_pages = cur_pages + nr_pages;
+		if (new_pages > page_limit)
+			return -ENOMEM;
+	} while (atomic_long_cmpxchg(&user->locked_vm, cur_pages,
+					new_pages) != cur_pages);
+
+	return 0;
+}
+
+static void io_unaccount_mem(struct user_struct *user, unsigned long nr_pages)
+{
+	atomic_long_sub(nr_pages, &user->locked_vm);
+}
+
+static int io_sqe_buffer_unregister(struct io_ring_ctx *ctx)
+{
+	int i, j;
+
+	if (!ctx->user_bufs)
+		return -ENXIO;
+
+	for (i = 0; i < ctx->nr_user_bufs; i++) {
+		struct io_mapped_ubuf *imu = &ctx->user_bufs[i];
+
+		for (j = 0; j < imu->nr_bvecs; j++)
+			put_page(imu->bvec[j].bv_page);
+
+		if (ctx->account_mem)
+			io_unaccount_mem(ctx->user, imu->nr_bvecs);
+		kvfree(imu->bvec);
+		imu->nr_bvecs = 0;
+	}
+
+	kfree(ctx->user_bufs);
+	ctx->user_bufs = NULL;
+	ctx->nr_user_bufs = 0;
+	return 0;
+}
+
+static int io_copy_iov(struct iovec *dst, void __user *arg, unsigned index)
+{
+	struct iovec __user *src;
+
+#ifdef CONFIG_COMPAT
+	if (in_compat_syscall()) {
+		struct compat_iovec __user *ciovs;
+		struct compat_iovec ciov;
+
+		ciovs = (struct compat_iovec __user *) arg;
+		if (copy_from_user(&ciov, &ciovs[index], sizeof(ciov)))
+			return -EFAULT;
+
+		dst->iov_base = (void __user *) (unsigned long) ciov.iov_base;
+		dst->iov_len = ciov.iov_len;
+		return 0;
+	}
+#endif
+	src = (struct iovec __user *) arg;
+	if (copy_from_user(dst, &src[index], sizeof(*dst)))
+		return -EFAULT;
+	return 0;
+}
+
+static int io_sqe_buffer_register(struct io_ring_ctx *ctx, void __user *arg,
+				  unsigned nr_args)
+{
+	struct vm_area_struct **vmas = NULL;
+	struct page **pages = NULL;
+	int i, j, got_pages = 0;
+	int ret = -EINVAL;
+
+	if (ctx->user_bufs)
+		return -EBUSY;
+	if (!nr_args || nr_args > UIO_MAXIOV)
+		return -EINVAL;
+
+	ctx->user_bufs = kcalloc(nr_args, sizeof(struct io_mapped_ubuf),
+					GFP_KERNEL);
+	if (!ctx->user_bufs)
+		return -ENOMEM;
+
+	for (i = 0; i < nr_args; i++) {
+		struct io_mapped_ubuf *imu = &ctx->user_bufs[i];
+		unsigned long off, start, end, ubuf;
+		int pret, nr_pages;
+		struct iovec iov;
+		size_t size;
+
+		ret = io_copy_iov(&iov, arg, i);
+		if (ret)
+			goto err;
+
+		/*
+		 * Don't impose further limits on the size and buffer
+		 * constraints here, we'll -EINVAL later when IO is
+		 * submitted if they are wrong.
+		 */
+		ret = -EFAULT;
+		if (!iov.iov_base || !iov.iov_len)
+			goto err;
+
+		/* arbitrary limit, but we need something */
+		if (iov.iov_len > SZ_1G)
+			goto err;
+
+		ubuf = (unsigned long) iov.iov_base;
+		end = (ubuf + iov.iov_len + PAGE_SIZE - 1) >> PAGE_SHIFT;
+		start = ubuf >> PAGE_SHIFT;
+		nr_pages = end - start;
+
+		if (ctx->account_mem) {
+			ret = io_account_mem(ctx->user, nr_pages);
+			if (ret)
+				goto err;
+		}
+
+		ret = 0;
+		if (!pages || nr_pages > got_pages) {
+			kvfree(vmas);
+			kvfree(pages);
+			pages = kvmalloc_array(nr_pages, sizeof(struct page *),
+						GFP_KERNEL);
+			vmas = kvmalloc_array(nr_pages,
+					sizeof(struct vm_area_struct *),
+					GFP_KERNEL);
+			if (!pages || !vmas) {
+				ret = -ENOMEM;
+				if (ctx->account_mem)
+					io_unaccount_mem(ctx->user, nr_pages);
+				goto err;
+			}
+			got_pages = nr_pages;
+		}
+
+		imu->bvec = kvmalloc_array(nr_pages, sizeof(struct bio_vec),
+						GFP_KERNEL);
+		ret = -ENOMEM;
+		if (!imu->bvec) {
+			if (ctx->account_mem)
+				io_unaccount_mem(ctx->user, nr_pages);
+			goto err;
+		}
+
+		ret = 0;
+		down_read(&current->mm->mmap_sem);
+		pret = get_user_pages_longterm(ubuf, nr_pages, FOLL_WRITE,
+						pages, vmas);
+		if (pret == nr_pages) {
+			/* don't support file backed memory */
+			for (j = 0; j < nr_pages; j++) {
+				struct vm_area_struct *vma = vmas[j];
+
+				if (vma->vm_file &&
+				    !is_file_hugepages(vma->vm_file)) {
+					ret = -EOPNOTSUPP;
+					break;
+				}
+			}
+		} else {
+			ret = pret < 0 ? pret : -EFAULT;
+		}
+		up_read(&current->mm->mmap_sem);
+		if (ret) {
+			/*
+			 * if we did partial map, or found file backed vmas,
+			 * release any pages we did get
+			 */
+			for (j = 0; j < pret; j++)
+				put_page(pages[j]);
+			if (ctx->account_mem)
+				io_unaccount_mem(ctx->user, nr_pages);
+			kvfree(imu->bvec);
+			goto err;
+		}
+
+		off = ubuf & ~PAGE_MASK;
+		size = iov.iov_len;
+		for (j = 0; j < nr_pages; j++) {
+			size_t vec_len;
+
+			vec_len = min_t(size_t, size, PAGE_SIZE - off);
+			imu->bvec[j].bv_page = pages[j];
+			imu->bvec[j].bv_len = vec_len;
+			imu->bvec[j].bv_offset = off;
+			off = 0;
+			size -= vec_len;
+		}
+		/* store original address for later verification */
+		imu->ubuf = ubuf;
+		imu->len = iov.iov_len;
+		imu->nr_bvecs = nr_pages;
+
+		ctx->nr_user_bufs++;
+	}
+	kvfree(pages);
+	kvfree(vmas);
+	return 0;
+err:
+	kvfree(pages);
+	kvfree(vmas);
+	io_sqe_buffer_unregister(ctx);
+	return ret;
+}
+
+static void io_ring_ctx_free(struct io_ring_ctx *ctx)
+{
+	if (ctx->sqo_wq)
+		destroy_workqueue(ctx->sqo_wq);
+	if (ctx->sqo_mm)
+		mmdrop(ctx->sqo_mm);
+
+	io_sqe_buffer_unregister(ctx);
+	io_sqe_files_unregister(ctx);
+
+	io_mem_free(ctx->sq_ring, io_sq_ring_size(ctx->sq_entries));
+	io_mem_free(ctx->sq_sqes, io_sqes_size(ctx->sq_entries));
+	io_mem_free(ctx->cq_ring, io_cq_ring_size(ctx->cq_entries));
+
+	free_uid(ctx->user);
+	if (ctx->creds)
+		put_cred(ctx->creds);
+	kfree(ctx);
+}
+
+static unsigned int io_uring_poll(struct file *file, poll_table *wait)
+{
+	struct io_ring_ctx *ctx = file->private_data;
+	unsigned int mask = 0;
+
+	poll_wait(file, &ctx->cq_wait, wait);
+	/* see comment at the top of this file */
+	smp_rmb();
+	if (READ_ONCE(ctx->sq_ring->r.tail) - ctx->cached_sq_head !=
+	    ctx->sq_ring->ring_entries)
+		mask |= POLLOUT | POLLWRNORM;
+	if (READ_ONCE(ctx->cq_ring->r.head) != READ_ONCE(ctx->cached_cq_tail))
+		mask |= POLLIN | POLLRDNORM;
+
+	return mask;
+}
+
+static void io_ring_ctx_wait_and_kill(struct io_ring_ctx *ctx)
+{
+	mutex_lock(&ctx->uring_lock);
+	io_poll_remove_all(ctx);
+	mutex_unlock(&ctx->uring_lock);
+
+	/* destroying the workqueue waits for punted and canceled requests */
+	io_ring_ctx_free(ctx);
+}
+
+static int io_uring_release(struct inode *inode, struct file *file)
+{
+	struct io_ring_ctx *ctx = file->private_data;
+
+	file->private_data = NULL;
+	io_ring_ctx_wait_and_kill(ctx);
+	return 0;
+}
+
+static int io_uring_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	loff_t offset = (loff_t) vma->vm_pgoff << PAGE_SHIFT;
+	unsigned long sz = vma->vm_end - vma->vm_start;
+	struct io_ring_ctx *ctx = file->private_data;
+	unsigned long pfn;
+	size_t size;
+	void *ptr;
+
+	switch (offset) {
+	case IORING_OFF_SQ_RING:
+		ptr = ctx->sq_ring;
+		size = io_sq_ring_size(ctx->sq_entries);
+		break;
+	case IORING_OFF_SQES:
+		ptr = ctx->sq_sqes;
+		size = io_sqes_size(ctx->sq_entries);
+		break;
+	case IORING_OFF_CQ_RING:
+		ptr = ctx->cq_ring;
+		size = io_cq_ring_size(ctx->cq_entries);
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	if (sz > (PAGE_SIZE << get_order(size)))
+		return -EINVAL;
+
+	pfn = virt_to_phys(ptr) >> PAGE_SHIFT;
+	return remap_pfn_range(vma, vma->vm_start, pfn, sz, vma->vm_page_prot);
+}
+
+SYSCALL_DEFINE6(io_uring_enter, unsigned int, fd, u32, to_submit,
+		u32, min_complete, u32, flags, const sigset_t __user *, sig,
+		size_t, sigsz)
+{
+	struct io_ring_ctx *ctx;
+	long ret = -EBADF;
+	int submitted = 0;
+	struct fd f;
+
+	if (flags & ~IORING_ENTER_GETEVENTS)
+		return -EINVAL;
+
+	f = fdget(fd);
+	if (!f.file)
+		return -EBADF;
+
+	ret = -EOPNOTSUPP;
+	if (f.file->f_op != &io_uring_fops)
+		goto out_fput;
+
+	ret = -ENXIO;
+	ctx = f.file->private_data;
+	if (!ctx)
+		goto out_fput;
+
+	ret = 0;
+	if (to_submit) {
+		to_submit = min(to_submit, ctx->sq_entries);
+
+		mutex_lock(&ctx->uring_lock);
+		submitted = io_submit_sqes(ctx, to_submit);
+		mutex_unlock(&ctx->uring_lock);
+
+		if (submitted < 0)
+			goto out_fput;
+	}
+	if (flags & IORING_ENTER_GETEVENTS) {
+		min_complete = min(min_complete, ctx->cq_entries);
+		ret = io_cqring_wait(ctx, min_complete, sig, sigsz);
+	}
+
+out_fput:
+	fdput(f);
+	return submitted ? submitted : ret;
+}
+
+static int io_allocate_scq_urings(struct io_ring_ctx *ctx,
+				  struct io_uring_params *p)
+{
+	struct io_sq_ring *sq_ring;
+	struct io_cq_ring *cq_ring;
+
+	sq_ring = io_mem_alloc(io_sq_ring_size(p->sq_entries));
+	if (!sq_ring)
+		return -ENOMEM;
+
+	ctx->sq_ring = sq_ring;
+	ctx->sq_entries = p->sq_entries;
+	ctx->sq_mask = p->sq_entries - 1;
+	sq_ring->ring_mask = ctx->sq_mask;
+	sq_ring->ring_entries = p->sq_entries;
+
+	ctx->sq_sqes = io_mem_alloc(io_sqes_size(p->sq_entries));
+	if (!ctx->sq_sqes)
+		return -ENOMEM;
+
+	cq_ring = io_mem_alloc(io_cq_ring_size(p->cq_entries));
+	if (!cq_ring)
+		return -ENOMEM;
+
+	ctx->cq_ring = cq_ring;
+	ctx->cq_entries = p->cq_entries;
+	ctx->cq_mask = p->cq_entries - 1;
+	cq_ring->ring_mask = ctx->cq_mask;
+	cq_ring->ring_entries = p->cq_entries;
+	return 0;
+}
+
+static void io_fill_offsets(struct io_uring_params *p)
+{
+	memset(&p->sq_off, 0, sizeof(p->sq_off));
+	p->sq_off.head = offsetof(struct io_sq_ring, r.head);
+	p->sq_off.tail = offsetof(struct io_sq_ring, r.tail);
+	p->sq_off.ring_mask = offsetof(struct io_sq_ring, ring_mask);
+	p->sq_off.ring_entries = offsetof(struct io_sq_ring, ring_entries);
+	p->sq_off.flags = offsetof(struct io_sq_ring, flags);
+	p->sq_off.dropped = offsetof(struct io_sq_ring, dropped);
+	p->sq_off.array = offsetof(struct io_sq_ring, array);
+
+	memset(&p->cq_off, 0, sizeof(p->cq_off));
+	p->cq_off.head = offsetof(struct io_cq_ring, r.head);
+	p->cq_off.tail = offsetof(struct io_cq_ring, r.tail);
+	p->cq_off.ring_mask = offsetof(struct io_cq_ring, ring_mask);
+	p->cq_off.ring_entries = offsetof(struct io_cq_ring, ring_entries);
+	p->cq_off.overflow = offsetof(struct io_cq_ring, overflow);
+	p->cq_off.cqes = offsetof(struct io_cq_ring, cqes);
+}
+
+static int io_uring_create(unsigned entries, struct io_uring_params *p,
+			   struct io_uring_params __user *params)
+{
+	struct io_ring_ctx *ctx;
+	struct file *file;
+	int ret, fd;
+
+	if (!entries || entries > IORING_MAX_ENTRIES)
+		return -EINVAL;
+
+	/*
+	 * Use twice as many entries for the CQ ring. It's possible for the
+	 * application to drive a higher depth than the size of the SQ ring,
+	 * since the sqes are only used at submission time. This allows for
+	 * some flexibility in overcommitting a bit.
+	 */
+	p->sq_entries = roundup_pow_of_two(entries);
+	p->cq_entries = 2 * p->sq_entries;
+
+	ctx = io_ring_ctx_alloc();
+	if (!ctx)
+		return -ENOMEM;
+
+	ctx->user = get_uid(current_user());
+	ctx->account_mem = !capable(CAP_IPC_LOCK);
+	ctx->creds = get_current_cred();
+	ctx->sqo_mm = current->mm;
+	mmgrab(ctx->sqo_mm);
+
+	ret = io_allocate_scq_urings(ctx, p);
+	if (ret)
+		goto err;
+
+	/* Do QD, or 2 * CPUS, whatever is smallest */
+	ret = -ENOMEM;
+	ctx->sqo_wq = alloc_workqueue("io_ring-wq", WQ_UNBOUND | WQ_FREEZABLE,
+			min(ctx->sq_entries - 1, 2 * num_online_cpus()));
+	if (!ctx->sqo_wq)
+		goto err;
+
+	io_fill_offsets(p);
+	ret = -EFAULT;
+	if (copy_to_user(params, p, sizeof(*p)))
+		goto err;
+
+	fd = get_unused_fd_flags(O_RDWR | O_CLOEXEC);
+	if (fd < 0) {
+		ret = fd;
+		goto err;
+	}
+
+	file = anon_inode_getfile("[io_uring]", &io_uring_fops, ctx,
+					O_RDWR | O_CLOEXEC);
+	if (IS_ERR(file)) {
+		put_unused_fd(fd);
+		ret = PTR_ERR(file);
+		goto err;
+	}
+
+	fd_install(fd, file);
+	return fd;
+err:
+	io_ring_ctx_free(ctx);
+	return ret;
+}
+
+/*
+ * Sets up an aio uring context, and returns the fd. Applications asks for a
+ * ring size, we return the actual sq/cq ring sizes (among other things) in the
+ * params structure passed in.
+ */
+SYSCALL_DEFINE2(io_uring_setup, u32, entries,
+		struct io_uring_params __user *, params)
+{
+	struct io_uring_params p;
+	int i;
+
+	if (copy_from_user(&p, params, sizeof(p)))
+		return -EFAULT;
+	for (i = 0; i < ARRAY_SIZE(p.resv); i++) {
+		if (p.resv[i])
+			return -EINVAL;
+	}
+
+	/* neither polled IO nor the SQ polling thread are supported */
+	if (p.flags)
+		return -EINVAL;
+
+	return io_uring_create(entries, &p, params);
+}
+
+static int __io_uring_register(struct io_ring_ctx *ctx, unsigned opcode,
+			       void __user *arg, unsigned nr_args)
+{
+	int ret;
+
+	switch (opcode) {
+	case IORING_REGISTER_BUFFERS:
+		ret = io_sqe_buffer_register(ctx, arg, nr_args);
+		break;
+	case IORING_UNREGISTER_BUFFERS:
+		ret = -EINVAL;
+		if (arg || nr_args)
+			break;
+		/* punted requests may still be reading from the buffers */
+		flush_workqueue(ctx->sqo_wq);
+		ret = io_sqe_buffer_unregister(ctx);
+		break;
+	case IORING_REGISTER_FILES:
+		ret = io_sqe_files_register(ctx, arg, nr_args);
+		break;
+	case IORING_UNREGISTER_FILES:
+		ret = -EINVAL;
+		if (arg || nr_args)
+			break;
+		ret = io_sqe_files_unregister(ctx);
+		break;
+	default:
+		ret = -EINVAL;
+		break;
+	}
+
+	return ret;
+}
+
+SYSCALL_DEFINE4(io_uring_register, unsigned int, fd, unsigned int, opcode,
+		void __user *, arg, unsigned int, nr_args)
+{
+	struct io_ring_ctx *ctx;
+	long ret = -EBADF;
+	struct fd f;
+
+	f = fdget(fd);
+	if (!f.file)
+		return -EBADF;
+
+	ret = -EOPNOTSUPP;
+	if (f.file->f_op != &io_uring_fops)
+		goto out_fput;
+
+	ctx = f.file->private_data;
+
+	mutex_lock(&ctx->uring_lock);
+	ret = __io_uring_register(ctx, opcode, arg, nr_args);
+	mutex_unlock(&ctx->uring_lock);
+out_fput:
+	fdput(f);
+	return ret;
+}
+
+static const struct file_operations io_uring_fops = {
+	.release	= io_uring_release,
+	.mmap		= io_uring_mmap,
+	.poll		= io_uring_poll,
+};
+
+static int __init io_uring_init(void)
+{
+	req_cachep = KMEM_CACHE(io_kiocb, SLAB_HWCACHE_ALIGN | SLAB_PANIC);
+	return 0;
+};
+__initcall(io_uring_init);
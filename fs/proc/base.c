@@ -97,6 +97,7 @@
 #include <linux/task_integrity.h>
 #include <linux/proca.h>
 #include <linux/cpufreq_times.h>
+#include <linux/simple_lmk.h>
 #ifdef CONFIG_HARDWALL
 #include <asm/hardwall.h>
 #endif
@@ -1268,6 +1269,7 @@ static int __set_oom_adj(struct file *file, int oom_adj, bool legacy)
 	if (!legacy && has_capability_noaudit(current, CAP_SYS_RESOURCE))
 		task->signal->oom_score_adj_min = (short)oom_adj;
 	trace_oom_score_adj_update(task);
+	simple_lmk_adj_changed(task);
 
 	if (mm) {
 		struct task_struct *p;
@@ -1288,6 +1290,7 @@ static int __set_oom_adj(struct file *file, int oom_adj, bool legacy)
 					p->signal->oom_score_adj_min = (short)oom_adj;
 			}
 			task_unlock(p);
+			simple_lmk_adj_changed(p);
 		}
 		rcu_read_unlock();
 		mmdrop(mm);
@@ -34,6 +34,12 @@ struct task_band {
 
 	unsigned long util;
 	unsigned long last_update_time;
+
+	/* wakeup prediction */
+	u64 last_wakeup;
+	u64 wakeup_interval;
+	u64 runtime;
+	int last_cpu;
 };
 
 #ifdef CONFIG_SCHED_EMS
@@ -13,6 +13,7 @@ struct css_set;
 #ifdef CONFIG_PSI
 
 extern struct static_key_false psi_disabled;
+extern struct psi_group psi_system;
 
 void psi_init(void);
 
@@ -28,6 +29,7 @@ int psi_show(struct seq_file *s, struct psi_group *group, enum psi_res res);
 int psi_cgroup_alloc(struct cgroup *cgrp);
 void psi_cgroup_free(struct cgroup *cgrp);
 void cgroup_move_task(struct task_struct *p, struct css_set *to);
+#endif
 
 struct psi_trigger *psi_trigger_create(struct psi_group *group,
 			char *buf, size_t nbytes, enum psi_res res);
@@ -35,7 +37,6 @@ void psi_trigger_destroy(struct psi_trigger *t);
 
 unsigned int psi_trigger_poll(void **trigger_ptr, struct file *file,
 			      poll_table *wait);
-#endif
 
 #else /* CONFIG_PSI */
 
@@ -417,11 +417,18 @@ struct sched_avg {
 	struct util_est			util_est;
 } ____cacheline_aligned;
 
+#define ONTIME_HIST_SIZE	4
+
 struct ontime_avg {
 	u64 ontime_migration_time;
 	u64 load_sum;
 	u32 period_contrib;
 	unsigned long load_avg;
+
+	/* load_avg at the end of recent windows, oldest first from hist_idx */
+	u16 hist[ONTIME_HIST_SIZE];
+	u8 hist_idx;
+	u8 hist_periods;
 };
 
 struct ontime_entity {
@@ -1298,9 +1305,6 @@ struct task_struct {
 #ifdef CONFIG_SEC_DEBUG_DTASK
 	struct sec_debug_wait		ssdbg_wait;
 #endif
-#ifdef CONFIG_ANDROID_SIMPLE_LMK
-	struct task_struct		*simple_lmk_next;
-#endif
 
 	/*
 	 * New fields for task_struct should be added above here, so that
@@ -219,6 +219,10 @@ struct signal_struct {
 					 * Only settable by CAP_SYS_RESOURCE. */
 	struct mm_struct *oom_mm;	/* recorded mm when the thread group got
 					 * killed by the oom killer */
+#ifdef CONFIG_ANDROID_SIMPLE_LMK
+	struct hlist_node simple_lmk_node;	/* simple_lmk adj index */
+	int simple_lmk_bucket;		/* adj bucket simple_lmk_node is on */
+#endif
 
 	struct mutex cred_guard_mutex;	/* guard against foreign influences on
 					 * credential calculations
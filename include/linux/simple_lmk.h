@@ -6,13 +6,26 @@
 #define _SIMPLE_LMK_H_
 
 struct mm_struct;
+struct task_struct;
 
 #ifdef CONFIG_ANDROID_SIMPLE_LMK
 void simple_lmk_mm_freed(struct mm_struct *mm);
+void simple_lmk_task_add(struct task_struct *tsk);
+void simple_lmk_task_del(struct task_struct *tsk);
+void simple_lmk_adj_changed(struct task_struct *tsk);
 #else
 static inline void simple_lmk_mm_freed(struct mm_struct *mm)
 {
 }
+static inline void simple_lmk_task_add(struct task_struct *tsk)
+{
+}
+static inline void simple_lmk_task_del(struct task_struct *tsk)
+{
+}
+static inline void simple_lmk_adj_changed(struct task_struct *tsk)
+{
+}
 #endif
 
 #endif /* _SIMPLE_LMK_H_ */
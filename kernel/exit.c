@@ -65,6 +65,7 @@
 #include <linux/cpufreq_times.h>
 #include <linux/ems.h>
 #include <linux/sysfs.h>
+#include <linux/simple_lmk.h>
 
 #include <linux/uaccess.h>
 #include <asm/unistd.h>
@@ -274,6 +275,9 @@ void release_task(struct task_struct *p)
 	}
 
 	write_unlock_irq(&tasklist_lock);
+	/* The thread group is gone once its leader is released */
+	if (leader == p)
+		simple_lmk_task_del(p);
 	release_thread(p);
 	call_rcu(&p->rcu, delayed_put_task_struct);
 
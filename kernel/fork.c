@@ -1714,6 +1714,7 @@ static void copy_oom_score_adj(u64 clone_flags, struct task_struct *tsk)
 	/* Update the values in case they were changed after copy_signal */
 	tsk->signal->oom_score_adj = current->signal->oom_score_adj;
 	tsk->signal->oom_score_adj_min = current->signal->oom_score_adj_min;
+	simple_lmk_adj_changed(tsk);
 	mutex_unlock(&oom_adj_mutex);
 }
 
@@ -2186,6 +2187,9 @@ static __latent_entropy struct task_struct *copy_process(
 		rkp_assign_pgd(p);
 #endif/*CONFIG_RKP_KDP*/
 
+	/* The child can't be released before it runs, so index it late */
+	if (thread_group_leader(p))
+		simple_lmk_task_add(p);
 	copy_oom_score_adj(clone_flags, p);
 
 	return p;
@@ -29,19 +29,116 @@ static struct task_band *lookup_band(struct task_struct *p)
 	return band;
 }
 
+/*
+ * Each band predicts how often its members wake up and how long they run
+ * once woken. Producer/consumer pipelines such as render and UI threads wake
+ * each other at a short, steady interval and run for a short time; their
+ * decayed utilization underestimates what they need when the next frame
+ * arrives, and scattering them across clusters costs a cache migration per
+ * hand-off. The prediction is kept as an exponential moving average with a
+ * weight of 1/8 per sample.
+ */
+#define BAND_PREDICT_SHIFT	3
+
+/* band that wakes up at least this often is latency sensitive */
+static u64 band_latency_interval = 20000000;	/* 20ms */
+
+static unsigned long out_of_time = 100000000;	/* 100ms */
+
+static inline u64 band_predict(u64 avg, u64 sample)
+{
+	if (!avg)
+		return sample;
+
+	return avg - (avg >> BAND_PREDICT_SHIFT) + (sample >> BAND_PREDICT_SHIFT);
+}
+
+static inline bool band_latency_sensitive(struct task_band *band)
+{
+	u64 interval = READ_ONCE(band->wakeup_interval);
+
+	return interval && interval < band_latency_interval;
+}
+
+/*
+ * Utilization the band is expected to need, assuming its members keep
+ * running for the predicted runtime every predicted wakeup interval.
+ */
+static unsigned long band_predicted_util(struct task_band *band)
+{
+	u64 interval = READ_ONCE(band->wakeup_interval);
+	u64 runtime = READ_ONCE(band->runtime);
+
+	if (!interval || !runtime)
+		return 0;
+
+	runtime = min(runtime, interval) << SCHED_CAPACITY_SHIFT;
+
+	return div64_u64(runtime, interval);
+}
+
+/*
+ * Called whenever a band member wakes up. The prediction tolerates lost
+ * updates, so it is updated without band->lock to keep the wakeup path
+ * cheap.
+ */
+void band_wakeup(struct task_struct *p)
+{
+	struct task_band *band;
+	u64 now, last, runtime;
+
+	band = lookup_band(p);
+	if (!band)
+		return;
+
+	now = local_clock();
+	last = READ_ONCE(band->last_wakeup);
+	WRITE_ONCE(band->last_wakeup, now);
+
+	/* runtime of the last activation of this member */
+	runtime = p->se.sum_exec_runtime - p->se.prev_sum_exec_runtime;
+	WRITE_ONCE(band->runtime, band_predict(READ_ONCE(band->runtime), runtime));
+
+	if (!last || now <= last)
+		return;
+
+	/* band was idle for a long time, start the prediction over */
+	if (now - last > out_of_time) {
+		WRITE_ONCE(band->wakeup_interval, 0);
+		return;
+	}
+
+	WRITE_ONCE(band->wakeup_interval,
+		band_predict(READ_ONCE(band->wakeup_interval), now - last));
+}
+
 int band_play_cpu(struct task_struct *p)
 {
 	struct task_band *band;
-	int cpu, min_cpu = -1;
+	int cpu, last_cpu, min_cpu = -1;
 	unsigned long min_util = ULONG_MAX;
 
 	band = lookup_band(p);
 	if (!band)
 		return -1;
 
+	/*
+	 * The cpu the band played on last has the members' data in its cache.
+	 * A latency sensitive band goes back there as long as it is idle, so
+	 * that producer and consumer keep sharing the warm cache.
+	 */
+	last_cpu = READ_ONCE(band->last_cpu);
+	if (band_latency_sensitive(band) && cpu_selected(last_cpu) &&
+	    cpumask_test_cpu(last_cpu, &band->playable_cpus) &&
+	    cpumask_test_cpu(last_cpu, tsk_cpus_allowed(p)) &&
+	    !cpu_rq(last_cpu)->nr_running)
+		return last_cpu;
+
 	for_each_cpu(cpu, &band->playable_cpus) {
-		if (!cpu_rq(cpu)->nr_running)
-			return cpu;
+		if (!cpu_rq(cpu)->nr_running) {
+			min_cpu = cpu;
+			break;
+		}
 
 		if (cpu_util(cpu) < min_util) {
 			min_cpu = cpu;
@@ -49,24 +146,35 @@ int band_play_cpu(struct task_struct *p)
 		}
 	}
 
+	if (cpu_selected(min_cpu))
+		WRITE_ONCE(band->last_cpu, min_cpu);
+
 	return min_cpu;
 }
 
 static void pick_playable_cpus(struct task_band *band)
 {
+	unsigned long util = band->util;
+
 	cpumask_clear(&band->playable_cpus);
 
+	/*
+	 * A latency sensitive band is placed by the larger of its current and
+	 * predicted utilization, so that the cluster is chosen before the next
+	 * burst instead of after it.
+	 */
+	if (band_latency_sensitive(band))
+		util = max(util, band_predicted_util(band));
+
 	/* pick condition should be fixed */
-	if (band->util < 442) // LIT up-threshold * 2
+	if (util < 442) // LIT up-threshold * 2
 		cpumask_and(&band->playable_cpus, cpu_online_mask, cpu_coregroup_mask(0));
-	else if (band->util < 1260) // MED up-threshold * 2
+	else if (util < 1260) // MED up-threshold * 2
 		cpumask_and(&band->playable_cpus, cpu_online_mask, cpu_coregroup_mask(4));
 	else
 		cpumask_and(&band->playable_cpus, cpu_online_mask, cpu_coregroup_mask(6));
 }
 
-static unsigned long out_of_time = 100000000;	/* 100ms */
-
 /* This function should be called protected with band->lock */
 static void __update_band(struct task_band *band, unsigned long now)
 {
@@ -189,6 +297,10 @@ static void leave_band(struct task_struct *p)
 	if (list_empty(&band->members)) {
 		band->tgid = -1;
 		cpumask_clear(&band->playable_cpus);
+		band->last_wakeup = 0;
+		band->wakeup_interval = 0;
+		band->runtime = 0;
+		band->last_cpu = -1;
 	}
 
 	__update_band(band, cpu_rq(0)->clock_task);
@@ -251,6 +363,7 @@ int alloc_bands(void)
 		INIT_LIST_HEAD(&band->members);
 		band->member_count = 0;
 		cpumask_clear(&band->playable_cpus);
+		band->last_cpu = -1;
 
 		bands[pos] = band;
 	}
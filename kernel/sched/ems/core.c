@@ -224,6 +224,7 @@ int exynos_wakeup_balance(struct task_struct *p, int prev_cpu, int sd_flag, int
 		sync_entity_load_avg(&p->se);
 		/* update the band if a large amount of task util is decayed */
 		update_band(p, old_util);
+		band_wakeup(p);
 	}
 
 	target_cpu = select_service_cpu(p);
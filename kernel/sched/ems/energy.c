@@ -33,9 +33,48 @@ struct energy_table {
 
 	struct energy_state *states;
 	unsigned int nr_states;
+
+	struct energy_cache __rcu *cache;
 };
 DEFINE_PER_CPU(struct energy_table, energy_table);
 
+/*
+ * Finding the capacity state for a given utilization walks the energy table
+ * on every candidate of every wakeup, and normalizing the utilization costs a
+ * division per cpu. The energy cache keeps, per frequency domain, the first
+ * state that can hold each quantized utilization and the power cost of one
+ * unit of capacity at each state, so calculate_energy() only needs a lookup
+ * and a multiplication. It is rebuilt whenever the capacity table or the
+ * cpufreq policy of the domain changes.
+ */
+#define ENERGY_UTIL_SHIFT	4
+#define ENERGY_UTIL_BUCKETS	((SCHED_CAPACITY_SCALE >> ENERGY_UTIL_SHIFT) + 1)
+
+struct energy_cache {
+	struct rcu_head rcu;
+
+	/* highest state allowed by policy->max */
+	unsigned int max_idx;
+	/* first state whose capacity covers the bucket */
+	unsigned short cap_idx[ENERGY_UTIL_BUCKETS];
+	/* power << SCHED_CAPACITY_SHIFT / capacity, per state */
+	unsigned long cost[0];
+};
+
+static int find_cap_idx(struct energy_table *table,
+			struct energy_cache *cache, unsigned long util)
+{
+	unsigned int bucket = min_t(unsigned long, util >> ENERGY_UTIL_SHIFT,
+					ENERGY_UTIL_BUCKETS - 1);
+	int idx = cache->cap_idx[bucket];
+
+	/* a bucket spans several utilization values, finish the search */
+	while (idx < cache->max_idx && table->states[idx].cap < util)
+		idx++;
+
+	return idx;
+}
+
 inline unsigned int get_cpu_mips(unsigned int cpu)
 {
 	return per_cpu(energy_table, cpu).mips;
@@ -79,8 +118,10 @@ unsigned int calculate_energy(struct task_struct *p, int target_cpu)
 			util[cpu] += task_util_est(p);
 	}
 
+	rcu_read_lock();
 	for_each_cpu(cpu, cpu_active_mask) {
 		struct energy_table *table;
+		struct energy_cache *cache;
 		unsigned long max_util = 0, util_sum = 0;
 		unsigned long capacity;
 		int i, cap_idx;
@@ -104,14 +145,19 @@ unsigned int calculate_energy(struct task_struct *p, int target_cpu)
 		 *    coregroup.
 		 */
 		table = &per_cpu(energy_table, cpu);
-		cap_idx = table->nr_states - 1;
-		for (i = 0; i < table->nr_states; i++) {
-			if (table->states[i].cap >= max_util) {
-				capacity = table->states[i].cap;
-				cap_idx = i;
-				break;
+		cache = rcu_dereference(table->cache);
+		if (likely(cache)) {
+			cap_idx = find_cap_idx(table, cache, max_util);
+		} else {
+			cap_idx = table->nr_states - 1;
+			for (i = 0; i < table->nr_states; i++) {
+				if (table->states[i].cap >= max_util) {
+					cap_idx = i;
+					break;
+				}
 			}
 		}
+		capacity = table->states[cap_idx].cap;
 
 		/*
 		 * 3. Get the utilization sum of coregroup. Since cpu
@@ -126,6 +172,12 @@ unsigned int calculate_energy(struct task_struct *p, int target_cpu)
 			if (i == target_cpu)
 				util[i] += task_util_est(p);
 
+			if (likely(cache)) {
+				/* normalized by the cached cost per capacity */
+				util_sum += min(util[i], capacity);
+				continue;
+			}
+
 			/* utilization with task exceeds max capacity of cpu */
 			if (util[i] >= capacity) {
 				util_sum += SCHED_CAPACITY_SCALE;
@@ -139,8 +191,12 @@ unsigned int calculate_energy(struct task_struct *p, int target_cpu)
 		/*
 		 * 4. compute active energy
 		 */
-		total_energy += util_sum * table->states[cap_idx].power;
+		if (likely(cache))
+			total_energy += util_sum * cache->cost[cap_idx];
+		else
+			total_energy += util_sum * table->states[cap_idx].power;
 	}
+	rcu_read_unlock();
 
 	return total_energy;
 }
@@ -349,6 +405,57 @@ static void show_energy_table(struct energy_table *table, int cpu)
 	}
 }
 
+static DEFINE_MUTEX(energy_cache_lock);
+
+/*
+ * Rebuild the energy cache of a cpu. States above max_freq cannot be
+ * reached under the current policy, so they are left out of the cache.
+ * max_freq of 0 means that the policy is not known yet.
+ */
+static void update_energy_cache(int cpu, unsigned long max_freq)
+{
+	struct energy_table *table = &per_cpu(energy_table, cpu);
+	struct energy_cache *cache, *old;
+	int i, b, idx;
+
+	if (!table->states)
+		return;
+
+	cache = kzalloc(sizeof(struct energy_cache) +
+			table->nr_states * sizeof(unsigned long), GFP_KERNEL);
+	if (unlikely(!cache))
+		return;
+
+	cache->max_idx = table->nr_states - 1;
+	if (max_freq) {
+		while (cache->max_idx > 0 &&
+		       table->states[cache->max_idx].frequency > max_freq)
+			cache->max_idx--;
+	}
+
+	for (i = 0; i < table->nr_states; i++) {
+		unsigned long cap = max_t(unsigned long, table->states[i].cap, 1);
+
+		cache->cost[i] = (table->states[i].power << SCHED_CAPACITY_SHIFT) / cap;
+	}
+
+	for (b = 0, idx = 0; b < ENERGY_UTIL_BUCKETS; b++) {
+		while (idx < cache->max_idx &&
+		       table->states[idx].cap < (b << ENERGY_UTIL_SHIFT))
+			idx++;
+		cache->cap_idx[b] = idx;
+	}
+
+	mutex_lock(&energy_cache_lock);
+	old = rcu_dereference_protected(table->cache,
+				lockdep_is_held(&energy_cache_lock));
+	rcu_assign_pointer(table->cache, cache);
+	mutex_unlock(&energy_cache_lock);
+
+	if (old)
+		kfree_rcu(old, rcu);
+}
+
 /*
  * Store the original capacity to update the cpu capacity according to the
  * max frequency of cpufreq.
@@ -377,6 +484,9 @@ static int sched_cpufreq_policy_callback(struct notifier_block *nb,
 		cpu_scale = per_cpu(cpu_orig_scale, cpu) * max_scale;
 		cpu_scale = cpu_scale >> SCHED_CAPACITY_SHIFT;
 		topology_set_cpu_scale(cpu, cpu_scale);
+
+		/* the reachable states changed, rebuild the energy cache */
+		update_energy_cache(cpu, policy->max);
 	}
 
 	return NOTIFY_OK;
@@ -477,6 +587,7 @@ void init_sched_energy_table(struct cpumask *cpus, int table_size,
 
 		fill_cap_table(table, max_mips, max_mips_freq);
 		show_energy_table(table, cpu);
+		update_energy_cache(cpu, cpufreq_quick_get_max(cpu));
 
 		last_state = table->nr_states - 1;
 		per_cpu(cpu_orig_scale, cpu) = table->states[last_state].cap;
@@ -66,16 +66,86 @@ static inline struct sched_entity *se_of(struct sched_avg *sa)
 	return container_of(sa, struct sched_entity, avg);
 }
 
+/*
+ * The ontime load of a task is sampled into a small ring at the end of each
+ * window of ONTIME_HIST_PERIODS pelt periods (~4ms, a tick at HZ=250). The
+ * ring gives a trend to anticipate a rising load and a recent peak to avoid
+ * sending a bursty task back to little cpus between its bursts.
+ */
+#define ONTIME_HIST_PERIODS	4
+
+static void ontime_update_hist(struct ontime_avg *oa, u64 periods)
+{
+	u16 load = min_t(unsigned long, oa->load_avg, U16_MAX);
+	u64 windows = periods + oa->hist_periods;
+
+	/* windows ended since the last update, periods left in the current one */
+	oa->hist_periods = do_div(windows, ONTIME_HIST_PERIODS);
+
+	/*
+	 * Every window that ended gets the decayed load, so a long sleep
+	 * doesn't leave pre-sleep samples behind.
+	 */
+	windows = min_t(u64, windows, ONTIME_HIST_SIZE);
+	while (windows--) {
+		oa->hist[oa->hist_idx] = load;
+		oa->hist_idx = (oa->hist_idx + 1) % ONTIME_HIST_SIZE;
+	}
+}
+
+/* Average load change per window over the history */
+static long ontime_trend(struct ontime_avg *oa)
+{
+	long oldest = oa->hist[oa->hist_idx];
+	long newest = oa->hist[(oa->hist_idx + ONTIME_HIST_SIZE - 1) % ONTIME_HIST_SIZE];
+
+	return (newest - oldest) / (ONTIME_HIST_SIZE - 1);
+}
+
+/* Load expected at the end of the next window, if the load is rising */
+static unsigned long ontime_predict_load(struct ontime_avg *oa)
+{
+	long trend = ontime_trend(oa);
+
+	if (trend <= 0)
+		return oa->load_avg;
+
+	return oa->load_avg + trend;
+}
+
+static unsigned long ontime_peak_load(struct ontime_avg *oa)
+{
+	unsigned long peak = oa->load_avg;
+	int i;
+
+	for (i = 0; i < ONTIME_HIST_SIZE; i++)
+		peak = max_t(unsigned long, peak, oa->hist[i]);
+
+	return peak;
+}
+
 extern long schedtune_margin(unsigned long signal, long boost);
-static inline unsigned long ontime_load_avg(struct task_struct *p)
+static inline unsigned long ontime_boost_load(struct task_struct *p,
+						unsigned long load)
 {
 	int boost = schedtune_task_boost(p);
-	unsigned long load_avg = ontime_of(p)->avg.load_avg;
 
 	if (boost == 0)
-		return load_avg;
+		return load;
+
+	return load + schedtune_margin(load, boost);
+}
 
-	return load_avg + schedtune_margin(load_avg, boost);
+/* Load compared against upper_boundary to decide upmigration */
+static inline unsigned long ontime_up_load(struct task_struct *p)
+{
+	return ontime_boost_load(p, ontime_predict_load(&ontime_of(p)->avg));
+}
+
+/* Load compared against lower_boundary to decide downmigration */
+static inline unsigned long ontime_down_load(struct task_struct *p)
+{
+	return ontime_boost_load(p, ontime_peak_load(&ontime_of(p)->avg));
 }
 
 struct ontime_cond *get_current_cond(int cpu)
@@ -140,7 +210,7 @@ ontime_select_fit_cpus(struct task_struct *p, struct cpumask *fit_cpus)
 
 	cpumask_clear(fit_cpus);
 
-	if (ontime_load_avg(p) >= curr->upper_boundary) {
+	if (ontime_up_load(p) >= curr->upper_boundary) {
 		/*
 		 * If task's load is above upper boundary of source,
 		 * find fit_cpus that have higher mips than source.
@@ -151,7 +221,7 @@ ontime_select_fit_cpus(struct task_struct *p, struct cpumask *fit_cpus)
 			if (is_faster_than(src_cpu, dst_cpu))
 				cpumask_or(fit_cpus, fit_cpus, &curr->cpus);
 		}
-	} else if (ontime_load_avg(p) >= curr->lower_boundary) {
+	} else if (ontime_down_load(p) >= curr->lower_boundary) {
 		/*
 		 * If task's load is between upper boundary and lower boundary of source,
 		 * fit cpus is the coregroup of source.
@@ -290,9 +360,9 @@ ontime_pick_heavy_task(struct sched_entity *se, int *boost_migration)
 		return p;
 	}
 	if (schedtune_ontime_en(p)) {
-		if (ontime_load_avg(p) >= get_upper_boundary(task_cpu(p))) {
+		if (ontime_up_load(p) >= get_upper_boundary(task_cpu(p))) {
 			heaviest_task = p;
-			max_util_avg = ontime_load_avg(p);
+			max_util_avg = ontime_up_load(p);
 			*boost_migration = 0;
 		}
 	}
@@ -313,12 +383,12 @@ ontime_pick_heavy_task(struct sched_entity *se, int *boost_migration)
 		if (!schedtune_ontime_en(p))
 			goto next_entity;
 
-		if (ontime_load_avg(p) < get_upper_boundary(task_cpu(p)))
+		if (ontime_up_load(p) < get_upper_boundary(task_cpu(p)))
 			goto next_entity;
 
-		if (ontime_load_avg(p) > max_util_avg) {
+		if (ontime_up_load(p) > max_util_avg) {
 			heaviest_task = p;
-			max_util_avg = ontime_load_avg(p);
+			max_util_avg = ontime_up_load(p);
 			*boost_migration = 0;
 		}
 
@@ -435,7 +505,7 @@ static void ontime_update_next_balance(int cpu, struct ontime_avg *oa)
 	if (cpumask_test_cpu(cpu, cpu_coregroup_mask(MAX_CAPACITY_CPU)))
 		return;
 
-	if (oa->load_avg < get_upper_boundary(cpu))
+	if (ontime_predict_load(oa) < get_upper_boundary(cpu))
 		return;
 
 	/*
@@ -644,8 +714,10 @@ int ontime_can_migration(struct task_struct *p, int dst_cpu)
 
 	/*
 	 * At this point, load balancer is trying to migrate task to smaller CPU.
+	 * The task is light only if it stayed below lower boundary over its
+	 * recent history, otherwise it would bounce back at its next burst.
 	 */
-	if (ontime_load_avg(p) < get_lower_boundary(src_cpu)) {
+	if (ontime_down_load(p) < get_lower_boundary(src_cpu)) {
 		trace_ems_ontime_check_migrate(p, dst_cpu, true, "light task");
 		return true;
 	}
@@ -710,12 +782,14 @@ void ontime_update_load_avg(u64 delta, int cpu, unsigned long weight, struct sch
 		return;
 
 	oa->load_avg = div_u64(oa->load_sum, LOAD_AVG_MAX - 1024 + oa->period_contrib);
+	ontime_update_hist(oa, periods);
 	ontime_update_next_balance(cpu, oa);
 }
 
 void ontime_new_entity_load(struct task_struct *parent, struct sched_entity *se)
 {
 	struct ontime_entity *ontime;
+	int i;
 
 	if (entity_is_cfs_rq(se))
 		return;
@@ -725,6 +799,10 @@ void ontime_new_entity_load(struct task_struct *parent, struct sched_entity *se)
 	ontime->avg.load_sum = ontime_of(parent)->avg.load_sum >> 1;
 	ontime->avg.load_avg = ontime_of(parent)->avg.load_avg >> 1;
 	ontime->avg.period_contrib = 1023;
+	for (i = 0; i < ONTIME_HIST_SIZE; i++)
+		ontime->avg.hist[i] = ontime->avg.load_avg;
+	ontime->avg.hist_idx = 0;
+	ontime->avg.hist_periods = 0;
 	ontime->migrating = 0;
 
 	trace_ems_ontime_new_entity_load(task_of(se), &ontime->avg);
@@ -154,6 +154,9 @@ cond_syscall(sys_io_getevents);
 cond_syscall(compat_sys_io_setup);
 cond_syscall(compat_sys_io_submit);
 cond_syscall(compat_sys_io_getevents);
+cond_syscall(sys_io_uring_setup);
+cond_syscall(sys_io_uring_enter);
+cond_syscall(sys_io_uring_register);
 cond_syscall(sys_sysfs);
 cond_syscall(sys_syslog);
 cond_syscall(sys_process_vm_readv);
@@ -335,6 +335,7 @@ static int max_sched_tunable_scaling = SCHED_TUNABLESCALING_END-1;
 #ifdef CONFIG_COMPACTION
 static int min_extfrag_threshold;
 static int max_extfrag_threshold = 1000;
+static int max_compaction_threads = COMPACT_MAX_THREADS;
 #endif
 
 static struct ctl_table kern_table[] = {
@@ -1533,6 +1534,15 @@ static struct ctl_table vm_table[] = {
 		.extra1		= &zero,
 		.extra2		= &one,
 	},
+	{
+		.procname	= "compaction_threads",
+		.data		= &sysctl_compaction_threads,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &one,
+		.extra2		= &max_compaction_threads,
+	},
 
 #endif /* CONFIG_COMPACTION */
 	{
@@ -23,6 +23,7 @@
 #include <linux/freezer.h>
 #include <linux/page_owner.h>
 #include <linux/psi.h>
+#include <linux/workqueue.h>
 #include "internal.h"
 
 #ifdef CONFIG_COMPACTION
@@ -1503,12 +1504,17 @@ bool compaction_zonelist_suitable(struct alloc_context *ac, int order,
 	return false;
 }
 
-static enum compact_result compact_zone(struct zone *zone, struct compact_control *cc)
+static enum compact_result __compact_zone(struct zone *zone,
+					  struct compact_control *cc);
+
+/*
+ * Reset the counters of @cc and check whether compaction should run on
+ * @zone at all. Returns COMPACT_CONTINUE if it should.
+ */
+static enum compact_result compact_zone_prepare(struct zone *zone,
+						struct compact_control *cc)
 {
 	enum compact_result ret;
-	unsigned long start_pfn = zone->zone_start_pfn;
-	unsigned long end_pfn = zone_end_pfn(zone);
-	const bool sync = cc->mode != MIGRATE_ASYNC;
 
 	/*
 	 * These counters track activities during zone compaction.  Initialize
@@ -1538,6 +1544,20 @@ static enum compact_result compact_zone(struct zone *zone, struct compact_contro
 	if (compaction_restarting(zone, cc->order))
 		__reset_isolation_suitable(zone);
 
+	return COMPACT_CONTINUE;
+}
+
+static enum compact_result compact_zone(struct zone *zone, struct compact_control *cc)
+{
+	enum compact_result ret;
+	unsigned long start_pfn = zone->zone_start_pfn;
+	unsigned long end_pfn = zone_end_pfn(zone);
+	const bool sync = cc->mode != MIGRATE_ASYNC;
+
+	ret = compact_zone_prepare(zone, cc);
+	if (ret != COMPACT_CONTINUE)
+		return ret;
+
 	/*
 	 * Setup to move all movable pages to the end of the zone. Used cached
 	 * information on where the scanners should start (unless we explicitly
@@ -1564,6 +1584,21 @@ static enum compact_result compact_zone(struct zone *zone, struct compact_contro
 			cc->whole_zone = true;
 	}
 
+	return __compact_zone(zone, cc);
+}
+
+/*
+ * Run the migrate and free scanners from cc->migrate_pfn and cc->free_pfn
+ * until they meet or compaction is finished.
+ */
+static enum compact_result __compact_zone(struct zone *zone,
+					  struct compact_control *cc)
+{
+	enum compact_result ret;
+	unsigned long start_pfn = zone->zone_start_pfn;
+	unsigned long end_pfn = zone_end_pfn(zone);
+	const bool sync = cc->mode != MIGRATE_ASYNC;
+
 	cc->last_migrated_pfn = 0;
 
 	trace_mm_compaction_begin(start_pfn, cc->migrate_pfn,
@@ -1705,6 +1740,128 @@ static enum compact_result compact_zone_order(struct zone *zone, int order,
 	return ret;
 }
 
+/*
+ * The number of threads compacting a zone for kcompactd and for
+ * /proc/sys/vm/compact_memory. With more than one, the zone is split into
+ * pfn ranges that are compacted concurrently, each with its own migrate
+ * and free scanner. Direct compaction always uses a single thread.
+ */
+int sysctl_compaction_threads = 1;
+
+/* Don't split a zone into ranges smaller than this */
+#define COMPACT_MIN_RANGE_PAGES	(16 * pageblock_nr_pages)
+
+struct compact_range {
+	struct work_struct work;
+	const struct compact_control *parent;
+	unsigned long start_pfn;
+	unsigned long end_pfn;
+	unsigned long migrate_scanned;
+	unsigned long free_scanned;
+	enum compact_result result;
+};
+
+static void compact_range(struct compact_range *cr)
+{
+	const struct compact_control *parent = cr->parent;
+	struct compact_control cc = {
+		.zone = parent->zone,
+		.order = parent->order,
+		.gfp_mask = parent->gfp_mask,
+		.migratetype = parent->migratetype,
+		.alloc_flags = parent->alloc_flags,
+		.classzone_idx = parent->classzone_idx,
+		.mode = parent->mode,
+		.ignore_skip_hint = parent->ignore_skip_hint,
+		.ignore_block_suitable = parent->ignore_block_suitable,
+		.direct_compaction = parent->direct_compaction,
+		.whole_zone = true,
+		.migrate_pfn = cr->start_pfn,
+		.free_pfn = pageblock_start_pfn(cr->end_pfn - 1),
+	};
+
+	INIT_LIST_HEAD(&cc.freepages);
+	INIT_LIST_HEAD(&cc.migratepages);
+
+	cr->result = __compact_zone(cc.zone, &cc);
+	cr->migrate_scanned = cc.total_migrate_scanned;
+	cr->free_scanned = cc.total_free_scanned;
+
+	VM_BUG_ON(!list_empty(&cc.freepages));
+	VM_BUG_ON(!list_empty(&cc.migratepages));
+}
+
+static void compact_range_work(struct work_struct *work)
+{
+	compact_range(container_of(work, struct compact_range, work));
+}
+
+/*
+ * compact_zone() using up to sysctl_compaction_threads threads. The ranges
+ * always cover the whole zone and ignore the cached scanner positions, so
+ * this is only meant for callers that ignore the pageblock skip hints.
+ */
+static enum compact_result compact_zone_parallel(struct zone *zone,
+						 struct compact_control *cc)
+{
+	struct compact_range ranges[COMPACT_MAX_THREADS];
+	unsigned long start_pfn = zone->zone_start_pfn;
+	unsigned long end_pfn = zone_end_pfn(zone);
+	unsigned long span;
+	unsigned int nr, i;
+	enum compact_result ret;
+
+	VM_BUG_ON(!cc->ignore_skip_hint);
+
+	nr = clamp(READ_ONCE(sysctl_compaction_threads), 1, COMPACT_MAX_THREADS);
+	nr = min_t(unsigned long, nr,
+		   (end_pfn - start_pfn) / COMPACT_MIN_RANGE_PAGES);
+	if (nr < 2)
+		return compact_zone(zone, cc);
+
+	ret = compact_zone_prepare(zone, cc);
+	if (ret != COMPACT_CONTINUE)
+		return ret;
+
+	/* every range but the last one ends on a pageblock boundary */
+	span = (end_pfn - start_pfn) / nr;
+	for (i = 0; i < nr; i++) {
+		struct compact_range *cr = &ranges[i];
+
+		cr->parent = cc;
+		cr->start_pfn = i ? ranges[i - 1].end_pfn : start_pfn;
+		cr->end_pfn = (i == nr - 1) ? end_pfn :
+			pageblock_start_pfn(start_pfn + (i + 1) * span);
+		if (!i)
+			continue;
+
+		INIT_WORK_ONSTACK(&cr->work, compact_range_work);
+		queue_work(system_unbound_wq, &cr->work);
+	}
+
+	/* the first range is compacted by the caller itself */
+	compact_range(&ranges[0]);
+
+	/*
+	 * COMPACT_SUCCESS from any range means the allocation should succeed,
+	 * and a contended range is worse than a complete one.
+	 */
+	ret = ranges[0].result;
+	cc->total_migrate_scanned = ranges[0].migrate_scanned;
+	cc->total_free_scanned = ranges[0].free_scanned;
+	for (i = 1; i < nr; i++) {
+		struct compact_range *cr = &ranges[i];
+
+		flush_work(&cr->work);
+		destroy_work_on_stack(&cr->work);
+		ret = max(ret, cr->result);
+		cc->total_migrate_scanned += cr->migrate_scanned;
+		cc->total_free_scanned += cr->free_scanned;
+	}
+
+	return ret;
+}
+
 int sysctl_extfrag_threshold = 500;
 
 /**
@@ -1809,7 +1966,7 @@ static void compact_node(int nid)
 
 		cc.zone = zone;
 
-		compact_zone(zone, &cc);
+		compact_zone_parallel(zone, &cc);
 
 		VM_BUG_ON(!list_empty(&cc.freepages));
 		VM_BUG_ON(!list_empty(&cc.migratepages));
@@ -1944,7 +2101,7 @@ static void kcompactd_do_work(pg_data_t *pgdat)
 			return;
 
 		cc.zone = zone;
-		status = compact_zone(zone, &cc);
+		status = compact_zone_parallel(zone, &cc);
 
 		if (status == COMPACT_SUCCESS) {
 			compaction_defer_reset(zone, cc.order, false);
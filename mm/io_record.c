@@ -26,7 +26,14 @@
 #include <linux/cleancache.h>
 #include <linux/rmap.h>
 #include <linux/module.h>
+#include <linux/percpu.h>
+#include <linux/rcupdate.h>
+#include <linux/proc_fs.h>
+#include <linux/workqueue.h>
+#include <linux/exportfs.h>
+#include <linux/kdev_t.h>
 #include <linux/io_record.h>
+#include <asm/unaligned.h>
 #include "internal.h"
 
 struct io_info {
@@ -37,21 +44,66 @@ struct io_info {
 };
 
 #define NUM_IO_INFO_IN_BUF (128 * 1024) /* # of struct io_info */
+#define NUM_IO_INFO_PER_CPU (16 * 1024) /* # of struct io_info per cpu */
 #define RESULT_BUF_SIZE_IN_BYTES (5 * 1024 * 1024) /* 5MB */
 #define RESULT_BUF_END_MAGIC (~0) /* -1 */
 
-struct io_info *record_buf; /* array of struct io_info */
+/*
+ * Records are appended to a per-cpu buffer with preemption disabled, so the
+ * recording path takes no lock and shares no cacheline with other cpus.
+ * Once recording is stopped, the per-cpu buffers are merged into record_buf
+ * by post_processing_records().
+ */
+struct io_record_pcpu {
+	struct io_info *buf;	/* array of NUM_IO_INFO_PER_CPU entries */
+	int head;		/* # of valid entries in buf */
+};
+
+static DEFINE_PER_CPU(struct io_record_pcpu, io_record_pcpu);
+
+struct io_info *record_buf; /* merged array of struct io_info */
+int record_buf_cnt; /* # of merged entries in record_buf */
 void *result_buf; /* buffer used for post processing result */
 
 /*
- * format in result buf per file:
+ * format in result buf per file (IO_RECORD_FORMAT_PATH):
  * <A = length of "path", (size = sizeof(int))>
  * <"path" string, (size = A)>
  * <tuple array, (size = B * sizeof(int) * 2>
  * <end MAGIC, (val = -1, size = sizeof(int) * 2>
+ * and the end MAGIC of the result (val = -1, size = sizeof(int)).
+ *
+ * compact format (IO_RECORD_FORMAT_COMPACT):
+ * <struct io_record_compact_hdr>
+ * per file, all fields are unsigned LEB128 varints:
+ * <dev> <ino> <generation> <B = # of ranges>
+ * <B * (offset delta from the end of the previous range, nr_pages)>
+ * Files are identified by (dev, ino, generation) and resolved through the
+ * export operations of their filesystem on replay.
  */
 #define MAX_FILEPATH_LEN 256
 
+enum io_record_format {
+	IO_RECORD_FORMAT_PATH = 0,
+	IO_RECORD_FORMAT_COMPACT = 1,
+};
+
+#define IO_RECORD_COMPACT_MAGIC 0x43524f49 /* "IORC" */
+#define IO_RECORD_COMPACT_VERSION 1
+#define MAX_VARINT_LEN 10 /* for u64 */
+
+struct io_record_compact_hdr {
+	__le32 magic;
+	__le16 version;
+	__le16 reserved;
+	__le32 nr_files;
+};
+
+/* format of the next post processing, latched in result_format */
+static int io_record_format = IO_RECORD_FORMAT_PATH;
+module_param_named(format, io_record_format, int, 0644);
+static int result_format;
+
 /* return bytes written to the path. if buffer full, return < 0 */
 void *result_buf_cursor; /* this is touched by post processing only */
 void write_to_result_buf(void *src, int size)
@@ -60,24 +112,85 @@ void write_to_result_buf(void *src, int size)
 	result_buf_cursor = result_buf_cursor + size;
 }
 
+static void write_varint_to_result_buf(u64 val)
+{
+	u8 *p = result_buf_cursor;
+
+	while (val >= 0x80) {
+		*p++ = (val & 0x7f) | 0x80;
+		val >>= 7;
+	}
+	*p++ = val;
+	result_buf_cursor = p;
+}
+
+typedef void (*emit_range_fn)(int offset, int nr_pages, void *priv);
+
+/*
+ * Merge overlapping and adjacent records of start_idx~end_idx, which are
+ * sorted by offset, and emit each merged range if @emit is given.
+ * Return # of merged ranges.
+ */
+static int merge_ranges(int start_idx, int end_idx, emit_range_fn emit,
+			void *priv)
+{
+	int prev_offset = record_buf[start_idx].offset;
+	int max_size = record_buf[start_idx].nr_pages;
+	int nr_ranges = 0;
+	int i;
+
+	for (i = start_idx + 1; i < end_idx; i++) {
+		/* in the last range */
+		if ((prev_offset + max_size) >=
+		    (record_buf[i].offset + record_buf[i].nr_pages))
+			continue;
+
+		if ((prev_offset + max_size) >= record_buf[i].offset) {
+			max_size = (record_buf[i].offset +
+				   record_buf[i].nr_pages) - prev_offset;
+		} else {
+			if (emit)
+				emit(prev_offset, max_size, priv);
+			nr_ranges++;
+			prev_offset = record_buf[i].offset;
+			max_size = record_buf[i].nr_pages;
+		}
+	}
+	if (emit)
+		emit(prev_offset, max_size, priv);
+
+	return nr_ranges + 1;
+}
+
+static void emit_tuple(int offset, int nr_pages, void *priv)
+{
+	write_to_result_buf(&offset, sizeof(int));
+	write_to_result_buf(&nr_pages, sizeof(int));
+}
+
+/* priv points to the end offset of the previous range */
+static void emit_delta(int offset, int nr_pages, void *priv)
+{
+	int *prev_end = priv;
+
+	write_varint_to_result_buf(offset - *prev_end);
+	write_varint_to_result_buf(nr_pages);
+	*prev_end = offset + nr_pages;
+}
+
 /* this assumes that start_idx~end_idx belong to the same inode */
-int fill_result_buf(int start_idx, int end_idx)
+static int fill_result_buf_path(int start_idx, int end_idx)
 {
 	int ret = 0;
-	int i;
 	int size_expected;
 	char strbuf[MAX_FILEPATH_LEN];
 	char *path;
 	int pathsize;
 	int result_buf_used;
-	int prev_offset = -1;
-	int long max_size = 0;
+	int end_magic = RESULT_BUF_END_MAGIC;
 	void *buf_start;
 	struct file *file;
 
-	if (start_idx >= end_idx)
-		BUG_ON(1); /* this case is not in consideration */
-
 	file = record_buf[start_idx].file;
 	path = d_path(&file->f_path, strbuf, MAX_FILEPATH_LEN);
 	if (!path || IS_ERR(path))
@@ -98,40 +211,11 @@ int fill_result_buf(int start_idx, int end_idx)
 	write_to_result_buf(path, pathsize);
 
 	/* fill the result buf using the record buf */
-	for (i = start_idx; i < end_idx; i++) {
-		if (prev_offset == -1) {
-			prev_offset = record_buf[i].offset;
-			max_size = record_buf[i].nr_pages;
-			continue;
-		}
-		/* in the last range */
-		if ((prev_offset + max_size) >=
-		    (record_buf[i].offset + record_buf[i].nr_pages)) {
-			continue;
-		} else {
-			if ((prev_offset + max_size) >= record_buf[i].offset) {
-				max_size = (record_buf[i].offset +
-					   record_buf[i].nr_pages) -
-					   prev_offset;
-			} else {
-				write_to_result_buf(&prev_offset,
-						    sizeof(int));
-				write_to_result_buf(&max_size,
-						    sizeof(int));
-				prev_offset = record_buf[i].offset;
-				max_size = record_buf[i].nr_pages;
-			}
-		}
-	}
-	/* fill the record buf */
-	write_to_result_buf(&prev_offset, sizeof(int));
-	write_to_result_buf(&max_size, sizeof(int));
+	merge_ranges(start_idx, end_idx, emit_tuple, NULL);
 
 	/* fill the record buf with final magic */
-	prev_offset = RESULT_BUF_END_MAGIC;
-	max_size = RESULT_BUF_END_MAGIC;
-	write_to_result_buf(&prev_offset, sizeof(int));
-	write_to_result_buf(&max_size, sizeof(int));
+	write_to_result_buf(&end_magic, sizeof(int));
+	write_to_result_buf(&end_magic, sizeof(int));
 
 	/* return # of bytes written to result buf */
 	ret = result_buf_cursor - buf_start;
@@ -139,34 +223,98 @@ int fill_result_buf(int start_idx, int end_idx)
 	return ret;
 }
 
-/* idx record_buf_cursor of the array (record_buf) */
-static atomic_t record_buf_cursor = ATOMIC_INIT(-1);
+/* this assumes that start_idx~end_idx belong to the same inode */
+static int fill_result_buf_compact(int start_idx, int end_idx)
+{
+	struct inode *inode = record_buf[start_idx].inode;
+	struct io_record_compact_hdr *hdr = result_buf;
+	int nr_ranges, size_expected, result_buf_used;
+	int prev_end = 0;
+	void *buf_start;
+
+	nr_ranges = merge_ranges(start_idx, end_idx, NULL, NULL);
+
+	/* max size check */
+	result_buf_used = result_buf_cursor - result_buf;
+	size_expected = MAX_VARINT_LEN * 4 +                  /* file identifier */
+			MAX_VARINT_LEN * 2 * nr_ranges;       /* data */
+	if (size_expected > (RESULT_BUF_SIZE_IN_BYTES - result_buf_used))
+		return -EINVAL;
+
+	buf_start = result_buf_cursor;
+	write_varint_to_result_buf(new_encode_dev(inode->i_sb->s_dev));
+	write_varint_to_result_buf(inode->i_ino);
+	write_varint_to_result_buf(inode->i_generation);
+	write_varint_to_result_buf(nr_ranges);
+	merge_ranges(start_idx, end_idx, emit_delta, &prev_end);
+
+	le32_add_cpu(&hdr->nr_files, 1);
+
+	return result_buf_cursor - buf_start;
+}
+
+int fill_result_buf(int start_idx, int end_idx)
+{
+	if (start_idx >= end_idx)
+		BUG_ON(1); /* this case is not in consideration */
+
+	if (result_format == IO_RECORD_FORMAT_COMPACT)
+		return fill_result_buf_compact(start_idx, end_idx);
+	return fill_result_buf_path(start_idx, end_idx);
+}
+
+static void start_result_buf(void)
+{
+	struct io_record_compact_hdr hdr;
+
+	result_format = READ_ONCE(io_record_format);
+	if (result_format != IO_RECORD_FORMAT_COMPACT)
+		return;
+
+	hdr.magic = cpu_to_le32(IO_RECORD_COMPACT_MAGIC);
+	hdr.version = cpu_to_le16(IO_RECORD_COMPACT_VERSION);
+	hdr.reserved = 0;
+	hdr.nr_files = 0;
+	write_to_result_buf(&hdr, sizeof(hdr));
+}
+
+static void finish_result_buf(void)
+{
+	int last_magic = RESULT_BUF_END_MAGIC;
+
+	/* the compact header carries the # of files instead */
+	if (result_format == IO_RECORD_FORMAT_COMPACT)
+		return;
+
+	write_to_result_buf(&last_magic, sizeof(int));
+}
 
-static DEFINE_RWLOCK(record_rwlock);
 int record_target; /* pid # of group leader */
 bool record_enable;
 
 static DEFINE_MUTEX(status_lock);
 enum  io_record_cmd_types current_status = IO_RECORD_INIT;
 
+/*
+ * Writers run with preemption disabled, so after clearing record_enable,
+ * synchronize_sched() guarantees that no cpu is still appending to its
+ * per-cpu buffer.
+ */
 static inline void set_record_status(bool enable)
 {
-	write_lock(&record_rwlock);
-	record_enable = enable;
-	write_unlock(&record_rwlock);
+	WRITE_ONCE(record_enable, enable);
+	if (!enable)
+		synchronize_sched();
 }
 
-/* assume caller has read lock of record_rwlock */
 static inline bool __get_record_status(void)
 {
-	return record_enable;
+	return READ_ONCE(record_enable);
 }
 
 static inline void set_record_target(int pid)
 {
-	write_lock(&record_rwlock);
-	record_target = pid;
-	write_unlock(&record_rwlock);
+	WRITE_ONCE(record_target, pid);
 }
 
 void release_records(void);
@@ -179,7 +327,7 @@ static void change_current_status(enum io_record_cmd_types status)
 		set_record_status(false);
 		set_record_target(-1);
 		release_records();
-		atomic_set(&record_buf_cursor, 0);
+		record_buf_cnt = 0;
 		result_buf_cursor = result_buf;
 		break;
 	case IO_RECORD_START:
@@ -293,25 +441,46 @@ static int io_info_compare(const void *lhs, const void *rhs)
 	}
 }
 
+/* gather the per-cpu buffers into record_buf, assume recording is stopped */
+static void merge_records(void)
+{
+	struct io_record_pcpu *pcpu;
+	int cpu, cnt;
+
+	record_buf_cnt = 0;
+	for_each_possible_cpu(cpu) {
+		pcpu = per_cpu_ptr(&io_record_pcpu, cpu);
+		cnt = min(pcpu->head, NUM_IO_INFO_IN_BUF - record_buf_cnt);
+		if (cnt <= 0)
+			continue;
+		memcpy(record_buf + record_buf_cnt, pcpu->buf,
+		       sizeof(struct io_info) * cnt);
+		record_buf_cnt += cnt;
+	}
+}
+
 bool post_processing_records(void)
 {
 	bool ret = false;
 	int i;
 	struct inode *prev_inode = NULL;
 	int start_idx = -1, end_idx = -1;
-	int last_magic = RESULT_BUF_END_MAGIC;
 
 	mutex_lock(&status_lock);
 	if (!change_status_if_valid(IO_RECORD_POST_PROCESSING))
 		goto out;
 
-	/* From this point, we assume that no one touches record buf */
+	/* From this point, we assume that no one touches per-cpu buffers */
+	merge_records();
+
 	/* sort based on inode pointer address */
-	sort(record_buf, atomic_read(&record_buf_cursor),
+	sort(record_buf, record_buf_cnt,
 	     sizeof(struct io_info), &io_info_compare, &io_info_swap);
 
+	start_result_buf();
+
 	/* fill the result buf per inode */
-	for (i = 0; i < atomic_read(&record_buf_cursor); i++) {
+	for (i = 0; i < record_buf_cnt; i++) {
 		if (prev_inode != record_buf[i].inode) {
 			end_idx = i;
 			if (prev_inode && (fill_result_buf(start_idx,
@@ -326,8 +495,7 @@ bool post_processing_records(void)
 	if (start_idx != -1)
 		fill_result_buf(start_idx, i);
 
-	/* fill the last magic to indicate end of result */
-	write_to_result_buf(&last_magic, sizeof(int));
+	finish_result_buf();
 
 	if (!change_status_if_valid(IO_RECORD_POST_PROCESSING_DONE))
 		BUG_ON(1); /* this is the case not in consideration */
@@ -408,62 +576,493 @@ bool forced_init_record(void)
 void record_io_info(struct file *file, pgoff_t offset,
 		    unsigned long req_size)
 {
+	struct io_record_pcpu *pcpu;
 	struct io_info *info;
-	int cnt;
 
 	/* check without lock */
-	if ((int)task_tgid_nr(current) != record_target)
+	if ((int)task_tgid_nr(current) != READ_ONCE(record_target))
 		return;
 
 	if (offset >= INT_MAX || req_size >= INT_MAX)
 		return;
 
-	cnt = atomic_read(&record_buf_cursor);
-	if (cnt < 0 || cnt >= NUM_IO_INFO_IN_BUF || !file || req_size == 0)
+	if (!file || req_size == 0)
 		return;
 
-	if (!read_trylock(&record_rwlock))
-		return;
+	pcpu = get_cpu_ptr(&io_record_pcpu);
 
 	if (!__get_record_status())
 		goto out;
 
 	/* strict check */
-	if ((int)task_tgid_nr(current) != record_target)
+	if ((int)task_tgid_nr(current) != READ_ONCE(record_target))
 		goto out;
 
-	cnt = atomic_inc_return(&record_buf_cursor) - 1;
-
 	/* buffer is full */
-	if (cnt >= NUM_IO_INFO_IN_BUF) {
-		atomic_dec(&record_buf_cursor);
+	if (pcpu->head >= NUM_IO_INFO_PER_CPU)
 		goto out;
-	}
 
-	info = record_buf + cnt;
+	info = pcpu->buf + pcpu->head;
 
 	get_file(file); /* will be put in release_records */
 	info->file = file;
 	info->inode = file_inode(file);
 	info->offset = (int)offset;
 	info->nr_pages = (int)req_size;
+	pcpu->head++;
 out:
-	read_unlock(&record_rwlock);
+	put_cpu_ptr(&io_record_pcpu);
 }
 
+/* assume recording is stopped */
 void release_records(void)
 {
+	struct io_record_pcpu *pcpu;
+	int cpu, i;
+
+	for_each_possible_cpu(cpu) {
+		pcpu = per_cpu_ptr(&io_record_pcpu, cpu);
+		for (i = 0; i < pcpu->head; i++)
+			fput(pcpu->buf[i].file);
+		pcpu->head = 0;
+	}
+}
+
+static void free_pcpu_bufs(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		vfree(per_cpu_ptr(&io_record_pcpu, cpu)->buf);
+		per_cpu_ptr(&io_record_pcpu, cpu)->buf = NULL;
+	}
+}
+
+static int alloc_pcpu_bufs(void)
+{
+	struct io_record_pcpu *pcpu;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		pcpu = per_cpu_ptr(&io_record_pcpu, cpu);
+		pcpu->buf = vzalloc_node(sizeof(struct io_info) *
+					 NUM_IO_INFO_PER_CPU, cpu_to_node(cpu));
+		if (!pcpu->buf) {
+			free_pcpu_bufs();
+			return -ENOMEM;
+		}
+		pcpu->head = 0;
+	}
+	return 0;
+}
+
+/*
+ * Replay:
+ * A result blob produced by read_record(), in either format, can be written
+ * back to /proc/io_record_replay. Once the writer closes the file, the blob
+ * is parsed and one work item per file issues readahead over the recorded
+ * ranges from an unbound workqueue, with the block layer plugged per file.
+ * This lets the working set of an app be prefetched at device queue depth
+ * rather than with one fadvise() syscall per range from userspace.
+ */
+#define IO_REPLAY_MAX_ACTIVE 4
+#define IO_REPLAY_GAP_PAGES 8 /* merge ranges separated by a smaller hole */
+#define IO_REPLAY_CHUNK_PAGES ((2 * 1024 * 1024) / PAGE_SIZE)
+
+struct io_replay_range {
+	int offset;
+	int nr_pages;
+};
+
+struct io_replay_work {
+	struct work_struct work;
+	struct file *file;	/* IO_RECORD_FORMAT_PATH */
+	dev_t dev;		/* IO_RECORD_FORMAT_COMPACT */
+	u64 ino;
+	u32 generation;
+	int nr_ranges;
+	struct io_replay_range ranges[0];
+};
+
+struct io_replay_buf {
+	void *data;
+	size_t size;
+};
+
+static struct workqueue_struct *io_replay_wq;
+static atomic_t io_replay_opened = ATOMIC_INIT(0);
+
+static void replay_ranges(struct address_space *mapping, struct file *file,
+			  struct io_replay_work *rw)
+{
+	struct blk_plug plug;
+	pgoff_t offset;
+	unsigned long nr, chunk;
 	int i;
-	struct io_info *info;
 
-	for (i = 0; i < atomic_read(&record_buf_cursor); i++) {
-		info = record_buf + i;
-		fput(info->file);
+	if (unlikely(!mapping->a_ops->readpage && !mapping->a_ops->readpages))
+		return;
+
+	/*
+	 * Unlike force_page_cache_readahead(), do not clamp a range to the
+	 * readahead window, the recorded range is known to be needed.
+	 */
+	blk_start_plug(&plug);
+	for (i = 0; i < rw->nr_ranges; i++) {
+		offset = rw->ranges[i].offset;
+		nr = rw->ranges[i].nr_pages;
+		while (nr) {
+			chunk = min_t(unsigned long, nr, IO_REPLAY_CHUNK_PAGES);
+			__do_page_cache_readahead(mapping, file, offset,
+						  chunk, 0);
+			offset += chunk;
+			nr -= chunk;
+		}
+	}
+	blk_finish_plug(&plug);
+}
+
+/*
+ * Resolve (dev, ino, generation) of a compact record like open_by_handle_at()
+ * does. Only filesystems on a block device are allowed, as their readpage(s)
+ * do not need a struct file.
+ */
+static void replay_by_handle(struct io_replay_work *rw)
+{
+	struct block_device *bdev;
+	struct super_block *sb;
+	struct dentry *dentry;
+	struct fid fid;
+
+	if (rw->ino > U32_MAX)
+		return;
+
+	bdev = bdget(rw->dev);
+	if (!bdev)
+		return;
+	/* s_umount is held for read until replay is done */
+	sb = get_super(bdev);
+	bdput(bdev);
+	if (!sb)
+		return;
+
+	if (!(sb->s_type->fs_flags & FS_REQUIRES_DEV) ||
+	    !sb->s_export_op || !sb->s_export_op->fh_to_dentry)
+		goto out;
+
+	fid.i32.ino = rw->ino;
+	fid.i32.gen = rw->generation;
+	dentry = sb->s_export_op->fh_to_dentry(sb, &fid, 2, FILEID_INO32_GEN);
+	if (IS_ERR_OR_NULL(dentry))
+		goto out;
+
+	if (d_really_is_positive(dentry) && d_is_reg(dentry))
+		replay_ranges(d_inode(dentry)->i_mapping, NULL, rw);
+	dput(dentry);
+out:
+	drop_super(sb);
+}
+
+static void io_replay_workfn(struct work_struct *work)
+{
+	struct io_replay_work *rw = container_of(work, struct io_replay_work,
+						 work);
+
+	if (rw->file) {
+		replay_ranges(rw->file->f_mapping, rw->file, rw);
+		fput(rw->file);
+	} else {
+		replay_by_handle(rw);
+	}
+	kvfree(rw);
+}
+
+static inline int replay_get_int(void *pos)
+{
+	return get_unaligned((int *)pos);
+}
+
+/* return 0 on success, advance *pos past the varint */
+static int replay_get_varint(void **pos, void *end, u64 *val)
+{
+	u8 *p = *pos;
+	int shift;
+
+	*val = 0;
+	for (shift = 0; shift < 64; shift += 7) {
+		if ((void *)p >= end)
+			return -EINVAL;
+		*val |= (u64)(*p & 0x7f) << shift;
+		if (!(*p++ & 0x80)) {
+			*pos = p;
+			return 0;
+		}
+	}
+	return -EINVAL;
+}
+
+static struct io_replay_work *alloc_replay_work(int nr_ranges)
+{
+	struct io_replay_work *rw;
+
+	rw = kvzalloc(sizeof(*rw) + sizeof(struct io_replay_range) * nr_ranges,
+		      GFP_KERNEL);
+	if (rw)
+		INIT_WORK(&rw->work, io_replay_workfn);
+	return rw;
+}
+
+/*
+ * Ranges come from userspace, drop those that don't fit the int fields of
+ * struct io_replay_range. Only a range starting at or after the previous one
+ * is coalesced with it, unsorted input just yields more ranges.
+ */
+static void add_replay_range(struct io_replay_work *rw, u64 offset,
+			     u64 nr_pages)
+{
+	struct io_replay_range *last;
+
+	if (offset >= INT_MAX || !nr_pages || nr_pages > INT_MAX - offset)
+		return;
+
+	last = rw->nr_ranges ? &rw->ranges[rw->nr_ranges - 1] : NULL;
+	if (last && offset >= last->offset &&
+	    offset <= (u64)last->offset + last->nr_pages +
+		      IO_REPLAY_GAP_PAGES) {
+		last->nr_pages = max_t(u64, last->nr_pages,
+				       offset + nr_pages - last->offset);
+		return;
+	}
+	rw->ranges[rw->nr_ranges].offset = offset;
+	rw->ranges[rw->nr_ranges].nr_pages = nr_pages;
+	rw->nr_ranges++;
+}
+
+/*
+ * Queue the readahead for one IO_RECORD_FORMAT_PATH entry starting at @pos.
+ * Return the # of bytes consumed, or < 0 if the entry is malformed.
+ */
+static int replay_one_file(void *pos, void *end)
+{
+	char path[MAX_FILEPATH_LEN];
+	struct io_replay_work *rw;
+	void *cur = pos;
+	struct file *file;
+	int pathsize, nr_tuples;
+	int i;
+
+	if (cur + sizeof(int) > end)
+		return -EINVAL;
+	pathsize = replay_get_int(cur);
+	cur += sizeof(int);
+	if (pathsize <= 0 || pathsize >= MAX_FILEPATH_LEN ||
+	    cur + pathsize > end)
+		return -EINVAL;
+	memcpy(path, cur, pathsize);
+	path[pathsize] = '\0';
+	cur += pathsize;
+
+	/* count the tuples up to the end magic of this file */
+	for (nr_tuples = 0; ; nr_tuples++) {
+		void *tuple = cur + sizeof(int) * 2 * nr_tuples;
+
+		if (tuple + sizeof(int) * 2 > end)
+			return -EINVAL;
+		if (replay_get_int(tuple) == RESULT_BUF_END_MAGIC)
+			break;
+	}
+
+	rw = alloc_replay_work(nr_tuples);
+	if (!rw)
+		return -ENOMEM;
+
+	for (i = 0; i < nr_tuples; i++, cur += sizeof(int) * 2)
+		add_replay_range(rw, replay_get_int(cur),
+				 replay_get_int(cur + sizeof(int)));
+	cur += sizeof(int) * 2; /* end magic of this file */
+
+	if (!rw->nr_ranges)
+		goto skip;
+
+	/* a stale entry is not an error, skip to the next file */
+	file = filp_open(path, O_RDONLY | O_LARGEFILE, 0);
+	if (IS_ERR(file))
+		goto skip;
+
+	rw->file = file;
+	queue_work(io_replay_wq, &rw->work);
+
+	return cur - pos;
+skip:
+	kvfree(rw);
+	return cur - pos;
+}
+
+static int replay_records_path(void *data, size_t size)
+{
+	void *cur = data;
+	void *end = data + size;
+	int ret;
+
+	while (cur + sizeof(int) <= end) {
+		/* last magic of the result */
+		if (replay_get_int(cur) == RESULT_BUF_END_MAGIC)
+			return 0;
+		ret = replay_one_file(cur, end);
+		if (ret < 0)
+			return ret;
+		cur += ret;
+	}
+	return 0;
+}
+
+static int replay_records_compact(void *data, size_t size)
+{
+	struct io_record_compact_hdr *hdr = data;
+	struct io_replay_work *rw;
+	void *cur = data + sizeof(*hdr);
+	void *end = data + size;
+	u64 dev, ino, gen, nr_ranges, delta, nr_pages;
+	u64 offset;
+	u32 nr_files, i, j;
+
+	if (le16_to_cpu(hdr->version) != IO_RECORD_COMPACT_VERSION)
+		return -EINVAL;
+
+	nr_files = le32_to_cpu(hdr->nr_files);
+	for (i = 0; i < nr_files; i++) {
+		if (replay_get_varint(&cur, end, &dev) ||
+		    replay_get_varint(&cur, end, &ino) ||
+		    replay_get_varint(&cur, end, &gen) ||
+		    replay_get_varint(&cur, end, &nr_ranges))
+			return -EINVAL;
+
+		/* each range takes 2 bytes at least */
+		if (nr_ranges == 0 || nr_ranges > (end - cur) / 2)
+			return -EINVAL;
+
+		rw = alloc_replay_work(nr_ranges);
+		if (!rw)
+			return -ENOMEM;
+		rw->dev = new_decode_dev(dev);
+		rw->ino = ino;
+		rw->generation = gen;
+
+		for (offset = 0, j = 0; j < nr_ranges; j++) {
+			if (replay_get_varint(&cur, end, &delta) ||
+			    replay_get_varint(&cur, end, &nr_pages)) {
+				kvfree(rw);
+				return -EINVAL;
+			}
+			offset += delta;
+			/* out of range ones are skipped by add_replay_range() */
+			add_replay_range(rw, offset, nr_pages);
+			offset += nr_pages;
+		}
+
+		if (rw->nr_ranges)
+			queue_work(io_replay_wq, &rw->work);
+		else
+			kvfree(rw);
+	}
+	return 0;
+}
+
+static int replay_records(void *data, size_t size)
+{
+	struct io_record_compact_hdr *hdr = data;
+
+	if (size >= sizeof(*hdr) &&
+	    le32_to_cpu(hdr->magic) == IO_RECORD_COMPACT_MAGIC)
+		return replay_records_compact(data, size);
+	return replay_records_path(data, size);
+}
+
+static int io_replay_open(struct inode *inode, struct file *file)
+{
+	struct io_replay_buf *rb;
+
+	if (!capable(CAP_SYS_ADMIN))
+		return -EPERM;
+
+	/* only 1 context is allowed at a time */
+	if (atomic_inc_return(&io_replay_opened) != 1) {
+		atomic_dec(&io_replay_opened);
+		return -EBUSY;
+	}
+
+	rb = kzalloc(sizeof(*rb), GFP_KERNEL);
+	if (!rb)
+		goto fail;
+	rb->data = vmalloc(RESULT_BUF_SIZE_IN_BYTES);
+	if (!rb->data) {
+		kfree(rb);
+		goto fail;
+	}
+	file->private_data = rb;
+	return 0;
+fail:
+	atomic_dec(&io_replay_opened);
+	return -ENOMEM;
+}
+
+static ssize_t io_replay_write(struct file *file, const char __user *buf,
+			       size_t count, loff_t *ppos)
+{
+	struct io_replay_buf *rb = file->private_data;
+
+	if (count > RESULT_BUF_SIZE_IN_BYTES - rb->size)
+		return -ENOSPC;
+	if (copy_from_user(rb->data + rb->size, buf, count))
+		return -EFAULT;
+	rb->size += count;
+	*ppos += count;
+	return count;
+}
+
+static int io_replay_release(struct inode *inode, struct file *file)
+{
+	struct io_replay_buf *rb = file->private_data;
+	int ret;
+
+	ret = replay_records(rb->data, rb->size);
+	if (ret < 0)
+		pr_err("%s: malformed record at the end, %d\n", __func__, ret);
+
+	vfree(rb->data);
+	kfree(rb);
+	atomic_dec(&io_replay_opened);
+	return 0;
+}
+
+static const struct file_operations io_replay_fops = {
+	.open		= io_replay_open,
+	.write		= io_replay_write,
+	.release	= io_replay_release,
+	.llseek		= noop_llseek,
+};
+
+static void __init io_replay_init(void)
+{
+	io_replay_wq = alloc_workqueue("io_replay", WQ_UNBOUND,
+				       IO_REPLAY_MAX_ACTIVE);
+	if (!io_replay_wq) {
+		pr_err("%s: failed to create workqueue\n", __func__);
+		return;
+	}
+
+	if (!proc_create("io_record_replay", S_IWUSR, NULL, &io_replay_fops)) {
+		pr_err("%s: failed to create proc entry\n", __func__);
+		destroy_workqueue(io_replay_wq);
+		io_replay_wq = NULL;
 	}
 }
 
 static int __init io_record_init(void)
 {
+	if (alloc_pcpu_bufs())
+		goto pcpu_buf_fail;
+
 	record_buf = vzalloc(sizeof(struct io_info) * NUM_IO_INFO_IN_BUF);
 	if (!record_buf)
 		goto record_buf_fail;
@@ -477,10 +1076,14 @@ static int __init io_record_init(void)
 		BUG_ON(1); /* should success at boot time */
 
 	mutex_unlock(&status_lock);
+
+	io_replay_init();
 	return 0;
 result_buf_fail:
 	vfree(record_buf);
 record_buf_fail:
+	free_pcpu_bufs();
+pcpu_buf_fail:
 	return -1;
 }
 
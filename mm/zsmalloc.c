@@ -194,6 +194,14 @@ static struct vfsmount *zsmalloc_mnt;
 static const int fullness_threshold_frac = 4;
 static size_t huge_class_size;
 
+/*
+ * zs_free() queues background compaction of a class once at least
+ * ZS_BG_COMPACT_MIN_PAGES pages could be freed by it and those make up
+ * ZS_BG_COMPACT_RATIO percent of the pages the class uses.
+ */
+#define ZS_BG_COMPACT_MIN_PAGES	32
+#define ZS_BG_COMPACT_RATIO	25
+
 struct size_class {
 	spinlock_t lock;
 	struct list_head fullness_list[NR_ZS_FULLNESS];
@@ -259,6 +267,9 @@ struct zs_pool {
 
 	/* Compact classes */
 	struct shrinker shrinker;
+	/* Compact fragmented classes in the background, see zs_free() */
+	struct work_struct compact_work;
+	DECLARE_BITMAP(compact_pending, ZS_SIZE_CLASSES);
 	/*
 	 * To signify that register_shrinker() was successful
 	 * and unregister_shrinker() will not Oops.
@@ -599,6 +610,7 @@ static void __exit zs_stat_exit(void)
 }
 
 static unsigned long zs_can_compact(struct size_class *class);
+static void zs_kick_compact(struct zs_pool *pool, struct size_class *class);
 
 static int zs_stats_size_show(struct seq_file *s, void *v)
 {
@@ -1643,6 +1655,7 @@ void zs_free(struct zs_pool *pool, unsigned long handle)
 	fullness = fix_fullness_group(class, zspage);
 	if (fullness != ZS_EMPTY) {
 		migrate_read_unlock(zspage);
+		zs_kick_compact(pool, class);
 		goto out;
 	}
 
@@ -2383,6 +2396,44 @@ static unsigned long __zs_compact(struct zs_pool *pool,
 	return pages_freed;
 }
 
+/*
+ * Called with class->lock held. Cheap enough for every zs_free(), as it
+ * only looks at the class statistics.
+ */
+static void zs_kick_compact(struct zs_pool *pool, struct size_class *class)
+{
+	unsigned long pages_wasted = zs_can_compact(class);
+	unsigned long pages_used;
+
+	if (pages_wasted < ZS_BG_COMPACT_MIN_PAGES)
+		return;
+
+	pages_used = zs_stat_get(class, OBJ_ALLOCATED) /
+			class->objs_per_zspage * class->pages_per_zspage;
+	if (pages_wasted * 100 < pages_used * ZS_BG_COMPACT_RATIO)
+		return;
+
+	/* compacting a large class takes a while, keep it off per-cpu workers */
+	if (!test_and_set_bit(class->index, pool->compact_pending))
+		queue_work(system_unbound_wq, &pool->compact_work);
+}
+
+static void async_compact(struct work_struct *work)
+{
+	int i;
+	struct size_class *class;
+	unsigned long pages_freed = 0;
+	struct zs_pool *pool = container_of(work, struct zs_pool,
+					compact_work);
+
+	for_each_set_bit(i, pool->compact_pending, ZS_SIZE_CLASSES) {
+		clear_bit(i, pool->compact_pending);
+		class = pool->size_class[i];
+		pages_freed += __zs_compact(pool, class);
+	}
+	atomic_long_add(pages_freed, &pool->stats.pages_compacted);
+}
+
 unsigned long zs_compact(struct zs_pool *pool)
 {
 	int i;
@@ -2487,6 +2538,7 @@ struct zs_pool *zs_create_pool(const char *name)
 		return NULL;
 
 	init_deferred_free(pool);
+	INIT_WORK(&pool->compact_work, async_compact);
 
 	pool->name = kstrdup(name, GFP_KERNEL);
 	if (!pool->name)
@@ -2595,6 +2647,7 @@ void zs_destroy_pool(struct zs_pool *pool)
 	int i;
 
 	zs_unregister_shrinker(pool);
+	cancel_work_sync(&pool->compact_work);
 	zs_unregister_migration(pool);
 	zs_pool_stat_destroy(pool);
 
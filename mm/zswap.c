@@ -30,7 +30,7 @@
 #include <linux/types.h>
 #include <linux/atomic.h>
 #include <linux/frontswap.h>
-#include <linux/rbtree.h>
+#include <linux/radix-tree.h>
 #include <linux/swap.h>
 #include <linux/crypto.h>
 #include <linux/mempool.h>
@@ -41,6 +41,7 @@
 #include <linux/swapops.h>
 #include <linux/writeback.h>
 #include <linux/pagemap.h>
+#include <linux/blkdev.h>
 
 /*********************************
 * statistics
@@ -49,6 +50,8 @@
 static u64 zswap_pool_total_size;
 /* The number of compressed pages currently stored in zswap */
 static atomic_t zswap_stored_pages = ATOMIC_INIT(0);
+/* The number of same-value filled pages currently stored in zswap */
+static atomic_t zswap_same_filled_pages = ATOMIC_INIT(0);
 
 /*
  * The statistics below are not protected from concurrent access for
@@ -116,6 +119,18 @@ module_param_cb(zpool, &zswap_zpool_param_ops, &zswap_zpool_type, 0644);
 static unsigned int zswap_max_pool_percent = 20;
 module_param_named(max_pool_percent, zswap_max_pool_percent, uint, 0644);
 
+/*
+ * The number of pool pages written back each time the pool limit is hit.
+ * Their writes are plugged together, so the block layer can merge them.
+ */
+static unsigned int zswap_writeback_batch = 16;
+module_param_named(writeback_batch, zswap_writeback_batch, uint, 0644);
+
+/* Enable/disable handling same-value filled pages (enabled by default) */
+static bool zswap_same_filled_pages_enabled = true;
+module_param_named(same_filled_pages_enabled, zswap_same_filled_pages_enabled,
+		   bool, 0644);
+
 /*********************************
 * data structures
 **********************************/
@@ -136,26 +151,30 @@ struct zswap_pool {
  * This structure contains the metadata for tracking a single compressed
  * page within zswap.
  *
- * rbnode - links the entry into red-black tree for the appropriate swap type
- * offset - the swap offset for the entry.  Index into the red-black tree.
+ * offset - the swap offset for the entry.  Index into the radix tree.
  * refcount - the number of outstanding reference to the entry. This is needed
  *            to protect against premature freeing of the entry by code
- *            concurrent calls to load, invalidate, and writeback.  The lock
- *            for the zswap_tree structure that contains the entry must
- *            be held while changing the refcount.  Since the lock must
- *            be held, there is no reason to also make refcount atomic.
+ *            concurrent calls to load, invalidate, and writeback.  It only
+ *            drops to zero with the lock for the zswap_tree held, see
+ *            zswap_entry_put(), so lookups under that lock always see a
+ *            live entry.  RCU lookups must use atomic_inc_not_zero().
  * length - the length in bytes of the compressed page data.  Needed during
- *          decompression
+ *          decompression. 0 for a same-value filled page.
  * pool - the zswap_pool the entry's data is in
  * handle - zpool allocation handle that stores the compressed page data
+ * value - value of the same-value filled page which has same content
+ * rcu - entries are freed after a grace period for RCU lookups
  */
 struct zswap_entry {
-	struct rb_node rbnode;
 	pgoff_t offset;
-	int refcount;
+	atomic_t refcount;
 	unsigned int length;
 	struct zswap_pool *pool;
-	unsigned long handle;
+	union {
+		unsigned long handle;
+		unsigned long value;
+	};
+	struct rcu_head rcu;
 };
 
 struct zswap_header {
@@ -164,11 +183,12 @@ struct zswap_header {
 
 /*
  * The tree lock in the zswap_tree struct protects a few things:
- * - the rbtree
- * - the refcount field of each entry in the tree
+ * - modifications of the radix tree
+ * - the last put of each entry in the tree
+ * zswap_frontswap_load() looks entries up under RCU only.
  */
 struct zswap_tree {
-	struct rb_root rbroot;
+	struct radix_tree_root root;
 	spinlock_t lock;
 };
 
@@ -249,8 +269,7 @@ static struct zswap_entry *zswap_entry_cache_alloc(gfp_t gfp)
 	entry = kmem_cache_alloc(zswap_entry_cache, gfp);
 	if (!entry)
 		return NULL;
-	entry->refcount = 1;
-	RB_CLEAR_NODE(&entry->rbnode);
+	atomic_set(&entry->refcount, 1);
 	return entry;
 }
 
@@ -259,59 +278,41 @@ static void zswap_entry_cache_free(struct zswap_entry *entry)
 	kmem_cache_free(zswap_entry_cache, entry);
 }
 
+static void zswap_entry_cache_free_rcu(struct rcu_head *head)
+{
+	zswap_entry_cache_free(container_of(head, struct zswap_entry, rcu));
+}
+
 /*********************************
-* rbtree functions
+* radix tree functions
 **********************************/
-static struct zswap_entry *zswap_rb_search(struct rb_root *root, pgoff_t offset)
+/* caller must hold the tree lock or rcu_read_lock() */
+static struct zswap_entry *zswap_tree_search(struct zswap_tree *tree,
+					     pgoff_t offset)
 {
-	struct rb_node *node = root->rb_node;
-	struct zswap_entry *entry;
-
-	while (node) {
-		entry = rb_entry(node, struct zswap_entry, rbnode);
-		if (entry->offset > offset)
-			node = node->rb_left;
-		else if (entry->offset < offset)
-			node = node->rb_right;
-		else
-			return entry;
-	}
-	return NULL;
+	return radix_tree_lookup(&tree->root, offset);
 }
 
 /*
  * In the case that a entry with the same offset is found, a pointer to
  * the existing entry is stored in dupentry and the function returns -EEXIST
+ * caller must hold the tree lock and have preloaded the radix tree
  */
-static int zswap_rb_insert(struct rb_root *root, struct zswap_entry *entry,
+static int zswap_tree_insert(struct zswap_tree *tree, struct zswap_entry *entry,
 			struct zswap_entry **dupentry)
 {
-	struct rb_node **link = &root->rb_node, *parent = NULL;
-	struct zswap_entry *myentry;
-
-	while (*link) {
-		parent = *link;
-		myentry = rb_entry(parent, struct zswap_entry, rbnode);
-		if (myentry->offset > entry->offset)
-			link = &(*link)->rb_left;
-		else if (myentry->offset < entry->offset)
-			link = &(*link)->rb_right;
-		else {
-			*dupentry = myentry;
-			return -EEXIST;
-		}
-	}
-	rb_link_node(&entry->rbnode, parent, link);
-	rb_insert_color(&entry->rbnode, root);
-	return 0;
+	int ret;
+
+	ret = radix_tree_insert(&tree->root, entry->offset, entry);
+	if (ret == -EEXIST)
+		*dupentry = radix_tree_lookup(&tree->root, entry->offset);
+	return ret;
 }
 
-static void zswap_rb_erase(struct rb_root *root, struct zswap_entry *entry)
+/* caller must hold the tree lock, does nothing if entry is not on the tree */
+static void zswap_tree_erase(struct zswap_tree *tree, struct zswap_entry *entry)
 {
-	if (!RB_EMPTY_NODE(&entry->rbnode)) {
-		rb_erase(&entry->rbnode, root);
-		RB_CLEAR_NODE(&entry->rbnode);
-	}
+	radix_tree_delete_item(&tree->root, entry->offset, entry);
 }
 
 /*
@@ -320,9 +321,13 @@ static void zswap_rb_erase(struct rb_root *root, struct zswap_entry *entry)
  */
 static void zswap_free_entry(struct zswap_entry *entry)
 {
-	zpool_free(entry->pool->zpool, entry->handle);
-	zswap_pool_put(entry->pool);
-	zswap_entry_cache_free(entry);
+	if (!entry->length)
+		atomic_dec(&zswap_same_filled_pages);
+	else {
+		zpool_free(entry->pool->zpool, entry->handle);
+		zswap_pool_put(entry->pool);
+	}
+	call_rcu(&entry->rcu, zswap_entry_cache_free_rcu);
 	atomic_dec(&zswap_stored_pages);
 	zswap_update_total_size();
 }
@@ -330,7 +335,7 @@ static void zswap_free_entry(struct zswap_entry *entry)
 /* caller must hold the tree lock */
 static void zswap_entry_get(struct zswap_entry *entry)
 {
-	entry->refcount++;
+	atomic_inc(&entry->refcount);
 }
 
 /* caller must hold the tree lock
@@ -339,28 +344,72 @@ static void zswap_entry_get(struct zswap_entry *entry)
 static void zswap_entry_put(struct zswap_tree *tree,
 			struct zswap_entry *entry)
 {
-	int refcount = --entry->refcount;
+	int refcount = atomic_dec_return(&entry->refcount);
 
 	BUG_ON(refcount < 0);
 	if (refcount == 0) {
-		zswap_rb_erase(&tree->rbroot, entry);
+		zswap_tree_erase(tree, entry);
 		zswap_free_entry(entry);
 	}
 }
 
+/*
+ * zswap_entry_put() for callers without the tree lock. Only the last
+ * reference needs the lock, to take the entry off the tree.
+ */
+static void zswap_entry_put_unlocked(struct zswap_tree *tree,
+			struct zswap_entry *entry)
+{
+	if (atomic_add_unless(&entry->refcount, -1, 1))
+		return;
+
+	spin_lock(&tree->lock);
+	zswap_entry_put(tree, entry);
+	spin_unlock(&tree->lock);
+}
+
+/*
+ * caller must hold the tree lock
+ * like zswap_entry_put() for an entry already off the tree, but leaves
+ * the freeing to the caller so it can be done after the lock is dropped.
+ * Returns true if this was the last reference.
+ */
+static bool zswap_entry_put_deferred(struct zswap_entry *entry)
+{
+	int refcount = atomic_dec_return(&entry->refcount);
+
+	BUG_ON(refcount < 0);
+	return refcount == 0;
+}
+
 /* caller must hold the tree lock */
-static struct zswap_entry *zswap_entry_find_get(struct rb_root *root,
+static struct zswap_entry *zswap_entry_find_get(struct zswap_tree *tree,
 				pgoff_t offset)
 {
 	struct zswap_entry *entry;
 
-	entry = zswap_rb_search(root, offset);
+	entry = zswap_tree_search(tree, offset);
 	if (entry)
 		zswap_entry_get(entry);
 
 	return entry;
 }
 
+/* lockless version of zswap_entry_find_get() */
+static struct zswap_entry *zswap_entry_find_get_rcu(struct zswap_tree *tree,
+				pgoff_t offset)
+{
+	struct zswap_entry *entry;
+
+	rcu_read_lock();
+	entry = zswap_tree_search(tree, offset);
+	if (entry && !atomic_inc_not_zero(&entry->refcount))
+		entry = NULL;
+	rcu_read_unlock();
+
+	return entry;
+}
+
 /*********************************
 * per-cpu code
 **********************************/
@@ -856,7 +905,7 @@ static int zswap_writeback_entry(struct zpool *pool, unsigned long handle)
 
 	/* find and ref zswap entry */
 	spin_lock(&tree->lock);
-	entry = zswap_entry_find_get(&tree->rbroot, offset);
+	entry = zswap_entry_find_get(tree, offset);
 	if (!entry) {
 		/* entry was invalidated */
 		spin_unlock(&tree->lock);
@@ -915,7 +964,7 @@ static int zswap_writeback_entry(struct zpool *pool, unsigned long handle)
 	*     because invalidate happened during writeback
 	*  search the tree and free the entry if find entry
 	*/
-	if (entry == zswap_rb_search(&tree->rbroot, offset))
+	if (entry == zswap_tree_search(tree, offset))
 		zswap_entry_put(tree, entry);
 	spin_unlock(&tree->lock);
 
@@ -937,20 +986,52 @@ static int zswap_writeback_entry(struct zpool *pool, unsigned long handle)
 	return ret;
 }
 
+/*
+ * Evicts up to zswap_writeback_batch pages, coldest first as the zpool
+ * keeps them in LRU order, and submits their writes as one batch.
+ * Returns 0 if at least one page could be evicted.
+ */
 static int zswap_shrink(void)
 {
 	struct zswap_pool *pool;
+	struct blk_plug plug;
+	unsigned int reclaimed = 0;
 	int ret;
 
 	pool = zswap_pool_last_get();
 	if (!pool)
 		return -ENOENT;
 
-	ret = zpool_shrink(pool->zpool, 1, NULL);
+	blk_start_plug(&plug);
+	ret = zpool_shrink(pool->zpool, max(READ_ONCE(zswap_writeback_batch), 1U),
+			   &reclaimed);
+	blk_finish_plug(&plug);
 
 	zswap_pool_put(pool);
 
-	return ret;
+	return reclaimed ? 0 : ret;
+}
+
+static int zswap_is_page_same_filled(void *ptr, unsigned long *value)
+{
+	unsigned int pos;
+	unsigned long *page;
+
+	page = (unsigned long *)ptr;
+	for (pos = 1; pos < PAGE_SIZE / sizeof(*page); pos++) {
+		if (page[pos] != page[0])
+			return 0;
+	}
+	*value = page[0];
+	return 1;
+}
+
+static void zswap_fill_page(void *ptr, unsigned long value)
+{
+	unsigned long *page;
+
+	page = (unsigned long *)ptr;
+	memset_l(page, value, PAGE_SIZE / sizeof(unsigned long));
 }
 
 /*********************************
@@ -961,11 +1042,11 @@ static int zswap_frontswap_store(unsigned type, pgoff_t offset,
 				struct page *page)
 {
 	struct zswap_tree *tree = zswap_trees[type];
-	struct zswap_entry *entry, *dupentry;
+	struct zswap_entry *entry, *dupentry, *stale = NULL;
 	struct crypto_comp *tfm;
 	int ret;
 	unsigned int dlen = PAGE_SIZE, len;
-	unsigned long handle;
+	unsigned long handle, value;
 	char *buf;
 	u8 *src, *dst;
 	struct zswap_header *zhdr;
@@ -1008,6 +1089,19 @@ static int zswap_frontswap_store(unsigned type, pgoff_t offset,
 		goto reject;
 	}
 
+	if (zswap_same_filled_pages_enabled) {
+		src = kmap_atomic(page);
+		if (zswap_is_page_same_filled(src, &value)) {
+			kunmap_atomic(src);
+			entry->offset = offset;
+			entry->length = 0;
+			entry->value = value;
+			atomic_inc(&zswap_same_filled_pages);
+			goto insert_entry;
+		}
+		kunmap_atomic(src);
+	}
+
 	/* if entry is successfully added, it keeps the reference */
 	entry->pool = zswap_pool_current_get();
 	if (!entry->pool) {
@@ -1052,18 +1146,38 @@ static int zswap_frontswap_store(unsigned type, pgoff_t offset,
 	entry->handle = handle;
 	entry->length = dlen;
 
+insert_entry:
 	/* map */
+	if (radix_tree_preload(GFP_KERNEL)) {
+		zswap_reject_alloc_fail++;
+		ret = -ENOMEM;
+		goto freeentry;
+	}
 	spin_lock(&tree->lock);
 	do {
-		ret = zswap_rb_insert(&tree->rbroot, entry, &dupentry);
+		ret = zswap_tree_insert(tree, entry, &dupentry);
 		if (ret == -EEXIST) {
 			zswap_duplicate_entry++;
-			/* remove from rbtree */
-			zswap_rb_erase(&tree->rbroot, dupentry);
-			zswap_entry_put(tree, dupentry);
+			/* remove from radix tree */
+			zswap_tree_erase(tree, dupentry);
+			if (!zswap_entry_put_deferred(dupentry))
+				continue;
+			if (stale)
+				zswap_free_entry(stale);
+			stale = dupentry;
 		}
 	} while (ret == -EEXIST);
 	spin_unlock(&tree->lock);
+	radix_tree_preload_end();
+
+	/* free the replaced entry without holding up the tree */
+	if (stale)
+		zswap_free_entry(stale);
+
+	if (ret) {
+		zswap_reject_alloc_fail++;
+		goto freeentry;
+	}
 
 	/* update stats */
 	atomic_inc(&zswap_stored_pages);
@@ -1071,6 +1185,14 @@ static int zswap_frontswap_store(unsigned type, pgoff_t offset,
 
 	return 0;
 
+freeentry:
+	/* not mapped, so nobody else can have seen it */
+	if (entry->length) {
+		zpool_free(entry->pool->zpool, entry->handle);
+		zswap_pool_put(entry->pool);
+	} else
+		atomic_dec(&zswap_same_filled_pages);
+	goto freepage;
 put_dstmem:
 	put_cpu_var(zswap_dstmem);
 	zswap_pool_put(entry->pool);
@@ -1095,14 +1217,18 @@ static int zswap_frontswap_load(unsigned type, pgoff_t offset,
 	int ret;
 
 	/* find */
-	spin_lock(&tree->lock);
-	entry = zswap_entry_find_get(&tree->rbroot, offset);
+	entry = zswap_entry_find_get_rcu(tree, offset);
 	if (!entry) {
 		/* entry was written back */
-		spin_unlock(&tree->lock);
 		return -1;
 	}
-	spin_unlock(&tree->lock);
+
+	if (!entry->length) {
+		dst = kmap_atomic(page);
+		zswap_fill_page(dst, entry->value);
+		kunmap_atomic(dst);
+		goto freeentry;
+	}
 
 	/* decompress */
 	dlen = PAGE_SIZE;
@@ -1116,9 +1242,8 @@ static int zswap_frontswap_load(unsigned type, pgoff_t offset,
 	zpool_unmap_handle(entry->pool->zpool, entry->handle);
 	BUG_ON(ret);
 
-	spin_lock(&tree->lock);
-	zswap_entry_put(tree, entry);
-	spin_unlock(&tree->lock);
+freeentry:
+	zswap_entry_put_unlocked(tree, entry);
 
 	return 0;
 }
@@ -1131,15 +1256,15 @@ static void zswap_frontswap_invalidate_page(unsigned type, pgoff_t offset)
 
 	/* find */
 	spin_lock(&tree->lock);
-	entry = zswap_rb_search(&tree->rbroot, offset);
+	entry = zswap_tree_search(tree, offset);
 	if (!entry) {
 		/* entry was written back */
 		spin_unlock(&tree->lock);
 		return;
 	}
 
-	/* remove from rbtree */
-	zswap_rb_erase(&tree->rbroot, entry);
+	/* remove from radix tree */
+	zswap_tree_erase(tree, entry);
 
 	/* drop the initial reference from entry creation */
 	zswap_entry_put(tree, entry);
@@ -1151,16 +1276,20 @@ static void zswap_frontswap_invalidate_page(unsigned type, pgoff_t offset)
 static void zswap_frontswap_invalidate_area(unsigned type)
 {
 	struct zswap_tree *tree = zswap_trees[type];
-	struct zswap_entry *entry, *n;
+	struct zswap_entry *entry;
+	struct radix_tree_iter iter;
+	void __rcu **slot;
 
 	if (!tree)
 		return;
 
 	/* walk the tree and free everything */
 	spin_lock(&tree->lock);
-	rbtree_postorder_for_each_entry_safe(entry, n, &tree->rbroot, rbnode)
+	radix_tree_for_each_slot(slot, &tree->root, &iter, 0) {
+		entry = radix_tree_deref_slot_protected(slot, &tree->lock);
+		radix_tree_iter_delete(&tree->root, &iter, slot);
 		zswap_free_entry(entry);
-	tree->rbroot = RB_ROOT;
+	}
 	spin_unlock(&tree->lock);
 	kfree(tree);
 	zswap_trees[type] = NULL;
@@ -1176,7 +1305,7 @@ static void zswap_frontswap_init(unsigned type)
 		return;
 	}
 
-	tree->rbroot = RB_ROOT;
+	INIT_RADIX_TREE(&tree->root, GFP_ATOMIC);
 	spin_lock_init(&tree->lock);
 	zswap_trees[type] = tree;
 }
@@ -1224,6 +1353,8 @@ static int __init zswap_debugfs_init(void)
 			zswap_debugfs_root, &zswap_pool_total_size);
 	debugfs_create_atomic_t("stored_pages", S_IRUGO,
 			zswap_debugfs_root, &zswap_stored_pages);
+	debugfs_create_atomic_t("same_filled_pages", S_IRUGO,
+			zswap_debugfs_root, &zswap_same_filled_pages);
 
 	return 0;
 }